@@ -0,0 +1,125 @@
+// Frustum test alone against frustum and normal cone tests in
+// ClusterCuller, on a closed sphere seen from cameras orbiting it, far
+// enough to see it whole and close enough for the frustum to clip it.
+
+#include "mesh.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+constexpr size_t SEGMENTS = 256;
+constexpr size_t RINGS = 128;
+constexpr size_t CAMERAS = 64;
+constexpr int RUNS = 20;
+constexpr float PI = 3.14159265f;
+
+// The seam column and the pole rows are duplicated vertices, as an importer
+// would split them for the UVs, compute_closed() welds them back
+static Mesh sphere() {
+  std::vector<Vertex> vertices;
+  for (size_t ring = 0; ring <= RINGS; ring++)
+    for (size_t segment = 0; segment <= SEGMENTS; segment++) {
+      const float u = static_cast<float>(segment) / SEGMENTS;
+      const float v = static_cast<float>(ring) / RINGS;
+      // the duplicates must land on the exact same position
+      const float theta =
+          static_cast<float>(segment % SEGMENTS) / SEGMENTS * 2.0f * PI;
+      const float phi = v * PI;
+      const float radius =
+          ring == 0 || ring == RINGS ? 0.0f : std::sin(phi);
+      const glm::vec3 normal(radius * std::cos(theta),
+                             ring == RINGS ? -1.0f : std::cos(phi),
+                             radius * std::sin(theta));
+      vertices.push_back(Vertex{normal, normal, glm::vec2(u, v)});
+    }
+
+  std::vector<unsigned int> indices;
+  for (size_t ring = 0; ring < RINGS; ring++)
+    for (size_t segment = 0; segment < SEGMENTS; segment++) {
+      const auto at = [](size_t r, size_t s) {
+        return static_cast<unsigned int>(r * (SEGMENTS + 1) + s);
+      };
+      // counter clockwise seen from outside
+      indices.insert(indices.end(),
+                     {at(ring, segment), at(ring, segment + 1),
+                      at(ring + 1, segment), at(ring, segment + 1),
+                      at(ring + 1, segment + 1), at(ring + 1, segment)});
+    }
+
+  Mesh mesh(std::move(vertices), std::move(indices), {});
+  mesh.compute_bounds();
+  mesh.compute_closed();
+  mesh.clusters =
+      build_clusters(mesh.indices, mesh.indices.size(), mesh.vertices);
+  return mesh;
+}
+
+struct Result {
+  double ms = 0.0;
+  size_t clusters = 0;
+  size_t triangles = 0;
+};
+
+// best time of one cull() per camera, visible totals over every camera
+static Result measure(const Mesh &mesh, float distance, bool cull_backfaces) {
+  const glm::mat4 projection =
+      glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.05f, 100.0f);
+  ClusterCuller culler;
+  Result result;
+  result.ms = 1e9;
+  for (int run = 0; run < RUNS; run++) {
+    size_t clusters = 0, triangles = 0;
+    double ms = 0.0;
+    for (size_t c = 0; c < CAMERAS; c++) {
+      const float angle =
+          static_cast<float>(c) / CAMERAS * 2.0f * PI;
+      const glm::vec3 camera(std::cos(angle) * distance,
+                             std::sin(angle * 3.0f) * 0.5f,
+                             std::sin(angle) * distance);
+      const glm::mat4 view =
+          glm::lookAt(camera, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+      const auto start = std::chrono::high_resolution_clock::now();
+      culler.reset();
+      culler.begin(Frustum::from(projection * view), camera, cull_backfaces);
+      culler.cull(mesh.clusters, 0, GL_UNSIGNED_INT, 0);
+      ms += std::chrono::duration<double, std::milli>(
+                std::chrono::high_resolution_clock::now() - start)
+                .count();
+
+      clusters += culler.visible;
+      for (GLsizei count : culler.counts)
+        triangles += static_cast<size_t>(count) / 3;
+    }
+    result.ms = std::min(result.ms, ms / CAMERAS);
+    result.clusters = clusters / CAMERAS;
+    result.triangles = triangles / CAMERAS;
+  }
+  return result;
+}
+
+int main() {
+  const Mesh mesh = sphere();
+  std::cout << mesh.indices.size() / 3 << " triangles, "
+            << mesh.clusters.size() << " clusters, "
+            << (mesh.closed ? "closed" : "open") << "\n";
+
+  for (float distance : {3.0f, 1.3f}) {
+    const Result frustum = measure(mesh, distance, false);
+    const Result cones = measure(mesh, distance, true);
+    std::cout << "camera at " << distance << " radius\n"
+              << "  frustum:         " << frustum.ms * 1000.0 << " us, "
+              << frustum.clusters << " clusters, " << frustum.triangles
+              << " triangles\n"
+              << "  frustum + cones: " << cones.ms * 1000.0 << " us, "
+              << cones.clusters << " clusters, " << cones.triangles
+              << " triangles\n";
+  }
+  return 0;
+}
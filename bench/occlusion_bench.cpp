@@ -0,0 +1,98 @@
+// Rasterization cost and rejection rate of OcclusionCuller on a synthetic
+// indoor scene: rows of walls in front of the camera with small props
+// scattered between and behind them.
+
+#include "occlusion_culler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+constexpr size_t FRAMES = 200;
+constexpr size_t WALL_ROWS = 6;
+constexpr size_t WALLS_PER_ROW = 8;
+constexpr size_t PROPS = 10000;
+
+// 12 triangles, counter clockwise seen from outside
+static Occluder box_occluder(const glm::vec3 &min, const glm::vec3 &max) {
+  Occluder occluder;
+  for (int corner = 0; corner < 8; corner++)
+    occluder.positions.push_back(glm::vec3(corner & 1 ? max.x : min.x,
+                                           corner & 2 ? max.y : min.y,
+                                           corner & 4 ? max.z : min.z));
+  occluder.indices = {0, 2, 3, 0, 3, 1, 4, 5, 7, 4, 7, 6,
+                      0, 1, 5, 0, 5, 4, 2, 6, 7, 2, 7, 3,
+                      0, 4, 6, 0, 6, 2, 1, 3, 7, 1, 7, 5};
+  return occluder;
+}
+
+int main() {
+  std::mt19937 random(42);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+  // walls 4 units wide with gaps between them, one row every 6 units
+  std::vector<Occluder> walls;
+  for (size_t row = 0; row < WALL_ROWS; row++)
+    for (size_t column = 0; column < WALLS_PER_ROW; column++) {
+      const float x = (static_cast<float>(column) - 4.0f) * 5.0f +
+                      unit(random) * 2.0f;
+      const float z = -8.0f - static_cast<float>(row) * 6.0f;
+      walls.push_back(box_occluder(glm::vec3(x, -1.0f, z - 0.2f),
+                                   glm::vec3(x + 4.0f, 4.0f, z + 0.2f)));
+    }
+
+  std::vector<BoundingBox> props;
+  for (size_t i = 0; i < PROPS; i++) {
+    const glm::vec3 center((unit(random) - 0.5f) * 40.0f,
+                           unit(random) * 3.0f - 1.0f,
+                           -6.0f - unit(random) * 40.0f);
+    const glm::vec3 half(0.1f + unit(random) * 0.4f);
+    props.push_back(BoundingBox{center - half, center + half});
+  }
+
+  const glm::mat4 projection = glm::perspective(
+      glm::radians(60.0f),
+      static_cast<float>(OCCLUSION_WIDTH) /
+          static_cast<float>(OCCLUSION_HEIGHT),
+      0.1f, 200.0f);
+  const glm::mat4 view =
+      glm::lookAt(glm::vec3(0.0f, 1.5f, 0.0f), glm::vec3(0.0f, 1.5f, -1.0f),
+                  glm::vec3(0.0f, 1.0f, 0.0f));
+
+  OcclusionCuller culler;
+  double raster_total = 0.0, raster_best = 1e9, test_total = 0.0;
+  size_t occluded = 0;
+  for (size_t frame = 0; frame < FRAMES; frame++) {
+    culler.begin(projection * view);
+    for (const Occluder &wall : walls)
+      culler.add_occluder(wall, glm::mat4(1.0f));
+    culler.rasterize();
+    raster_total += culler.stats().raster_ms;
+    raster_best = std::min(raster_best, culler.stats().raster_ms);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    occluded = 0;
+    for (const BoundingBox &prop : props)
+      occluded += culler.is_occluded(prop, glm::mat4(1.0f));
+    auto end = std::chrono::high_resolution_clock::now();
+    test_total +=
+        std::chrono::duration<double, std::milli>(end - start).count();
+  }
+
+  const double frames = static_cast<double>(FRAMES);
+  std::cout << "Occluder triangles drawn: " << culler.stats().triangles
+            << "\nRaster: " << raster_total / frames << " ms average, "
+            << raster_best << " ms best"
+            << "\nTests: " << test_total / frames << " ms for " << PROPS
+            << " boxes"
+            << "\nRejected: "
+            << 100.0 * static_cast<double>(occluded) /
+                   static_cast<double>(PROPS)
+            << "%\n";
+  return 0;
+}
@@ -0,0 +1,156 @@
+// Per frame cost of SpatialIndex with 100k entities in a registry, moving
+// the way a crowd would: a velocity each, patched every frame. The signals
+// do part of the work during the patches, the same patches are timed on a
+// registry without an index to tell it apart. Between two frames a buffer
+// larger than the caches is written over, the way rendering and the rest of
+// a frame would, so neither run finds the components still in cache. Then
+// the queries.
+// Usage: spatial_bench [moving fraction] [speed per frame]
+
+#include "spatial_index.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+constexpr size_t ENTITIES = 100000;
+constexpr size_t FRAMES = 300;
+constexpr float WORLD_SIZE = 1000.0f;
+constexpr size_t SPHERE_QUERIES = 1000;
+constexpr size_t REST_OF_FRAME_BYTES = 64 << 20;
+
+static double
+elapsed_ms(std::chrono::high_resolution_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::high_resolution_clock::now() - start)
+      .count();
+}
+
+int main(int argc, char **argv) {
+  const float moving = argc > 1 ? std::strtof(argv[1], nullptr) : 1.0f;
+  const float speed = argc > 2 ? std::strtof(argv[2], nullptr) : 0.05f;
+
+  std::mt19937 random(42);
+  std::uniform_real_distribution<float> position(0.0f, WORLD_SIZE);
+  std::uniform_real_distribution<float> velocity(-speed, speed);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+  std::vector<glm::vec3> positions, velocities;
+  std::vector<size_t> movers;
+  for (size_t i = 0; i < ENTITIES; i++) {
+    positions.push_back(
+        glm::vec3(position(random), position(random), position(random)));
+    if (unit(random) < moving) {
+      movers.push_back(i);
+      velocities.push_back(
+          glm::vec3(velocity(random), velocity(random), velocity(random)));
+    }
+  }
+  auto populate = [&positions](entt::registry &registry) {
+    const LocalBounds bounds{BoundingBox{glm::vec3(-0.5f), glm::vec3(0.5f)}};
+    std::vector<entt::entity> entities;
+    for (const glm::vec3 &at : positions) {
+      entities.push_back(registry.create());
+      registry.emplace<WorldTransform>(
+          entities.back(),
+          WorldTransform{glm::translate(glm::mat4(1.0f), at)});
+      registry.emplace<LocalBounds>(entities.back(), bounds);
+    }
+    return entities;
+  };
+  // what gameplay does every frame, in ms
+  auto patch = [&movers, &velocities](entt::registry &registry,
+                                      const std::vector<entt::entity> &all) {
+    const auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < movers.size(); i++)
+      registry.patch<WorldTransform>(
+          all[movers[i]],
+          [&velocity = velocities[i]](WorldTransform &transform) {
+            transform.matrix[3] += glm::vec4(velocity, 0.0f);
+          });
+    return elapsed_ms(start);
+  };
+
+  std::vector<uint8_t> rest_of_frame(REST_OF_FRAME_BYTES);
+  auto evict = [&rest_of_frame]() {
+    for (size_t i = 0; i < rest_of_frame.size(); i += 64)
+      rest_of_frame[i]++;
+  };
+
+  double plain_total = 0.0;
+  {
+    entt::registry plain;
+    const std::vector<entt::entity> all = populate(plain);
+    for (size_t frame = 0; frame < FRAMES; frame++) {
+      evict();
+      plain_total += patch(plain, all);
+    }
+  }
+
+  entt::registry registry;
+  SpatialIndex index(registry);
+  const std::vector<entt::entity> all = populate(registry);
+  auto start = std::chrono::high_resolution_clock::now();
+  index.sync();
+  std::cout << ENTITIES << " entities, " << movers.size() << " moving up to "
+            << speed << " per axis and frame\n"
+            << "First sync (every insertion): " << elapsed_ms(start)
+            << " ms, tree height " << index.tree().height() << "\n";
+
+  double patch_total = 0.0, sync_total = 0.0, sync_worst = 0.0;
+  for (size_t frame = 0; frame < FRAMES; frame++) {
+    evict();
+    patch_total += patch(registry, all);
+    index.sync();
+    sync_total += index.last_sync_ms();
+    sync_worst = std::max(sync_worst, index.last_sync_ms());
+  }
+
+  // the caller owned buffers of a culling pass and of gameplay queries
+  std::vector<entt::entity> found;
+  found.reserve(ENTITIES);
+  const glm::mat4 projection =
+      glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 300.0f);
+  const glm::mat4 view =
+      glm::lookAt(glm::vec3(WORLD_SIZE * 0.5f), glm::vec3(0.0f),
+                  glm::vec3(0.0f, 1.0f, 0.0f));
+  start = std::chrono::high_resolution_clock::now();
+  index.query_frustum(Frustum::from(projection * view), found);
+  const double frustum_ms = elapsed_ms(start);
+  const size_t in_frustum = found.size();
+
+  size_t in_spheres = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (size_t q = 0; q < SPHERE_QUERIES; q++) {
+    found.clear();
+    index.query_sphere(
+        glm::vec3(position(random), position(random), position(random)),
+        20.0f, found);
+    in_spheres += found.size();
+  }
+  const double spheres_ms = elapsed_ms(start);
+
+  const double frames = static_cast<double>(FRAMES);
+  const double signals = (patch_total - plain_total) / frames;
+  const double sync = sync_total / frames;
+  std::cout << "Per frame over " << FRAMES << " frames\n"
+            << "  patches without index: " << plain_total / frames
+            << " ms\n"
+            << "  patches with index:    " << patch_total / frames
+            << " ms, signals " << signals << " ms\n"
+            << "  sync: " << sync << " ms average, " << sync_worst
+            << " ms worst\n"
+            << "  index total: " << signals + sync << " ms\n"
+            << "Tree height " << index.tree().height() << "\n"
+            << "Frustum query: " << frustum_ms << " ms, " << in_frustum
+            << " entities\n"
+            << SPHERE_QUERIES << " sphere queries of radius 20: " << spheres_ms
+            << " ms, " << in_spheres << " entities\n";
+  return 0;
+}
@@ -0,0 +1,139 @@
+// Load time and video memory of raw textures against the BC1/BC3/BC4/BC5
+// path of Texture2DBuilder::compress, see texture_compressor.hpp. Load is
+// decode and upload, the raw one includes glGenerateMipmap.
+// Usage: texture_bench [image...]
+// Without arguments a synthetic 2048x2048 RGB image is used, a PPM decodes
+// much faster than the PNG / JPEG of real models, pass those to compare.
+
+#include "texture2D.hpp"
+#include "texture_compressor.hpp"
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+constexpr int SYNTHETIC_SIZE = 2048;
+constexpr int RUNS = 3;
+
+static double
+elapsed_ms(std::chrono::high_resolution_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::high_resolution_clock::now() - start)
+      .count();
+}
+
+// smooth gradients with some noise, roughly what albedo maps look like
+static std::string write_synthetic(const std::string &path) {
+  std::ofstream file(path, std::ios::binary);
+  file << "P6\n" << SYNTHETIC_SIZE << " " << SYNTHETIC_SIZE << "\n255\n";
+  uint32_t noise = 12345;
+  std::vector<unsigned char> row(static_cast<size_t>(SYNTHETIC_SIZE) * 3);
+  for (int y = 0; y < SYNTHETIC_SIZE; y++) {
+    for (int x = 0; x < SYNTHETIC_SIZE; x++) {
+      noise = noise * 1664525u + 1013904223u;
+      const float u = static_cast<float>(x) / SYNTHETIC_SIZE;
+      const float v = static_cast<float>(y) / SYNTHETIC_SIZE;
+      const int grain = static_cast<int>(noise >> 28) - 8;
+      const float base[3] = {0.5f + 0.4f * std::sin(u * 12.0f),
+                             0.5f + 0.4f * std::cos(v * 9.0f),
+                             0.5f + 0.4f * std::sin((u + v) * 5.0f)};
+      for (size_t c = 0; c < 3; c++)
+        row[static_cast<size_t>(x) * 3 + c] = static_cast<unsigned char>(
+            std::clamp(static_cast<int>(base[c] * 255.0f) + grain, 0, 255));
+    }
+    file.write(reinterpret_cast<const char *>(row.data()),
+               static_cast<std::streamsize>(row.size()));
+  }
+  return path;
+}
+
+// Decode and upload, finished on the GPU. The .ktx of the compressed path
+// sits next to the source.
+static double load_ms(const std::string &path, bool compress,
+                      size_t &bytes) {
+  const auto start = std::chrono::high_resolution_clock::now();
+  const DecodedImage image = compress ? decode_compressed(path.c_str())
+                                      : DecodedImage::decode(path.c_str());
+  Texture2D texture(image);
+  glFinish();
+  const double ms = elapsed_ms(start);
+  bytes = texture.get_byte_size();
+  texture.deinit();
+  return ms;
+}
+
+static void compare(const std::string &path) {
+  const std::string ktx_path = path + KTX_EXTENSION;
+  const bool had_ktx = std::ifstream(ktx_path).good();
+
+  double raw_ms = 1e9, bake_ms = 1e9, cached_ms = 1e9;
+  size_t raw_bytes = 0, compressed_bytes = 0;
+  for (int run = 0; run < RUNS; run++) {
+    raw_ms = std::min(raw_ms, load_ms(path, false, raw_bytes));
+    // first launch: decode, encode every level and bake the .ktx
+    std::remove(ktx_path.c_str());
+    bake_ms = std::min(bake_ms, load_ms(path, true, compressed_bytes));
+    // later launches read the .ktx back
+    cached_ms = std::min(cached_ms, load_ms(path, true, compressed_bytes));
+  }
+  if (!had_ktx)
+    std::remove(ktx_path.c_str());
+
+  std::cout << path << "\n"
+            << "  raw:                " << raw_ms << " ms, "
+            << raw_bytes / 1024 << " KB\n"
+            << "  compressed, baking: " << bake_ms << " ms, "
+            << compressed_bytes / 1024 << " KB\n"
+            << "  compressed, cached: " << cached_ms << " ms, "
+            << compressed_bytes / 1024 << " KB\n";
+}
+
+int main(int argc, char **argv) {
+  // hidden window, only for a context of the same version as the engine
+  if (glfwInit() == 0) {
+    std::cerr << "Erreur: Impossible d'init glfw\n";
+    return 1;
+  }
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  GLFWwindow *window = glfwCreateWindow(64, 64, "bench", nullptr, nullptr);
+  if (window == nullptr) {
+    std::cerr << "Erreur: Impossible de créer une Window avec OpenGL\n";
+    return 1;
+  }
+  glfwMakeContextCurrent(window);
+  if (gladLoadGLLoader(reinterpret_cast<GLADloadproc>(glfwGetProcAddress)) ==
+      0) {
+    std::cerr << "Erreur: Impossible de load via glad\n";
+    return 1;
+  }
+  detect_texture_compression();
+  if (!s3tc_supported())
+    std::cout << "No S3TC, RGB and RGBA images stay raw\n";
+
+  std::vector<std::string> paths(argv + 1, argv + argc);
+  if (paths.empty())
+    paths.push_back(write_synthetic("texture_bench.ppm"));
+
+  for (const std::string &path : paths) {
+    try {
+      compare(path);
+    } catch (const std::exception &error) {
+      std::cerr << error.what() << "\n";
+    }
+  }
+  if (argc == 1)
+    std::remove(paths.front().c_str());
+  glfwDestroyWindow(window);
+  glfwTerminate();
+  return 0;
+}
@@ -0,0 +1,72 @@
+// convert_vertices() against its scalar loop on 5M random vertices laid out
+// like an aiMesh: separate xyz arrays for positions, normals and uvs.
+
+#include "vertex_conversion.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+constexpr size_t VERTICES = 5000000;
+constexpr int RUNS = 10;
+
+template <typename Convert>
+static double best_ms(Convert convert, std::vector<Vertex> &out) {
+  double best = 1e9;
+  for (int run = 0; run < RUNS; run++) {
+    const auto start = std::chrono::high_resolution_clock::now();
+    convert(out.data());
+    const auto end = std::chrono::high_resolution_clock::now();
+    best = std::min(
+        best, std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  return best;
+}
+
+int main() {
+  std::mt19937 random(42);
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+  std::vector<float> positions(VERTICES * 3), normals(VERTICES * 3),
+      uvs(VERTICES * 3);
+  for (size_t i = 0; i < VERTICES * 3; i++) {
+    positions[i] = unit(random) * 100.0f;
+    normals[i] = unit(random);
+    uvs[i] = unit(random);
+  }
+
+  // the same storage as model.cpp, a std::vector<Vertex>
+  std::vector<Vertex> scalar(VERTICES), simd(VERTICES);
+  const double scalar_ms = best_ms(
+      [&](Vertex *out) {
+        convert_vertices_scalar(positions.data(), normals.data(), uvs.data(),
+                                VERTICES, true, out);
+      },
+      scalar);
+  const double simd_ms = best_ms(
+      [&](Vertex *out) {
+        convert_vertices(positions.data(), normals.data(), uvs.data(),
+                         VERTICES, true, out);
+      },
+      simd);
+
+  if (std::memcmp(scalar.data(), simd.data(), VERTICES * sizeof(Vertex)) !=
+      0) {
+    std::cerr << "Erreur: les deux conversions different\n";
+    return 1;
+  }
+
+  // read 3 arrays of xyz, write one Vertex
+  const double bytes =
+      static_cast<double>(VERTICES) * (9 * sizeof(float) + sizeof(Vertex));
+  std::cout << VERTICES << " vertices, best of " << RUNS << "\n"
+            << "  scalar: " << scalar_ms << " ms, "
+            << bytes / scalar_ms / 1e6 << " GB/s\n"
+            << "  SSE2:   " << simd_ms << " ms, " << bytes / simd_ms / 1e6
+            << " GB/s\n"
+            << "  speedup: " << scalar_ms / simd_ms << "x\n";
+  return 0;
+}
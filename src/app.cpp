@@ -13,6 +13,7 @@ void App::run() {
     glClearColor(0, 0, 0, 1);
     glClear(GL_COLOR_BUFFER_BIT);
 
+    _spatial.sync();
     for (const auto &sys : _systems) {
       sys.func(_world);
     }
@@ -7,6 +7,8 @@
 #include <entt/entt.hpp>
 #include <type_traits>
 
+#include "spatial_index.hpp"
+
 enum SystemPriority {
   Once = INT_MIN,
   Update = 100,
@@ -54,9 +56,15 @@ public:
   bool is_running();
   void run();
 
+  // every entity with a WorldTransform and LocalBounds, synced each frame
+  // before the systems run
+  SpatialIndex &spatial() { return _spatial; }
+
 private:
   // basically our ECS world
   entt::registry _world;
+  // after _world, it disconnects from it on destruction
+  SpatialIndex _spatial{_world};
   // Always sorted by priority
   std::vector<System> _systems;
 
@@ -0,0 +1,424 @@
+#include "bvh.hpp"
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+static BoundingBox merged(const BoundingBox &a, const BoundingBox &b) {
+  return BoundingBox{glm::min(a.min, b.min), glm::max(a.max, b.max)};
+}
+
+// half the surface, only ever compared
+static float area(const BoundingBox &box) {
+  const glm::vec3 size = box.max - box.min;
+  return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+static bool overlaps(const BoundingBox &a, const BoundingBox &b) {
+  return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y &&
+         b.min.y <= a.max.y && a.min.z <= b.max.z && b.min.z <= a.max.z;
+}
+
+static bool same(const BoundingBox &a, const BoundingBox &b) {
+  return a.min.x == b.min.x && a.min.y == b.min.y && a.min.z == b.min.z &&
+         a.max.x == b.max.x && a.max.y == b.max.y && a.max.z == b.max.z;
+}
+
+// How many entries ahead the batched move asks for the nodes it is about to
+// touch. They are spread over the whole array, the misses overlap instead of
+// being paid one after the other.
+constexpr size_t BVH_PREFETCH_DISTANCE = 16;
+
+static void prefetch(const void *address) {
+#if defined(__SSE2__)
+  _mm_prefetch(static_cast<const char *>(address), _MM_HINT_T0);
+#else
+  (void)address;
+#endif
+}
+
+int32_t DynamicBvh::allocate() {
+  if (this->_free == BVH_NULL) {
+    this->_nodes.emplace_back();
+    this->_free = static_cast<int32_t>(this->_nodes.size() - 1);
+    this->_nodes.back().parent = BVH_NULL;
+  }
+
+  const int32_t index = this->_free;
+  BvhNode &node = this->at(index);
+  this->_free = node.parent;
+  node = BvhNode{};
+  node.height = 1;
+  return index;
+}
+
+void DynamicBvh::release(int32_t index) {
+  BvhNode &node = this->at(index);
+  node.parent = this->_free;
+  node.height = -1;
+  this->_free = index;
+}
+
+int32_t DynamicBvh::allocate_leaf() {
+  if (this->_free_leaf == BVH_NULL) {
+    this->_leaves.emplace_back();
+    this->_free_leaf = static_cast<int32_t>(this->_leaves.size() - 1);
+    this->_leaves.back().parent = BVH_NULL;
+  }
+
+  const int32_t index = this->_free_leaf;
+  BvhLeaf &leaf = this->leaf(index);
+  this->_free_leaf = leaf.parent;
+  leaf = BvhLeaf{};
+  leaf.used = true;
+  return index;
+}
+
+void DynamicBvh::link(int32_t parent, uint8_t side, int32_t child,
+                      const BoundingBox &box) {
+  if (parent == BVH_NULL) {
+    this->_root = child;
+    this->_root_box = box;
+  } else {
+    this->at(parent).children[side] = child;
+    this->at(parent).boxes[side] = box;
+  }
+  if (is_leaf_ref(child)) {
+    this->leaf(leaf_ref(child)).parent = parent;
+    this->leaf(leaf_ref(child)).side = side;
+  } else {
+    this->at(child).parent = parent;
+    this->at(child).side = side;
+  }
+}
+
+int32_t DynamicBvh::insert(const BoundingBox &box, uint32_t user) {
+  const int32_t index = this->allocate_leaf();
+  const glm::vec3 margin(this->_margin);
+  this->leaf(index).user = user;
+  this->insert_leaf(index, BoundingBox{box.min - margin, box.max + margin});
+  this->_leaf_count++;
+  return index;
+}
+
+void DynamicBvh::remove(int32_t proxy) {
+  this->remove_leaf(proxy);
+  BvhLeaf &leaf = this->leaf(proxy);
+  leaf.used = false;
+  leaf.parent = this->_free_leaf;
+  this->_free_leaf = proxy;
+  this->_leaf_count--;
+}
+
+// Stretched ahead along the last displacement, something moving steadily
+// then stays inside for longer
+BoundingBox DynamicBvh::fattened(const BoundingBox &box,
+                                 const glm::vec3 &displacement) const {
+  const glm::vec3 margin(this->_margin);
+  const glm::vec3 ahead = displacement * BVH_MOTION_FACTOR;
+  BoundingBox moved{box.min - margin, box.max + margin};
+  for (int axis = 0; axis < 3; axis++) {
+    if (ahead[axis] < 0.0f)
+      moved.min[axis] += ahead[axis];
+    else
+      moved.max[axis] += ahead[axis];
+  }
+  return moved;
+}
+
+bool DynamicBvh::move(int32_t proxy, const BoundingBox &box,
+                      const glm::vec3 &displacement) {
+  const BvhLeaf &leaf = this->leaf(proxy);
+  BoundingBox &fat = this->box_of(leaf.parent, leaf.side);
+  if (fat.contains(box))
+    return false;
+  const BoundingBox moved = this->fattened(box, displacement);
+
+  // A short move only grows the ancestors, they are tightened again when
+  // optimize() gets to the leaf. Anything else goes through a reinsertion.
+  if (overlaps(fat, moved)) {
+    fat = moved;
+    for (int32_t index = leaf.parent; index != BVH_NULL;
+         index = this->at(index).parent) {
+      const BvhNode &node = this->at(index);
+      BoundingBox &above = this->box_of(node.parent, node.side);
+      if (above.contains(moved))
+        break;
+      above = merged(above, moved);
+    }
+    return true;
+  }
+
+  this->remove_leaf(proxy);
+  this->insert_leaf(proxy, moved);
+  return true;
+}
+
+size_t DynamicBvh::move(const BvhMove *moves, size_t count) {
+  this->_far.clear();
+
+  size_t moved_count = 0;
+  for (size_t i = 0; i < count; i++) {
+    // the leaf far ahead, the parent of the one halfway there
+    if (i + BVH_PREFETCH_DISTANCE < count)
+      prefetch(&this->leaf(moves[i + BVH_PREFETCH_DISTANCE].proxy));
+    if (i + BVH_PREFETCH_DISTANCE / 2 < count) {
+      const BvhLeaf &ahead =
+          this->leaf(moves[i + BVH_PREFETCH_DISTANCE / 2].proxy);
+      if (ahead.parent != BVH_NULL)
+        prefetch(&this->at(ahead.parent));
+    }
+
+    const BvhMove &move = moves[i];
+    const BvhLeaf &leaf = this->leaf(move.proxy);
+    BoundingBox &fat = this->box_of(leaf.parent, leaf.side);
+    if (fat.contains(move.box))
+      continue;
+    moved_count++;
+
+    const BoundingBox moved = this->fattened(move.box, move.displacement);
+    if (!overlaps(fat, moved)) {
+      this->_far.emplace_back(move.proxy, moved);
+      continue;
+    }
+    fat = moved;
+    this->queue_refit(leaf.parent, 0);
+  }
+  this->refit_queued();
+
+  for (const auto &[proxy, box] : this->_far) {
+    this->remove_leaf(proxy);
+    this->insert_leaf(proxy, box);
+  }
+  return moved_count;
+}
+
+void DynamicBvh::queue_refit(int32_t index, size_t round) {
+  if (index == BVH_NULL || this->at(index).queued)
+    return;
+  this->at(index).queued = 1;
+  if (this->_rounds.size() <= round)
+    this->_rounds.resize(round + 1);
+  this->_rounds[round].push_back(index);
+}
+
+// Round n holds nodes n steps above a moved leaf. A node with a deeper
+// subtree on its other side is refit again once that side gets to it, so
+// each node is done at most once per child that changed. Only growth goes
+// up: the box of a node is exact, the ones above may be larger than they
+// need until they are refit themselves. No rotation here, the structure
+// stays as it is and optimize() takes care of it.
+void DynamicBvh::refit_queued() {
+  for (size_t round = 0;
+       round < this->_rounds.size() && !this->_rounds[round].empty();
+       round++) {
+    // room for the parents first, nodes is held on to while they are queued
+    if (this->_rounds.size() == round + 1)
+      this->_rounds.emplace_back();
+    std::vector<int32_t> &nodes = this->_rounds[round];
+
+    for (size_t k = 0; k < nodes.size(); k++) {
+      // the node far ahead, the parent of the one halfway there
+      if (k + BVH_PREFETCH_DISTANCE < nodes.size())
+        prefetch(&this->at(nodes[k + BVH_PREFETCH_DISTANCE]));
+      if (k + BVH_PREFETCH_DISTANCE / 2 < nodes.size()) {
+        const BvhNode &ahead = this->at(nodes[k + BVH_PREFETCH_DISTANCE / 2]);
+        if (ahead.parent != BVH_NULL)
+          prefetch(&this->at(ahead.parent));
+      }
+
+      BvhNode &node = this->at(nodes[k]);
+      node.queued = 0;
+      const BoundingBox box = merged(node.boxes[0], node.boxes[1]);
+      BoundingBox &above = this->box_of(node.parent, node.side);
+      // Tighter or unchanged, the boxes above still hold it and stay as they
+      // are until something grows out of them
+      const bool grew = !above.contains(box);
+      above = box;
+      if (grew)
+        this->queue_refit(node.parent, round + 1);
+    }
+    nodes.clear();
+  }
+}
+
+void DynamicBvh::optimize(size_t count) {
+  if (this->_leaves.empty())
+    return;
+
+  for (size_t visited = 0; visited < this->_leaves.size() && count > 0;
+       visited++) {
+    const int32_t index = static_cast<int32_t>(this->_cursor);
+    this->_cursor = (this->_cursor + 1) % this->_leaves.size();
+    const BvhLeaf &leaf = this->leaf(index);
+    if (!leaf.used || leaf.parent == BVH_NULL)
+      continue;
+
+    const BoundingBox box = this->box_of(leaf.parent, leaf.side);
+    this->remove_leaf(index);
+    this->insert_leaf(index, box);
+    count--;
+  }
+}
+
+void DynamicBvh::clear() {
+  this->_nodes.clear();
+  this->_leaves.clear();
+  this->_root = this->_free = this->_free_leaf = BVH_NULL;
+  this->_leaf_count = 0;
+  this->_cursor = 0;
+}
+
+void DynamicBvh::insert_leaf(int32_t index, const BoundingBox &box) {
+  if (this->_root == BVH_NULL) {
+    this->link(BVH_NULL, 0, leaf_ref(index), box);
+    return;
+  }
+
+  // Down towards the cheapest sibling: a new parent here costs its area,
+  // going further costs the growth of every node on the way. The children
+  // boxes are in the node, only the way down is read.
+  int32_t sibling = this->_root;
+  BoundingBox sibling_box = this->_root_box;
+  while (!is_leaf_ref(sibling)) {
+    const BvhNode &node = this->at(sibling);
+    const float combined = area(merged(sibling_box, box));
+    const float here = 2.0f * combined;
+    const float inherited = 2.0f * (combined - area(sibling_box));
+
+    auto descend_cost = [&node, &box, inherited](uint8_t side) {
+      const float grown = area(merged(node.boxes[side], box));
+      return (is_leaf_ref(node.children[side])
+                  ? grown
+                  : grown - area(node.boxes[side])) +
+             inherited;
+    };
+    const float left = descend_cost(0);
+    const float right = descend_cost(1);
+    if (here < left && here < right)
+      break;
+    const uint8_t side = left < right ? 0 : 1;
+    sibling = node.children[side];
+    sibling_box = node.boxes[side];
+  }
+
+  int32_t old_parent;
+  uint8_t old_side;
+  if (is_leaf_ref(sibling)) {
+    old_parent = this->leaf(leaf_ref(sibling)).parent;
+    old_side = this->leaf(leaf_ref(sibling)).side;
+  } else {
+    old_parent = this->at(sibling).parent;
+    old_side = this->at(sibling).side;
+  }
+  const int32_t parent = this->allocate();
+  this->at(parent).height =
+      static_cast<int16_t>(this->height_of(sibling) + 1);
+  this->link(old_parent, old_side, parent, merged(sibling_box, box));
+  this->link(parent, 0, sibling, sibling_box);
+  this->link(parent, 1, leaf_ref(index), box);
+  this->refit(old_parent);
+}
+
+void DynamicBvh::remove_leaf(int32_t index) {
+  const int32_t parent = this->leaf(index).parent;
+  if (parent == BVH_NULL) {
+    this->_root = BVH_NULL;
+    return;
+  }
+
+  // the sibling takes the place of the parent
+  const BvhNode &node = this->at(parent);
+  const uint8_t other = node.children[0] == leaf_ref(index) ? 1 : 0;
+  const int32_t grand_parent = node.parent;
+  this->link(grand_parent, node.side, node.children[other],
+             node.boxes[other]);
+  this->release(parent);
+  this->refit(grand_parent);
+}
+
+// Stops at the first node that keeps its structure, height and box, nothing
+// above can tell the difference
+void DynamicBvh::refit(int32_t index) {
+  while (index != BVH_NULL) {
+    const bool rotated = this->rotate(index);
+
+    BvhNode &node = this->at(index);
+    const auto height = static_cast<int16_t>(
+        1 + std::max(this->height_of(node.children[0]),
+                     this->height_of(node.children[1])));
+    const BoundingBox box = merged(node.boxes[0], node.boxes[1]);
+    BoundingBox &above = this->box_of(node.parent, node.side);
+    if (!rotated && height == node.height && same(box, above))
+      return;
+    node.height = height;
+    above = box;
+    index = node.parent;
+  }
+}
+
+bool DynamicBvh::rotate(int32_t index) {
+  // Swap a child of index with a grand child under its other child, the one
+  // shrinking that other child the most wins
+  uint8_t best_side = 0, best_grand_side = 0;
+  float best_gain = 0.0f;
+  auto consider = [&](uint8_t side) {
+    const BvhNode &node = this->at(index);
+    const int32_t other = node.children[1 - side];
+    if (is_leaf_ref(other))
+      return;
+
+    const BvhNode &lower = this->at(other);
+    const float before = area(node.boxes[1 - side]);
+    const BoundingBox &moved = node.boxes[side];
+    for (uint8_t kept = 0; kept < 2; kept++) {
+      const float gain = before - area(merged(moved, lower.boxes[kept]));
+      if (gain > best_gain) {
+        best_gain = gain;
+        best_side = side;
+        best_grand_side = static_cast<uint8_t>(1 - kept);
+      }
+    }
+  };
+  consider(0);
+  consider(1);
+  if (best_gain <= 0.0f)
+    return false;
+
+  // the child at best_side and the grand child trade places
+  const BvhNode &node = this->at(index);
+  const int32_t child = node.children[best_side];
+  const BoundingBox child_box = node.boxes[best_side];
+  const int32_t other = node.children[1 - best_side];
+  BvhNode &lower = this->at(other);
+  const int32_t grand_child = lower.children[best_grand_side];
+  const BoundingBox grand_child_box = lower.boxes[best_grand_side];
+  this->link(index, best_side, grand_child, grand_child_box);
+  this->link(other, best_grand_side, child, child_box);
+  lower.height = static_cast<int16_t>(
+      1 + std::max(this->height_of(lower.children[0]),
+                   this->height_of(lower.children[1])));
+  this->at(index).boxes[1 - best_side] =
+      merged(lower.boxes[0], lower.boxes[1]);
+  return true;
+}
+
+bool DynamicBvh::ray_hits(const glm::vec3 &origin, const glm::vec3 &inverse,
+                          float max_distance, const BoundingBox &box) {
+  // slabs, a zero direction gives infinities which compare the right way
+  // unless the origin sits exactly on a plane
+  float enter = 0.0f, leave = max_distance;
+  for (int axis = 0; axis < 3; axis++) {
+    float t0 = (box.min[axis] - origin[axis]) * inverse[axis];
+    float t1 = (box.max[axis] - origin[axis]) * inverse[axis];
+    if (t0 > t1)
+      std::swap(t0, t1);
+    enter = std::max(enter, t0);
+    leave = std::min(leave, t1);
+    if (enter > leave)
+      return false;
+  }
+  return true;
+}
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "frustum.hpp"
+#include "mesh.hpp"
+
+constexpr int32_t BVH_NULL = -1;
+// how far ahead of a moving leaf its fattened box reaches, in displacements
+constexpr float BVH_MOTION_FACTOR = 4.0f;
+// nodes a query keeps on the call stack, deeper trees get a heap one
+constexpr size_t BVH_QUERY_STACK = 256;
+
+// Internal node. The boxes of both children are stored here rather than in
+// the children, walking up or down the tree reads one cache line per level.
+// A child is a node index, or a leaf index turned negative by leaf_ref().
+struct alignas(64) BvhNode {
+  BoundingBox boxes[2];
+  int32_t children[2] = {BVH_NULL, BVH_NULL};
+  // next free node while in the free list
+  int32_t parent = BVH_NULL;
+  // leaves are 0, free nodes -1
+  int16_t height = -1;
+  // which child of parent this is
+  uint8_t side = 0;
+  // waiting in a round of the batched refit
+  uint8_t queued = 0;
+};
+
+struct BvhLeaf {
+  // next free leaf while in the free list
+  int32_t parent = BVH_NULL;
+  uint32_t user = 0;
+  uint8_t side = 0;
+  bool used = false;
+};
+
+// One leaf of a batched DynamicBvh::move
+struct BvhMove {
+  int32_t proxy = BVH_NULL;
+  BoundingBox box;
+  glm::vec3 displacement{0.0f};
+};
+
+// Dynamic AABB tree (Box2D / Bullet style). Leaves have a box fattened by
+// margin so small moves do not touch the tree. Insertion walks down by
+// surface area cost and every refit tries the tree rotation that shrinks
+// the node the most (Kensler 2008), which keeps it close to a SAH build
+// without ever rebuilding it.
+// A proxy is the index of its leaf and stays valid until remove().
+class DynamicBvh {
+public:
+  explicit DynamicBvh(float margin = 0.1f) : _margin(margin) {}
+
+  int32_t insert(const BoundingBox &box, uint32_t user);
+  void remove(int32_t proxy);
+  // false when box still fits the fattened one, the tree is untouched.
+  // displacement is the last motion of the leaf, e.g. over one frame.
+  bool move(int32_t proxy, const BoundingBox &box,
+            const glm::vec3 &displacement = glm::vec3(0.0f));
+  // Many leaves at once, each proxy at most once. The leaves are updated
+  // first, then the ancestors are refit bottom up, one level after the
+  // other, instead of walking up from each leaf. Returns how many leaves
+  // left their fattened box.
+  size_t move(const BvhMove *moves, size_t count);
+  void clear();
+  // Reinserts up to count leaves, round robin, to undo what the short moves
+  // did to the tree. Meant to run every frame with a small budget.
+  void optimize(size_t count);
+
+  size_t size() const { return this->_leaf_count; }
+  int32_t height() const {
+    return this->_root == BVH_NULL ? 0 : this->height_of(this->_root);
+  }
+  uint32_t user(int32_t proxy) const { return this->leaf(proxy).user; }
+  const BoundingBox &fat_box(int32_t proxy) const {
+    const BvhLeaf &leaf = this->leaf(proxy);
+    return this->box_of(leaf.parent, leaf.side);
+  }
+
+  // visit(user) for every leaf whose fattened box passes the test, callers
+  // do the exact test themselves if they need one
+  template <typename Visit>
+  void query_frustum(const Frustum &frustum, Visit &&visit) const {
+    this->query(
+        [&frustum](const BoundingBox &box) {
+          return frustum.intersects_aabb(box.min, box.max);
+        },
+        visit);
+  }
+  template <typename Visit>
+  void query_sphere(const glm::vec3 &center, float radius,
+                    Visit &&visit) const {
+    this->query(
+        [&center, radius](const BoundingBox &box) {
+          const glm::vec3 closest =
+              glm::max(box.min, glm::min(center, box.max));
+          const glm::vec3 offset = closest - center;
+          return glm::dot(offset, offset) <= radius * radius;
+        },
+        visit);
+  }
+  // Leaves crossed by origin + t * direction for t in [0, max_distance],
+  // in no particular order
+  template <typename Visit>
+  void query_ray(const glm::vec3 &origin, const glm::vec3 &direction,
+                 float max_distance, Visit &&visit) const {
+    const glm::vec3 inverse = glm::vec3(1.0f) / direction;
+    this->query(
+        [&origin, &inverse, max_distance](const BoundingBox &box) {
+          return ray_hits(origin, inverse, max_distance, box);
+        },
+        visit);
+  }
+
+private:
+  std::vector<BvhNode> _nodes;
+  std::vector<BvhLeaf> _leaves;
+  // a node or a leaf_ref(), its box is _root_box
+  int32_t _root = BVH_NULL;
+  BoundingBox _root_box{glm::vec3(0.0f), glm::vec3(0.0f)};
+  int32_t _free = BVH_NULL;
+  int32_t _free_leaf = BVH_NULL;
+  size_t _leaf_count = 0;
+  size_t _cursor = 0;
+  float _margin;
+
+  // scratch of the batched move, nodes to refit round by round
+  std::vector<std::vector<int32_t>> _rounds;
+  // leaves that jumped away, reinserted once the refit is done
+  std::vector<std::pair<int32_t, BoundingBox>> _far;
+
+  // leaf index to child reference and back
+  static int32_t leaf_ref(int32_t index) { return -2 - index; }
+  static bool is_leaf_ref(int32_t child) { return child < BVH_NULL; }
+
+  BvhNode &at(int32_t index) {
+    return this->_nodes[static_cast<size_t>(index)];
+  }
+  const BvhNode &at(int32_t index) const {
+    return this->_nodes[static_cast<size_t>(index)];
+  }
+  BvhLeaf &leaf(int32_t index) {
+    return this->_leaves[static_cast<size_t>(index)];
+  }
+  const BvhLeaf &leaf(int32_t index) const {
+    return this->_leaves[static_cast<size_t>(index)];
+  }
+  // the box of the child at side of parent, the root one without a parent
+  BoundingBox &box_of(int32_t parent, uint8_t side) {
+    return parent == BVH_NULL ? this->_root_box : this->at(parent).boxes[side];
+  }
+  const BoundingBox &box_of(int32_t parent, uint8_t side) const {
+    return parent == BVH_NULL ? this->_root_box : this->at(parent).boxes[side];
+  }
+  int32_t height_of(int32_t child) const {
+    return is_leaf_ref(child) ? 0 : this->at(child).height;
+  }
+  int32_t allocate();
+  void release(int32_t node);
+  int32_t allocate_leaf();
+  // child and its box become the side child of parent, or the root
+  void link(int32_t parent, uint8_t side, int32_t child,
+            const BoundingBox &box);
+  void insert_leaf(int32_t index, const BoundingBox &box);
+  void remove_leaf(int32_t index);
+  // boxes, heights and rotations from index up to the root
+  void refit(int32_t index);
+  // false when no rotation helps
+  bool rotate(int32_t index);
+  BoundingBox fattened(const BoundingBox &box,
+                       const glm::vec3 &displacement) const;
+  void queue_refit(int32_t index, size_t round);
+  void refit_queued();
+
+  static bool ray_hits(const glm::vec3 &origin, const glm::vec3 &inverse,
+                       float max_distance, const BoundingBox &box);
+
+  template <typename Test, typename Visit>
+  void query(const Test &test, Visit &visit) const {
+    if (this->_root == BVH_NULL || !test(this->_root_box))
+      return;
+    if (is_leaf_ref(this->_root)) {
+      visit(this->leaf(leaf_ref(this->_root)).user);
+      return;
+    }
+
+    // depth first, no more than height nodes wait at once
+    int32_t local[BVH_QUERY_STACK];
+    std::vector<int32_t> spilled;
+    int32_t *stack = local;
+    const size_t capacity = static_cast<size_t>(this->height()) + 1;
+    if (capacity > BVH_QUERY_STACK) {
+      spilled.resize(capacity);
+      stack = spilled.data();
+    }
+
+    size_t depth = 0;
+    stack[depth++] = this->_root;
+    while (depth > 0) {
+      const BvhNode &node = this->at(stack[--depth]);
+      for (uint8_t side = 0; side < 2; side++) {
+        if (!test(node.boxes[side]))
+          continue;
+        const int32_t child = node.children[side];
+        if (is_leaf_ref(child))
+          visit(this->leaf(leaf_ref(child)).user);
+        else
+          stack[depth++] = child;
+      }
+    }
+  }
+};
@@ -0,0 +1,324 @@
+#include "deferred_renderer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+constexpr unsigned int SPHERE_SEGMENTS = 16;
+constexpr unsigned int SPHERE_RINGS = 8;
+
+// G-buffer texture units, the same for both light programs
+constexpr int UNIT_ALBEDO_SPECULAR = 0;
+constexpr int UNIT_NORMAL = 1;
+constexpr int UNIT_EMISSION = 2;
+constexpr int UNIT_DEPTH = 3;
+
+void DeferredRenderer::init(int width, int height) {
+  if (!this->_linked) {
+    this->_geometry_program.add_shader<VertexShader>(
+        "../src/shaders/model_vertex.glsl");
+    this->_geometry_program.add_shader<FragmentShader>(
+        "../src/shaders/gbuffer.frag.glsl");
+    this->_geometry_program.link();
+
+    this->_light_program.add_shader<VertexShader>(
+        "../src/shaders/fullscreen.vert.glsl");
+    this->_light_program.add_shader<FragmentShader>(
+        "../src/shaders/deferred_light.frag.glsl");
+    this->_light_program.link();
+
+    this->_point_light_program.add_shader<VertexShader>(
+        "../src/shaders/deferred_point_light.vert.glsl");
+    this->_point_light_program.add_shader<FragmentShader>(
+        "../src/shaders/deferred_point_light.frag.glsl");
+    this->_point_light_program.link();
+    this->_linked = true;
+  }
+
+  // samplers are program state, set once
+  for (const Shader *program :
+       {&this->_light_program, &this->_point_light_program}) {
+    program->use();
+    program->set_uniform("gbuffer_albedo_specular", UNIT_ALBEDO_SPECULAR);
+    program->set_uniform("gbuffer_normal", UNIT_NORMAL);
+    program->set_uniform("gbuffer_depth", UNIT_DEPTH);
+  }
+  this->_light_program.use();
+  this->_light_program.set_uniform("gbuffer_emission", UNIT_EMISSION);
+  glUseProgram(0);
+
+  glGenVertexArrays(1, &this->_empty_VAO);
+  this->create_sphere();
+  for (auto &timers : this->_timers)
+    glGenQueries(2, timers);
+  this->_frame = 0;
+
+  this->_width = width;
+  this->_height = height;
+  this->create_targets();
+}
+
+void DeferredRenderer::deinit() {
+  if (!this->is_init())
+    return;
+
+  this->destroy_targets();
+  glDeleteVertexArrays(1, &this->_empty_VAO);
+  glDeleteVertexArrays(1, &this->_sphere_VAO);
+  glDeleteBuffers(1, &this->_sphere_VBO);
+  glDeleteBuffers(1, &this->_sphere_EBO);
+  glDeleteBuffers(1, &this->_instance_VBO);
+  for (auto &timers : this->_timers)
+    glDeleteQueries(2, timers);
+  this->_empty_VAO = this->_sphere_VAO = this->_sphere_VBO = 0;
+  this->_sphere_EBO = this->_instance_VBO = 0;
+}
+
+void DeferredRenderer::resize(int width, int height) {
+  // a minimized window reports 0 x 0, the old targets can wait
+  if (!this->is_init() || width <= 0 || height <= 0 ||
+      (width == this->_width && height == this->_height))
+    return;
+
+  this->destroy_targets();
+  this->_width = width;
+  this->_height = height;
+  this->create_targets();
+}
+
+void DeferredRenderer::create_targets() {
+  glGenFramebuffers(1, &this->_framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, this->_framebuffer);
+
+  auto target = [this](unsigned int &texture, GLint internal_format,
+                       GLenum format, GLenum type, GLenum attachment) {
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, this->_width,
+                 this->_height, 0, format, type, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture,
+                           0);
+  };
+  target(this->_albedo_specular, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE,
+         GL_COLOR_ATTACHMENT0);
+  target(this->_normal, GL_RG16F, GL_RG, GL_FLOAT, GL_COLOR_ATTACHMENT1);
+  target(this->_emission, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE,
+         GL_COLOR_ATTACHMENT2);
+  // stencil too so the outline still works in the geometry pass
+  target(this->_depth, GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL,
+         GL_UNSIGNED_INT_24_8, GL_DEPTH_STENCIL_ATTACHMENT);
+
+  const GLenum attachments[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,
+                                GL_COLOR_ATTACHMENT2};
+  glDrawBuffers(3, attachments);
+
+  const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  if (status != GL_FRAMEBUFFER_COMPLETE)
+    throw std::runtime_error("Erreur: G-buffer incomplet (" +
+                             std::to_string(status) + ")");
+}
+
+void DeferredRenderer::destroy_targets() {
+  const unsigned int textures[] = {this->_albedo_specular, this->_normal,
+                                   this->_emission, this->_depth};
+  glDeleteTextures(4, textures);
+  glDeleteFramebuffers(1, &this->_framebuffer);
+  this->_albedo_specular = this->_normal = this->_emission = this->_depth = 0;
+  this->_framebuffer = 0;
+}
+
+// UV sphere pushed out so its flat faces never cut inside the unit sphere,
+// counter clockwise seen from outside
+void DeferredRenderer::create_sphere() {
+  const float pi = 3.14159265f;
+  const float scale =
+      1.0f / (std::cos(pi / static_cast<float>(SPHERE_SEGMENTS)) *
+              std::cos(pi / static_cast<float>(2 * SPHERE_RINGS)));
+
+  std::vector<glm::vec3> vertices;
+  for (unsigned int ring = 0; ring <= SPHERE_RINGS; ring++) {
+    const float theta =
+        pi * static_cast<float>(ring) / static_cast<float>(SPHERE_RINGS);
+    for (unsigned int segment = 0; segment <= SPHERE_SEGMENTS; segment++) {
+      const float phi = 2.0f * pi * static_cast<float>(segment) /
+                        static_cast<float>(SPHERE_SEGMENTS);
+      vertices.push_back(glm::vec3(std::sin(theta) * std::cos(phi),
+                                   std::cos(theta),
+                                   std::sin(theta) * std::sin(phi)) *
+                         scale);
+    }
+  }
+
+  std::vector<uint16_t> indices;
+  for (unsigned int ring = 0; ring < SPHERE_RINGS; ring++)
+    for (unsigned int segment = 0; segment < SPHERE_SEGMENTS; segment++) {
+      const uint16_t a =
+          static_cast<uint16_t>(ring * (SPHERE_SEGMENTS + 1) + segment);
+      const uint16_t b = static_cast<uint16_t>(a + SPHERE_SEGMENTS + 1);
+      indices.insert(indices.end(),
+                     {a, static_cast<uint16_t>(a + 1), b,
+                      static_cast<uint16_t>(a + 1),
+                      static_cast<uint16_t>(b + 1), b});
+    }
+  this->_sphere_index_count = static_cast<GLsizei>(indices.size());
+
+  glGenVertexArrays(1, &this->_sphere_VAO);
+  glGenBuffers(1, &this->_sphere_VBO);
+  glGenBuffers(1, &this->_sphere_EBO);
+  glGenBuffers(1, &this->_instance_VBO);
+
+  glBindVertexArray(this->_sphere_VAO);
+  glBindBuffer(GL_ARRAY_BUFFER, this->_sphere_VBO);
+  glBufferData(GL_ARRAY_BUFFER,
+               static_cast<GLsizeiptr>(vertices.size() * sizeof(glm::vec3)),
+               vertices.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->_sphere_EBO);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+               static_cast<GLsizeiptr>(indices.size() * sizeof(uint16_t)),
+               indices.data(), GL_STATIC_DRAW);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), nullptr);
+
+  glBindBuffer(GL_ARRAY_BUFFER, this->_instance_VBO);
+  const GLsizei stride = sizeof(PointLightInstance);
+  auto attribute = [stride](GLuint location, GLint size, size_t offset) {
+    glEnableVertexAttribArray(location);
+    glVertexAttribPointer(location, size, GL_FLOAT, GL_FALSE, stride,
+                          reinterpret_cast<void *>(offset));
+    glVertexAttribDivisor(location, 1);
+  };
+  attribute(1, 4, offsetof(PointLightInstance, position_radius));
+  attribute(2, 3, offsetof(PointLightInstance, ambient));
+  attribute(3, 3, offsetof(PointLightInstance, diffuse));
+  attribute(4, 3, offsetof(PointLightInstance, specular));
+  attribute(5, 3, offsetof(PointLightInstance, attenuation));
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Timers of the oldest frame in flight, their slot is reused right after
+void DeferredRenderer::read_timers() {
+  if (this->_frame < DEFERRED_TIMER_FRAMES)
+    return;
+
+  GLuint *timers = this->_timers[this->_frame % DEFERRED_TIMER_FRAMES];
+  GLuint available = 0;
+  glGetQueryObjectuiv(timers[1], GL_QUERY_RESULT_AVAILABLE, &available);
+  if (!available)
+    return;
+
+  GLuint64 geometry = 0, lighting = 0;
+  glGetQueryObjectui64v(timers[0], GL_QUERY_RESULT, &geometry);
+  glGetQueryObjectui64v(timers[1], GL_QUERY_RESULT, &lighting);
+  this->_geometry_ms = static_cast<double>(geometry) / 1e6;
+  this->_lighting_ms = static_cast<double>(lighting) / 1e6;
+}
+
+void DeferredRenderer::begin_geometry() {
+  this->read_timers();
+  glBeginQuery(GL_TIME_ELAPSED,
+               this->_timers[this->_frame % DEFERRED_TIMER_FRAMES][0]);
+  glBindFramebuffer(GL_FRAMEBUFFER, this->_framebuffer);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+}
+
+void DeferredRenderer::end_geometry() {
+  glEndQuery(GL_TIME_ELAPSED);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void DeferredRenderer::bind_gbuffer_textures() const {
+  const unsigned int textures[] = {this->_albedo_specular, this->_normal,
+                                   this->_emission, this->_depth};
+  for (unsigned int unit = 0; unit < 4; unit++) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, textures[unit]);
+  }
+}
+
+void DeferredRenderer::light(
+    const glm::mat4 &view, const glm::mat4 &projection, float shininess,
+    const std::vector<PointLight> &point_lights) {
+  glBeginQuery(GL_TIME_ELAPSED,
+               this->_timers[this->_frame % DEFERRED_TIMER_FRAMES][1]);
+  // the Frame block has the rest of the camera
+  const glm::mat4 inverse_view_projection = glm::inverse(projection * view);
+
+  // every pixel once per pass, no depth needed
+  glDisable(GL_DEPTH_TEST);
+  glDepthMask(GL_FALSE);
+  glStencilMask(0x00);
+  this->bind_gbuffer_textures();
+
+  // directional and spot lights come from the Lights block
+  const Shader &light = this->_light_program;
+  light.use();
+  light.set_uniform("inverse_view_projection", inverse_view_projection);
+  light.set_uniform("shininess", shininess);
+  glBindVertexArray(this->_empty_VAO);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  this->_instances.clear();
+  for (const PointLight &point_light : point_lights) {
+    const float radius =
+        light_radius(point_light.info, point_light.attenuation_info);
+    if (radius <= 0.0f)
+      continue;
+    const AttenuationInfo &attenuation = point_light.attenuation_info;
+    this->_instances.push_back(PointLightInstance{
+        glm::vec4(point_light.position, radius), point_light.info.ambient,
+        point_light.info.diffuse, point_light.info.specular,
+        glm::vec3(attenuation.constant, attenuation.linear,
+                  attenuation.quadratic)});
+  }
+  this->_point_light_count = this->_instances.size();
+
+  if (!this->_instances.empty()) {
+    // orphaned, last frame draw may still be reading it
+    glBindBuffer(GL_ARRAY_BUFFER, this->_instance_VBO);
+    const GLsizeiptr bytes = static_cast<GLsizeiptr>(
+        this->_instances.size() * sizeof(PointLightInstance));
+    glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, this->_instances.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    const Shader &point = this->_point_light_program;
+    point.use();
+    point.set_uniform("inverse_view_projection", inverse_view_projection);
+    point.set_uniform("shininess", shininess);
+    point.set_uniform("screen_size",
+                      glm::vec2(static_cast<float>(this->_width),
+                                static_cast<float>(this->_height)));
+
+    // back faces only, still there with the camera inside the volume
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_FRONT);
+    glBindVertexArray(this->_sphere_VAO);
+    glDrawElementsInstanced(GL_TRIANGLES, this->_sphere_index_count,
+                            GL_UNSIGNED_SHORT, nullptr,
+                            static_cast<GLsizei>(this->_instances.size()));
+    glCullFace(GL_BACK);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_BLEND);
+  }
+
+  glBindVertexArray(0);
+  glActiveTexture(GL_TEXTURE0);
+  glEnable(GL_DEPTH_TEST);
+  glDepthMask(GL_TRUE);
+  glStencilMask(0xFF);
+  glEndQuery(GL_TIME_ELAPSED);
+  this->_frame++;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "glad/glad.h"
+#include "light.hpp"
+#include "shader.hpp"
+#include <glm/glm.hpp>
+
+// frames of GPU timers in flight before one is read back
+constexpr size_t DEFERRED_TIMER_FRAMES = 3;
+
+enum class RenderPath {
+  FORWARD,
+  DEFERRED,
+  // forward with the lights of a LightGrid
+  CLUSTERED,
+};
+
+// Geometry pass into a G-buffer, then lights over what it holds so their
+// cost no longer depends on the meshes:
+// - albedo rgb + specular intensity, RGBA8
+// - octahedral normal, RG16F
+// - emission, RGBA8
+// - depth stencil, positions are rebuilt from it
+// Emission, directional and spot lights go in one full screen pass, point
+// lights are spheres drawn in one instanced call and blended on top.
+// GL thread only.
+class DeferredRenderer {
+public:
+  DeferredRenderer() = default;
+  DeferredRenderer(const DeferredRenderer &) = delete;
+  DeferredRenderer &operator=(const DeferredRenderer &) = delete;
+  ~DeferredRenderer() { this->deinit(); }
+
+  // Programs and sphere once, the targets follow the size
+  void init(int width, int height);
+  void deinit();
+  bool is_init() const { return this->_framebuffer != 0; }
+  // Reallocates the targets when the size changed
+  void resize(int width, int height);
+
+  // Binds and clears the G-buffer, meshes are drawn with the
+  // geometry program until end_geometry()
+  void begin_geometry();
+  void end_geometry();
+  // model_vertex.glsl + gbuffer.frag.glsl
+  const Shader &geometry_program() const { return this->_geometry_program; }
+
+  // Into the default framebuffer, replaces its color. Directional and spot
+  // lights are read from the LightBuffer.
+  void light(const glm::mat4 &view, const glm::mat4 &projection,
+             float shininess, const std::vector<PointLight> &point_lights);
+
+  // GPU time of both passes, a few frames late
+  double geometry_ms() const { return this->_geometry_ms; }
+  double lighting_ms() const { return this->_lighting_ms; }
+  // point lights drawn by the last light(), too dim ones are skipped
+  size_t point_light_count() const { return this->_point_light_count; }
+
+private:
+  // tightly packed, attributes 1 to 5 of deferred_point_light.vert.glsl
+  struct PointLightInstance {
+    glm::vec4 position_radius;
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+    glm::vec3 attenuation;
+  };
+
+  int _width = 0, _height = 0;
+  unsigned int _framebuffer = 0;
+  unsigned int _albedo_specular = 0, _normal = 0, _emission = 0, _depth = 0;
+
+  Shader _geometry_program;
+  Shader _light_program;
+  Shader _point_light_program;
+  bool _linked = false;
+  // the full screen triangle has no attribute but core needs a VAO bound
+  unsigned int _empty_VAO = 0;
+  unsigned int _sphere_VAO = 0, _sphere_VBO = 0, _sphere_EBO = 0;
+  unsigned int _instance_VBO = 0;
+  GLsizei _sphere_index_count = 0;
+  std::vector<PointLightInstance> _instances;
+  size_t _point_light_count = 0;
+
+  // GL_TIME_ELAPSED, geometry then lighting, one pair per frame in flight
+  GLuint _timers[DEFERRED_TIMER_FRAMES][2] = {};
+  size_t _frame = 0;
+  double _geometry_ms = 0.0, _lighting_ms = 0.0;
+
+  void create_targets();
+  void destroy_targets();
+  void create_sphere();
+  void read_timers();
+  void bind_gbuffer_textures() const;
+};
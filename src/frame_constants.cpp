@@ -0,0 +1,36 @@
+#include "frame_constants.hpp"
+
+void FrameConstants::init() {
+  glGenBuffers(1, &this->UBO);
+  glBindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameStd140), &this->_frame,
+               GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BINDING, this->UBO);
+}
+
+void FrameConstants::deinit() {
+  if (!this->is_init())
+    return;
+  glDeleteBuffers(1, &this->UBO);
+  this->UBO = 0;
+}
+
+void FrameConstants::update(const glm::mat4 &view, const glm::mat4 &projection,
+                            const glm::vec3 &camera_pos, float near, float far,
+                            float time) {
+  this->_frame.view = view;
+  this->_frame.projection = projection;
+  this->_frame.view_projection = projection * view;
+  this->_frame.camera_pos = camera_pos;
+  this->_frame.near = near;
+  this->_frame.far = far;
+  this->_frame.time = time;
+
+  // small enough to go up whole, orphaned since last frame draws may still
+  // read it
+  glBindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameStd140), &this->_frame,
+               GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
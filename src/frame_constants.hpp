@@ -0,0 +1,45 @@
+#pragma once
+
+#include "glad/glad.h"
+#include "shader.hpp"
+#include <glm/glm.hpp>
+
+// std140 mirror of the Frame block, padded to a whole vec4 since some
+// drivers round the block size up
+struct FrameStd140 {
+  glm::mat4 view;
+  glm::mat4 projection;
+  glm::mat4 view_projection;
+  glm::vec3 camera_pos;
+  float near;
+  float far;
+  float time;
+  float padding[2];
+};
+
+static_assert(sizeof(FrameStd140) == 224, "std140 Frame");
+
+// Camera and time of the frame in one uniform buffer bound to
+// FRAME_BINDING, every program declaring the Frame block reads it instead of
+// its own view / projection uniforms. GL thread only.
+class FrameConstants {
+public:
+  FrameConstants() = default;
+  FrameConstants(const FrameConstants &) = delete;
+  FrameConstants &operator=(const FrameConstants &) = delete;
+  ~FrameConstants() { this->deinit(); }
+
+  void init();
+  void deinit();
+  bool is_init() const { return this->UBO != 0; }
+
+  // Once per frame, before the first draw
+  void update(const glm::mat4 &view, const glm::mat4 &projection,
+              const glm::vec3 &camera_pos, float near, float far, float time);
+
+  const FrameStd140 &frame() const { return this->_frame; }
+
+private:
+  unsigned int UBO = 0;
+  FrameStd140 _frame{};
+};
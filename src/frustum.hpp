@@ -0,0 +1,46 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Planes pointing inward, normalized so dot(plane, vec4(p, 1)) is a distance.
+// Extracted from projection * view (* model to get them in model space).
+struct Frustum {
+  glm::vec4 planes[6];
+
+  static Frustum from(const glm::mat4 &clip) {
+    // glm is column major, row i of the matrix is clip[0][i] .. clip[3][i]
+    auto row = [&clip](int i) {
+      return glm::vec4(clip[0][i], clip[1][i], clip[2][i], clip[3][i]);
+    };
+
+    Frustum frustum;
+    frustum.planes[0] = row(3) + row(0); // left
+    frustum.planes[1] = row(3) - row(0); // right
+    frustum.planes[2] = row(3) + row(1); // bottom
+    frustum.planes[3] = row(3) - row(1); // top
+    frustum.planes[4] = row(3) + row(2); // near
+    frustum.planes[5] = row(3) - row(2); // far
+    for (glm::vec4 &plane : frustum.planes)
+      plane = plane / glm::length(glm::vec3(plane));
+    return frustum;
+  }
+
+  bool intersects_sphere(const glm::vec3 &center, float radius) const {
+    for (const glm::vec4 &plane : this->planes)
+      if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+        return false;
+    return true;
+  }
+
+  // the corner furthest along each plane normal decides
+  bool intersects_aabb(const glm::vec3 &min, const glm::vec3 &max) const {
+    for (const glm::vec4 &plane : this->planes) {
+      const glm::vec3 corner(plane.x >= 0.0f ? max.x : min.x,
+                             plane.y >= 0.0f ? max.y : min.y,
+                             plane.z >= 0.0f ? max.z : min.z);
+      if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+        return false;
+    }
+    return true;
+  }
+};
@@ -0,0 +1,150 @@
+#include "geometry_arena.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+size_t GeometryArena::vertex_bytes(const MeshView &view) {
+  return view.vertex_count * view.vertex_format.stride();
+}
+
+size_t GeometryArena::index_bytes(const MeshView &view) {
+  const size_t bytes = view.index_count * index_size(view.index_type);
+  return (bytes + 3) & ~size_t{3};
+}
+
+void GeometryArena::init(const std::vector<MeshView> &views) {
+  this->deinit();
+  if (!views.empty())
+    this->_format = views.front().vertex_format;
+
+  for (const MeshView &view : views) {
+    if (view.vertex_format.bits() != this->_format.bits())
+      throw std::runtime_error(
+          "Erreur: tous les meshes d'une arena doivent partager le meme "
+          "format de vertex");
+    this->_vertex_capacity += vertex_bytes(view);
+    this->_index_capacity += index_bytes(view);
+  }
+
+  glGenVertexArrays(1, &this->VAO);
+  glGenBuffers(1, &this->VBO);
+  glGenBuffers(1, &this->EBO);
+
+  glBindVertexArray(this->VAO);
+
+  glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+  glBufferData(GL_ARRAY_BUFFER,
+               static_cast<GLsizeiptr>(this->_vertex_capacity), nullptr,
+               GL_STATIC_DRAW);
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+               static_cast<GLsizeiptr>(this->_index_capacity), nullptr,
+               GL_STATIC_DRAW);
+
+  this->_format.setup_attributes();
+
+  // one identity to start with so a plain draw never reads past the buffer
+  const InstanceTransform identity{glm::mat4(1.0f), glm::mat3(1.0f)};
+  glGenBuffers(1, &this->instance_VBO);
+  glBindBuffer(GL_ARRAY_BUFFER, this->instance_VBO);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(InstanceTransform), &identity,
+               GL_STREAM_DRAW);
+  this->_instance_capacity = 1;
+  for (GLuint column = 0; column < 4; column++) {
+    glEnableVertexAttribArray(INSTANCE_ATTRIBUTE + column);
+    glVertexAttribDivisor(INSTANCE_ATTRIBUTE + column, 1);
+  }
+  for (GLuint column = 0; column < 3; column++) {
+    glEnableVertexAttribArray(INSTANCE_NORMAL_ATTRIBUTE + column);
+    glVertexAttribDivisor(INSTANCE_NORMAL_ATTRIBUTE + column, 1);
+  }
+  this->bind_instances(0);
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void GeometryArena::deinit() {
+  if (this->VAO) {
+    glDeleteVertexArrays(1, &this->VAO);
+    glDeleteBuffers(1, &this->VBO);
+    glDeleteBuffers(1, &this->EBO);
+    glDeleteBuffers(1, &this->instance_VBO);
+  }
+  this->VAO = this->VBO = this->EBO = this->instance_VBO = 0;
+  this->_instance_capacity = 0;
+  this->_vertex_capacity = this->_vertex_used = 0;
+  this->_index_capacity = this->_index_used = 0;
+}
+
+GeometryRange GeometryArena::upload(const MeshView &view) {
+  const size_t vertices = vertex_bytes(view);
+  const size_t indices = index_bytes(view);
+  if (this->_vertex_used + vertices > this->_vertex_capacity ||
+      this->_index_used + indices > this->_index_capacity)
+    throw std::runtime_error("Erreur: l'arena de geometrie est pleine");
+
+  GeometryRange range;
+  range.base_vertex = static_cast<GLint>(this->_vertex_used /
+                                         this->_format.stride());
+  range.index_offset = this->_index_used;
+  range.index_count = static_cast<GLsizei>(view.index_count);
+  range.index_type = view.index_type;
+
+  // the copy target leaves the element binding of whatever VAO is bound alone
+  glBindBuffer(GL_COPY_WRITE_BUFFER, this->VBO);
+  glBufferSubData(GL_COPY_WRITE_BUFFER,
+                  static_cast<GLintptr>(this->_vertex_used),
+                  static_cast<GLsizeiptr>(vertices), view.vertices);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, this->EBO);
+  glBufferSubData(GL_COPY_WRITE_BUFFER,
+                  static_cast<GLintptr>(this->_index_used),
+                  static_cast<GLsizeiptr>(view.index_count *
+                                          index_size(view.index_type)),
+                  view.indices);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  this->_vertex_used += vertices;
+  this->_index_used += indices;
+  return range;
+}
+
+void GeometryArena::bind() const { glBindVertexArray(this->VAO); }
+
+void GeometryArena::unbind() const { glBindVertexArray(0); }
+
+void GeometryArena::upload_instances(const InstanceTransform *transforms,
+                                     size_t count) {
+  if (count > this->_instance_capacity)
+    this->_instance_capacity = std::max(count, this->_instance_capacity * 2);
+
+  glBindBuffer(GL_ARRAY_BUFFER, this->instance_VBO);
+  glBufferData(GL_ARRAY_BUFFER,
+               static_cast<GLsizeiptr>(this->_instance_capacity *
+                                       sizeof(InstanceTransform)),
+               nullptr, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0,
+                  static_cast<GLsizeiptr>(count * sizeof(InstanceTransform)),
+                  transforms);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void GeometryArena::bind_instances(size_t first) const {
+  // no base instance before GL 4.2, the pointers move instead
+  glBindBuffer(GL_ARRAY_BUFFER, this->instance_VBO);
+  const size_t base = first * sizeof(InstanceTransform);
+  for (GLuint column = 0; column < 4; column++)
+    glVertexAttribPointer(
+        INSTANCE_ATTRIBUTE + column, 4, GL_FLOAT, GL_FALSE,
+        sizeof(InstanceTransform),
+        reinterpret_cast<void *>(base + offsetof(InstanceTransform, model) +
+                                 column * sizeof(glm::vec4)));
+  for (GLuint column = 0; column < 3; column++)
+    glVertexAttribPointer(
+        INSTANCE_NORMAL_ATTRIBUTE + column, 3, GL_FLOAT, GL_FALSE,
+        sizeof(InstanceTransform),
+        reinterpret_cast<void *>(base + offsetof(InstanceTransform, normal) +
+                                 column * sizeof(glm::vec3)));
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
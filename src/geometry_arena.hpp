@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+
+#include "glad/glad.h"
+#include "mesh.hpp"
+#include <glm/glm.hpp>
+#include <vector>
+
+constexpr GLuint INSTANCE_ATTRIBUTE = 3;
+constexpr GLuint INSTANCE_NORMAL_ATTRIBUTE = 7;
+
+// Inverse transpose of the upper 3x3, keeps normals perpendicular under non
+// uniform scales. Takes the model matrix without the position decode, that
+// one only unpacks positions.
+inline glm::mat3 normal_matrix(const glm::mat4 &model) {
+  return glm::transpose(glm::inverse(glm::mat3(model)));
+}
+
+// What an instanced draw reads per instance
+struct InstanceTransform {
+  // position decode included
+  glm::mat4 model;
+  glm::mat3 normal;
+};
+
+// One vertex buffer, one index buffer and one VAO shared by every mesh of a
+// model. Meshes are appended in upload order and drawn with
+// glDrawElementsBaseVertex, so the 16 bits indices of a mesh stay relative to
+// its own first vertex. Every mesh must use the same VertexFormat.
+// A third, streamed buffer feeds one InstanceTransform per instance for
+// instanced draws, the mat4 at attributes INSTANCE_ATTRIBUTE .. + 3 and the
+// normal matrix at INSTANCE_NORMAL_ATTRIBUTE .. + 2.
+// GL thread only.
+class GeometryArena {
+public:
+  GeometryArena() = default;
+  GeometryArena(const GeometryArena &) = delete;
+  GeometryArena &operator=(const GeometryArena &) = delete;
+  ~GeometryArena() { this->deinit(); }
+
+  // Sizes both buffers for every view at once, nothing is copied yet
+  void init(const std::vector<MeshView> &views);
+  void deinit();
+  bool is_init() const { return this->VAO != 0; }
+
+  // Copies the view in the next free range
+  GeometryRange upload(const MeshView &view);
+
+  void bind() const;
+  void unbind() const;
+
+  // Replaces every instance transform, the buffer is orphaned so the draws
+  // of the previous frame can still read the old ones
+  void upload_instances(const InstanceTransform *transforms, size_t count);
+  // Instanced draws start reading at transforms[first], the arena must be
+  // bound
+  void bind_instances(size_t first) const;
+
+  static size_t vertex_bytes(const MeshView &view);
+  // padded so the next range stays 4 bytes aligned
+  static size_t index_bytes(const MeshView &view);
+
+private:
+  unsigned int VAO = 0, VBO = 0, EBO = 0, instance_VBO = 0;
+  VertexFormat _format;
+  size_t _vertex_capacity = 0, _vertex_used = 0;
+  size_t _index_capacity = 0, _index_used = 0;
+  size_t _instance_capacity = 0;
+};
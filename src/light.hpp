@@ -1,13 +1,21 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "uniform_reflection.hpp"
+
 // Basic K_LINEAR + quadratic + constant for pointlight attenuation
 constexpr float K_CONSTANT = 1;
 constexpr float K_LINEAR = 0.09f;
 constexpr float K_QUADRATIC = 0.032f;
+// for lights without any falloff
+constexpr float MAX_LIGHT_RADIUS = 1000.0f;
 
 struct LightInfo {
   glm::vec3 ambient;
@@ -42,3 +50,76 @@ struct SpotLight {
   LightInfo info;
   AttenuationInfo attenuation_info;
 };
+
+// Uniform layout of the GLSL light structs, info and attenuation fields sit
+// next to the others there
+template <> struct UniformReflection<LightInfo> {
+  static constexpr auto fields =
+      std::make_tuple(UNIFORM_FIELD(LightInfo, ambient),
+                      UNIFORM_FIELD(LightInfo, specular),
+                      UNIFORM_FIELD(LightInfo, diffuse));
+};
+
+template <> struct UniformReflection<AttenuationInfo> {
+  static constexpr auto fields =
+      std::make_tuple(UNIFORM_FIELD(AttenuationInfo, constant),
+                      UNIFORM_FIELD(AttenuationInfo, linear),
+                      UNIFORM_FIELD(AttenuationInfo, quadratic));
+};
+
+template <> struct UniformReflection<PointLight> {
+  static constexpr auto fields =
+      std::make_tuple(UNIFORM_FIELD(PointLight, position),
+                      UNIFORM_NESTED(PointLight, info),
+                      UNIFORM_NESTED(PointLight, attenuation_info));
+};
+
+template <> struct UniformReflection<DirectionalLight> {
+  static constexpr auto fields =
+      std::make_tuple(UNIFORM_FIELD(DirectionalLight, direction),
+                      UNIFORM_NESTED(DirectionalLight, info));
+};
+
+template <> struct UniformReflection<SpotLight> {
+  static constexpr auto fields =
+      std::make_tuple(UNIFORM_FIELD(SpotLight, position),
+                      UNIFORM_FIELD(SpotLight, direction),
+                      UNIFORM_FIELD(SpotLight, inner_cut_off),
+                      UNIFORM_FIELD(SpotLight, outer_cut_off),
+                      UNIFORM_NESTED(SpotLight, info),
+                      UNIFORM_NESTED(SpotLight, attenuation_info));
+};
+
+static_assert(reflected_field_count<PointLight> == 7, "PointLight fields");
+static_assert(reflected_field_count<DirectionalLight> == 4,
+              "DirectionalLight fields");
+static_assert(reflected_field_count<SpotLight> == 10, "SpotLight fields");
+static_assert(std::get<6>(reflected_fields<PointLight>()).offset ==
+                  offsetof(PointLight, attenuation_info) +
+                      offsetof(AttenuationInfo, quadratic),
+              "nested offsets are from the outer struct");
+
+// distance where the light falls under 5 / 256 of its brightest channel,
+// its influence stops there
+inline float light_radius(const LightInfo &info,
+                          const AttenuationInfo &attenuation) {
+  const float brightest =
+      std::max({info.ambient.x, info.ambient.y, info.ambient.z,
+                info.diffuse.x, info.diffuse.y, info.diffuse.z,
+                info.specular.x, info.specular.y, info.specular.z});
+
+  // constant + linear * d + quadratic * d^2 = brightest * 256 / 5
+  const float c = attenuation.constant - brightest * 256.0f / 5.0f;
+  if (c >= 0.0f)
+    return 0.0f;
+  if (attenuation.quadratic > 0.0f)
+    return std::min(
+        (-attenuation.linear +
+         std::sqrt(attenuation.linear * attenuation.linear -
+                   4.0f * attenuation.quadratic * c)) /
+            (2.0f * attenuation.quadratic),
+        MAX_LIGHT_RADIUS);
+  if (attenuation.linear > 0.0f)
+    return std::min(-c / attenuation.linear, MAX_LIGHT_RADIUS);
+  return MAX_LIGHT_RADIUS;
+}
@@ -0,0 +1,115 @@
+#include "light_buffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+static PointLightStd140 to_std140(const PointLight &light) {
+  const AttenuationInfo &attenuation = light.attenuation_info;
+  return PointLightStd140{light.position,       attenuation.constant,
+                          light.info.ambient,   attenuation.linear,
+                          light.info.diffuse,   attenuation.quadratic,
+                          light.info.specular,  0.0f};
+}
+
+static SpotLightStd140 to_std140(const SpotLight &light) {
+  const AttenuationInfo &attenuation = light.attenuation_info;
+  return SpotLightStd140{light.position,      attenuation.constant,
+                         light.direction,     attenuation.linear,
+                         light.info.ambient,  attenuation.quadratic,
+                         light.info.diffuse,  light.inner_cut_off,
+                         light.info.specular, light.outer_cut_off};
+}
+
+static DirectionalLightStd140 to_std140(const DirectionalLight &light) {
+  return DirectionalLightStd140{light.direction,     0.0f,
+                                light.info.ambient,  0.0f,
+                                light.info.diffuse,  0.0f,
+                                light.info.specular, 0.0f};
+}
+
+void LightBuffer::init() {
+  glGenBuffers(1, &this->UBO);
+  glBindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(LightsStd140), &this->_block,
+               GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  glBindBufferBase(GL_UNIFORM_BUFFER, LIGHTS_BINDING, this->UBO);
+  for (Range &range : this->_dirty)
+    range = Range{};
+}
+
+void LightBuffer::deinit() {
+  if (!this->is_init())
+    return;
+  glDeleteBuffers(1, &this->UBO);
+  this->UBO = 0;
+}
+
+template <typename T>
+void LightBuffer::store(Section section, T &stored, const T &value) {
+  // mirrors have no implicit padding, comparing the bytes is enough
+  if (std::memcmp(&stored, &value, sizeof(T)) == 0)
+    return;
+  stored = value;
+
+  const size_t begin = static_cast<size_t>(
+      reinterpret_cast<const char *>(&stored) -
+      reinterpret_cast<const char *>(&this->_block));
+  Range &range = this->_dirty[section];
+  if (range.begin == range.end) {
+    range = Range{begin, begin + sizeof(T)};
+  } else {
+    range.begin = std::min(range.begin, begin);
+    range.end = std::max(range.end, begin + sizeof(T));
+  }
+}
+
+void LightBuffer::sync(
+    const std::vector<PointLight> &point_lights,
+    const std::vector<SpotLight> &spot_lights,
+    const std::vector<DirectionalLight> &directionnal_lights) {
+  const uint32_t point_count =
+      static_cast<uint32_t>(std::min(point_lights.size(), MAX_POINT_LIGHTS));
+  const uint32_t spot_count =
+      static_cast<uint32_t>(std::min(spot_lights.size(), MAX_SPOT_LIGHTS));
+  const uint32_t directionnal_count = static_cast<uint32_t>(
+      std::min(directionnal_lights.size(), MAX_DIRECTIONNAL_LIGHTS));
+
+  // the shaders stop at the counts, removed lights are left as they were
+  this->store(HEADER, this->_block.point_lights_count, point_count);
+  this->store(HEADER, this->_block.spot_lights_count, spot_count);
+  this->store(HEADER, this->_block.directionnal_lights_count,
+              directionnal_count);
+  for (uint32_t i = 0; i < point_count; i++)
+    this->store(POINTS, this->_block.point_lights[i],
+                to_std140(point_lights[i]));
+  for (uint32_t i = 0; i < spot_count; i++)
+    this->store(SPOTS, this->_block.spot_lights[i], to_std140(spot_lights[i]));
+  for (uint32_t i = 0; i < directionnal_count; i++)
+    this->store(DIRECTIONNALS, this->_block.directionnal_lights[i],
+                to_std140(directionnal_lights[i]));
+}
+
+void LightBuffer::upload() {
+  this->_uploaded_bytes = 0;
+  this->_uploaded_ranges = 0;
+
+  const char *block = reinterpret_cast<const char *>(&this->_block);
+  bool bound = false;
+  for (Range &range : this->_dirty) {
+    if (range.begin == range.end)
+      continue;
+    if (!bound) {
+      glBindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+      bound = true;
+    }
+    glBufferSubData(GL_UNIFORM_BUFFER, static_cast<GLintptr>(range.begin),
+                    static_cast<GLsizeiptr>(range.end - range.begin),
+                    block + range.begin);
+    this->_uploaded_bytes += range.end - range.begin;
+    this->_uploaded_ranges++;
+    range = Range{};
+  }
+  if (bound)
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
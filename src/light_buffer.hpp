@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "glad/glad.h"
+#include "light.hpp"
+#include "shader.hpp"
+#include <glm/glm.hpp>
+
+// array sizes of the Lights block, mirrored by the shaders declaring it.
+// Lights past them are left out of the block.
+constexpr size_t MAX_POINT_LIGHTS = 128;
+constexpr size_t MAX_SPOT_LIGHTS = 32;
+constexpr size_t MAX_DIRECTIONNAL_LIGHTS = 4;
+
+// std140 mirrors of the light structs of the Lights block, the scalars fill
+// the 4 bytes following each vec3
+struct PointLightStd140 {
+  glm::vec3 position;
+  float constant;
+  glm::vec3 ambient;
+  float linear;
+  glm::vec3 diffuse;
+  float quadratic;
+  glm::vec3 specular;
+  float padding;
+};
+
+struct SpotLightStd140 {
+  glm::vec3 position;
+  float constant;
+  glm::vec3 direction;
+  float linear;
+  glm::vec3 ambient;
+  float quadratic;
+  glm::vec3 diffuse;
+  float inner_cut_off;
+  glm::vec3 specular;
+  float outer_cut_off;
+};
+
+struct DirectionalLightStd140 {
+  glm::vec3 direction;
+  float padding0;
+  glm::vec3 ambient;
+  float padding1;
+  glm::vec3 diffuse;
+  float padding2;
+  glm::vec3 specular;
+  float padding3;
+};
+
+struct LightsStd140 {
+  uint32_t point_lights_count;
+  uint32_t spot_lights_count;
+  uint32_t directionnal_lights_count;
+  uint32_t padding;
+  PointLightStd140 point_lights[MAX_POINT_LIGHTS];
+  SpotLightStd140 spot_lights[MAX_SPOT_LIGHTS];
+  DirectionalLightStd140 directionnal_lights[MAX_DIRECTIONNAL_LIGHTS];
+};
+
+static_assert(sizeof(PointLightStd140) == 64, "std140 PointLight");
+static_assert(sizeof(SpotLightStd140) == 80, "std140 SpotLight");
+static_assert(sizeof(DirectionalLightStd140) == 64, "std140 DirectionalLight");
+static_assert(offsetof(LightsStd140, point_lights) == 16, "std140 Lights");
+
+// Every light in one uniform buffer shared by the lit programs, instead of
+// a uniform per field and per program. sync() compares the lights with
+// their mirror and only what changed is uploaded, wherever it was changed
+// from. GL thread only for init() and upload().
+class LightBuffer {
+public:
+  LightBuffer() = default;
+  LightBuffer(const LightBuffer &) = delete;
+  LightBuffer &operator=(const LightBuffer &) = delete;
+  ~LightBuffer() { this->deinit(); }
+
+  // Creates the buffer and binds it to LIGHTS_BINDING
+  void init();
+  void deinit();
+  bool is_init() const { return this->UBO != 0; }
+
+  void sync(const std::vector<PointLight> &point_lights,
+            const std::vector<SpotLight> &spot_lights,
+            const std::vector<DirectionalLight> &directionnal_lights);
+  // One glBufferSubData per dirty range
+  void upload();
+
+  size_t last_uploaded_bytes() const { return this->_uploaded_bytes; }
+  size_t last_uploaded_ranges() const { return this->_uploaded_ranges; }
+
+private:
+  // byte range of _block changed since the last upload, begin == end when
+  // clean
+  struct Range {
+    size_t begin = 0, end = 0;
+  };
+  enum Section { HEADER, POINTS, SPOTS, DIRECTIONNALS, SECTION_COUNT };
+
+  unsigned int UBO = 0;
+  LightsStd140 _block{};
+  Range _dirty[SECTION_COUNT];
+  size_t _uploaded_bytes = 0, _uploaded_ranges = 0;
+
+  template <typename T> void store(Section section, T &stored, const T &value);
+};
@@ -0,0 +1,367 @@
+#include "light_grid.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <utility>
+
+#include "thread_pool.hpp"
+
+constexpr uint32_t CLUSTER_COUNT = LIGHT_GRID_X * LIGHT_GRID_Y * LIGHT_GRID_Z;
+constexpr uint32_t SLICE_CLUSTERS = LIGHT_GRID_X * LIGHT_GRID_Y;
+// texels of one light in its texture buffer
+constexpr size_t POINT_LIGHT_TEXELS = 4;
+constexpr size_t SPOT_LIGHT_TEXELS = 5;
+
+// texture units, after the ones of the material
+constexpr int UNIT_GRID = 8;
+constexpr int UNIT_INDICES = 9;
+constexpr int UNIT_POINT_LIGHTS = 10;
+constexpr int UNIT_SPOT_LIGHTS = 11;
+
+// column or row of the tile holding ndc, clamped to the grid
+static uint32_t tile(float ndc, uint32_t count) {
+  const float position = (ndc * 0.5f + 0.5f) * static_cast<float>(count);
+  if (position <= 0.0f)
+    return 0;
+  return std::min(static_cast<uint32_t>(position), count - 1);
+}
+
+static void create_texture_buffer(unsigned int &buffer, unsigned int &texture,
+                                  GLenum format) {
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+  glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_BUFFER, texture);
+  // follows the buffer when its storage is replaced, set once
+  glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+}
+
+static void upload_texture_buffer(unsigned int buffer, const void *data,
+                                  size_t bytes) {
+  // orphaned, last frame draws may still be reading it
+  glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+  glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>(bytes), nullptr,
+               GL_STREAM_DRAW);
+  glBufferSubData(GL_TEXTURE_BUFFER, 0, static_cast<GLsizeiptr>(bytes), data);
+}
+
+void LightGrid::init() {
+  if (!this->_linked) {
+    this->_program.add_shader<VertexShader>(
+        "../src/shaders/model_vertex.glsl");
+    this->_program.add_shader<FragmentShader>(
+        "../src/shaders/model_clustered.frag.glsl");
+    this->_program.link();
+    this->_linked = true;
+  }
+
+  // samplers are program state, set once
+  this->_program.use();
+  this->_program.set_uniform("light_grid", UNIT_GRID);
+  this->_program.set_uniform("light_indices", UNIT_INDICES);
+  this->_program.set_uniform("point_light_data", UNIT_POINT_LIGHTS);
+  this->_program.set_uniform("spot_light_data", UNIT_SPOT_LIGHTS);
+  glUseProgram(0);
+
+  GLint max_texels = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+  this->_max_texels = static_cast<size_t>(std::max(max_texels, 65536));
+
+  create_texture_buffer(this->_grid_buffer, this->_grid_texture, GL_RG32UI);
+  create_texture_buffer(this->_index_buffer, this->_index_texture, GL_R32UI);
+  create_texture_buffer(this->_point_buffer, this->_point_texture,
+                        GL_RGBA32F);
+  create_texture_buffer(this->_spot_buffer, this->_spot_texture, GL_RGBA32F);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightGrid::deinit() {
+  if (!this->is_init())
+    return;
+
+  const unsigned int buffers[] = {this->_grid_buffer, this->_index_buffer,
+                                  this->_point_buffer, this->_spot_buffer};
+  const unsigned int textures[] = {this->_grid_texture, this->_index_texture,
+                                   this->_point_texture, this->_spot_texture};
+  glDeleteBuffers(4, buffers);
+  glDeleteTextures(4, textures);
+  this->_grid_buffer = this->_grid_texture = 0;
+  this->_index_buffer = this->_index_texture = 0;
+  this->_point_buffer = this->_point_texture = 0;
+  this->_spot_buffer = this->_spot_texture = 0;
+}
+
+void LightGrid::build_bounds(const glm::mat4 &projection, float near,
+                             float far) {
+  this->_projection = projection;
+  this->_near = near;
+  this->_far = far;
+  const float ratio = std::log(far / near);
+  this->_slice_scale = static_cast<float>(LIGHT_GRID_Z) / ratio;
+  this->_slice_bias = -std::log(near) * this->_slice_scale;
+
+  // view space direction through every tile corner, z = -1
+  const glm::mat4 inverse = glm::inverse(projection);
+  std::vector<glm::vec3> rays;
+  rays.reserve((LIGHT_GRID_X + 1) * (LIGHT_GRID_Y + 1));
+  for (uint32_t y = 0; y <= LIGHT_GRID_Y; y++)
+    for (uint32_t x = 0; x <= LIGHT_GRID_X; x++) {
+      const glm::vec4 corner =
+          inverse *
+          glm::vec4(static_cast<float>(x) / LIGHT_GRID_X * 2.0f - 1.0f,
+                    static_cast<float>(y) / LIGHT_GRID_Y * 2.0f - 1.0f,
+                    -1.0f, 1.0f);
+      const glm::vec3 ray = glm::vec3(corner) / corner.w;
+      rays.push_back(ray / -ray.z);
+    }
+
+  this->_bounds.resize(CLUSTER_COUNT);
+  for (uint32_t z = 0; z < LIGHT_GRID_Z; z++) {
+    const float depths[2] = {
+        near * std::exp(ratio * static_cast<float>(z) / LIGHT_GRID_Z),
+        near * std::exp(ratio * static_cast<float>(z + 1) / LIGHT_GRID_Z)};
+    for (uint32_t y = 0; y < LIGHT_GRID_Y; y++)
+      for (uint32_t x = 0; x < LIGHT_GRID_X; x++) {
+        BoundingBox box{glm::vec3(std::numeric_limits<float>::max()),
+                        glm::vec3(std::numeric_limits<float>::lowest())};
+        for (uint32_t corner = 0; corner < 4; corner++) {
+          const glm::vec3 &ray = rays[(x + (corner & 1)) +
+                                      (y + (corner >> 1)) * (LIGHT_GRID_X + 1)];
+          for (float depth : depths) {
+            box.min = glm::min(box.min, ray * depth);
+            box.max = glm::max(box.max, ray * depth);
+          }
+        }
+        this->_bounds[x + LIGHT_GRID_X * (y + LIGHT_GRID_Y * z)] = box;
+      }
+  }
+}
+
+uint32_t LightGrid::slice(float depth) const {
+  if (depth <= this->_near)
+    return 0;
+  const float position =
+      std::log(depth) * this->_slice_scale + this->_slice_bias;
+  if (position <= 0.0f)
+    return 0;
+  return std::min(static_cast<uint32_t>(position), LIGHT_GRID_Z - 1);
+}
+
+bool LightGrid::add_candidate(const glm::mat4 &view, const glm::vec3 &position,
+                              float radius, uint32_t index, bool spot) {
+  if (radius <= 0.0f)
+    return false;
+  const glm::vec3 center = glm::vec3(view * glm::vec4(position, 1.0f));
+  const float nearest = -center.z - radius;
+  const float farthest = -center.z + radius;
+  if (farthest < this->_near || nearest > this->_far)
+    return false;
+
+  Candidate candidate{center,       radius,           index,
+                      spot,         0,                LIGHT_GRID_X - 1,
+                      0,            LIGHT_GRID_Y - 1, this->slice(nearest),
+                      this->slice(farthest)};
+  // Screen rectangle of the box around the sphere. Crossing the near plane
+  // it is unbounded, every tile of its slices stays a candidate.
+  if (nearest > this->_near) {
+    glm::vec2 min(std::numeric_limits<float>::max());
+    glm::vec2 max(std::numeric_limits<float>::lowest());
+    for (int corner = 0; corner < 8; corner++) {
+      const glm::vec4 clip =
+          this->_projection *
+          glm::vec4(center.x + (corner & 1 ? radius : -radius),
+                    center.y + (corner & 2 ? radius : -radius),
+                    center.z + (corner & 4 ? radius : -radius), 1.0f);
+      const glm::vec2 ndc = glm::vec2(clip.x, clip.y) / clip.w;
+      min = glm::min(min, ndc);
+      max = glm::max(max, ndc);
+    }
+    if (max.x < -1.0f || min.x > 1.0f || max.y < -1.0f || min.y > 1.0f)
+      return false;
+    candidate.min_x = tile(min.x, LIGHT_GRID_X);
+    candidate.max_x = tile(max.x, LIGHT_GRID_X);
+    candidate.min_y = tile(min.y, LIGHT_GRID_Y);
+    candidate.max_y = tile(max.y, LIGHT_GRID_Y);
+  }
+  this->_candidates.push_back(candidate);
+  return true;
+}
+
+void LightGrid::bin_slice(uint32_t z) {
+  const uint32_t first = z * SLICE_CLUSTERS;
+  for (uint32_t cluster = first; cluster < first + SLICE_CLUSTERS; cluster++) {
+    this->_cluster_lights[cluster].clear();
+    this->_cluster_points[cluster] = 0;
+  }
+
+  // points are queued before spots, each cluster keeps that order
+  for (const Candidate &candidate : this->_candidates) {
+    if (z < candidate.min_z || z > candidate.max_z)
+      continue;
+    const float radius_squared = candidate.radius * candidate.radius;
+    for (uint32_t y = candidate.min_y; y <= candidate.max_y; y++)
+      for (uint32_t x = candidate.min_x; x <= candidate.max_x; x++) {
+        const uint32_t cluster = first + x + LIGHT_GRID_X * y;
+        std::vector<uint32_t> &lights = this->_cluster_lights[cluster];
+        if (lights.size() >= LIGHT_GRID_MAX_PER_CLUSTER)
+          continue;
+
+        const BoundingBox &box = this->_bounds[cluster];
+        const glm::vec3 delta =
+            glm::min(glm::max(candidate.center, box.min), box.max) -
+            candidate.center;
+        if (glm::dot(delta, delta) > radius_squared)
+          continue;
+        lights.push_back(candidate.index);
+        if (!candidate.spot)
+          this->_cluster_points[cluster]++;
+      }
+  }
+}
+
+void LightGrid::build(const glm::mat4 &view, const glm::mat4 &projection,
+                      float near, float far,
+                      const std::vector<PointLight> &point_lights,
+                      const std::vector<SpotLight> &spot_lights) {
+  auto start = std::chrono::high_resolution_clock::now();
+  if (projection != this->_projection || near != this->_near ||
+      far != this->_far)
+    this->build_bounds(projection, near, far);
+  this->_cluster_lights.resize(CLUSTER_COUNT);
+  this->_cluster_points.resize(CLUSTER_COUNT);
+
+  // every light goes up, the index list refers to them by position
+  const size_t point_count =
+      std::min(point_lights.size(), this->_max_texels / POINT_LIGHT_TEXELS);
+  const size_t spot_count =
+      std::min(spot_lights.size(), this->_max_texels / SPOT_LIGHT_TEXELS);
+  this->_candidates.clear();
+  this->_point_data.clear();
+  for (size_t i = 0; i < point_count; i++) {
+    const PointLight &light = point_lights[i];
+    const AttenuationInfo &attenuation = light.attenuation_info;
+    this->_point_data.push_back(
+        glm::vec4(light.position, attenuation.constant));
+    this->_point_data.push_back(
+        glm::vec4(light.info.ambient, attenuation.linear));
+    this->_point_data.push_back(
+        glm::vec4(light.info.diffuse, attenuation.quadratic));
+    this->_point_data.push_back(glm::vec4(light.info.specular, 0.0f));
+    this->add_candidate(view, light.position,
+                        light_radius(light.info, attenuation),
+                        static_cast<uint32_t>(i), false);
+  }
+  this->_spot_data.clear();
+  for (size_t i = 0; i < spot_count; i++) {
+    const SpotLight &light = spot_lights[i];
+    const AttenuationInfo &attenuation = light.attenuation_info;
+    this->_spot_data.push_back(
+        glm::vec4(light.position, attenuation.constant));
+    this->_spot_data.push_back(
+        glm::vec4(light.direction, attenuation.linear));
+    this->_spot_data.push_back(
+        glm::vec4(light.info.ambient, attenuation.quadratic));
+    this->_spot_data.push_back(
+        glm::vec4(light.info.diffuse, light.inner_cut_off));
+    this->_spot_data.push_back(
+        glm::vec4(light.info.specular, light.outer_cut_off));
+    // the cone is ignored, its sphere is conservative
+    this->add_candidate(view, light.position,
+                        light_radius(light.info, attenuation),
+                        static_cast<uint32_t>(i), true);
+  }
+
+  // Same scheme as OcclusionCuller::rasterize(), workers and caller pull
+  // slices until none is left
+  struct Slices {
+    std::atomic<uint32_t> next{0};
+    std::atomic<uint32_t> done{0};
+  };
+  auto slices = std::make_shared<Slices>();
+  auto work = [this, slices]() {
+    for (uint32_t z = slices->next++; z < LIGHT_GRID_Z; z = slices->next++) {
+      this->bin_slice(z);
+      slices->done++;
+    }
+  };
+  if (!this->_candidates.empty()) {
+    ThreadPool &pool = ThreadPool::global();
+    const size_t helpers = std::min(pool.worker_count(),
+                                    static_cast<size_t>(LIGHT_GRID_Z - 1));
+    for (size_t i = 0; i < helpers; i++)
+      pool.submit(work);
+  }
+  work();
+  while (slices->done < LIGHT_GRID_Z)
+    std::this_thread::yield();
+
+  this->_grid.resize(CLUSTER_COUNT * 2);
+  this->_indices.clear();
+  this->_stats.max_per_cluster = 0;
+  for (uint32_t cluster = 0; cluster < CLUSTER_COUNT; cluster++) {
+    const std::vector<uint32_t> &lights = this->_cluster_lights[cluster];
+    uint32_t points = this->_cluster_points[cluster];
+    uint32_t spots = static_cast<uint32_t>(lights.size()) - points;
+    // past the texture buffer limit the cluster goes dark
+    if (this->_indices.size() + lights.size() > this->_max_texels)
+      points = spots = 0;
+    this->_grid[cluster * 2] = static_cast<uint32_t>(this->_indices.size());
+    this->_grid[cluster * 2 + 1] = points | spots << 16;
+    this->_indices.insert(this->_indices.end(), lights.begin(),
+                          lights.begin() + points + spots);
+    this->_stats.max_per_cluster =
+        std::max(this->_stats.max_per_cluster, lights.size());
+  }
+  this->_stats.lights = this->_candidates.size();
+  this->_stats.indices = this->_indices.size();
+
+  // a texture buffer needs some storage, even with nothing in it
+  if (this->_indices.empty())
+    this->_indices.push_back(0);
+  if (this->_point_data.empty())
+    this->_point_data.emplace_back(0.0f);
+  if (this->_spot_data.empty())
+    this->_spot_data.emplace_back(0.0f);
+
+  auto end = std::chrono::high_resolution_clock::now();
+  this->_stats.bin_ms =
+      std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void LightGrid::upload() {
+  upload_texture_buffer(this->_grid_buffer, this->_grid.data(),
+                        this->_grid.size() * sizeof(uint32_t));
+  upload_texture_buffer(this->_index_buffer, this->_indices.data(),
+                        this->_indices.size() * sizeof(uint32_t));
+  upload_texture_buffer(this->_point_buffer, this->_point_data.data(),
+                        this->_point_data.size() * sizeof(glm::vec4));
+  upload_texture_buffer(this->_spot_buffer, this->_spot_data.data(),
+                        this->_spot_data.size() * sizeof(glm::vec4));
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightGrid::bind(const Shader &program, int width, int height) const {
+  const std::pair<int, unsigned int> textures[] = {
+      {UNIT_GRID, this->_grid_texture},
+      {UNIT_INDICES, this->_index_texture},
+      {UNIT_POINT_LIGHTS, this->_point_texture},
+      {UNIT_SPOT_LIGHTS, this->_spot_texture}};
+  for (const auto &[unit, texture] : textures) {
+    glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(unit));
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+  }
+  glActiveTexture(GL_TEXTURE0);
+
+  program.set_uniform("light_grid_screen",
+                      glm::vec2(static_cast<float>(width),
+                                static_cast<float>(height)));
+  program.set_uniform("light_grid_scale", this->_slice_scale);
+  program.set_uniform("light_grid_bias", this->_slice_bias);
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "glad/glad.h"
+#include "light.hpp"
+#include "mesh.hpp"
+#include "shader.hpp"
+#include <glm/glm.hpp>
+
+// Froxels, screen tiles times exponential depth slices. Mirrored by the
+// defines of model_clustered.frag.glsl.
+constexpr uint32_t LIGHT_GRID_X = 16;
+constexpr uint32_t LIGHT_GRID_Y = 9;
+constexpr uint32_t LIGHT_GRID_Z = 24;
+// lights past this in one cluster are dropped, bounds the fragment cost
+constexpr size_t LIGHT_GRID_MAX_PER_CLUSTER = 512;
+
+struct LightGridStats {
+  // CPU binning of build()
+  double bin_ms = 0.0;
+  // lights touching at least one cluster
+  size_t lights = 0;
+  // total entries of the index list
+  size_t indices = 0;
+  size_t max_per_cluster = 0;
+};
+
+// Clustered forward shading. Point and spot lights are binned on the CPU
+// into the froxels of the projection, then a fragment only loops over the
+// lights of its own cluster so the cost follows the lights per pixel.
+// Every slice is binned by the caller or the thread pool, the results go up
+// as texture buffers:
+// - grid, RG32UI, offset in the index list + point count | spot count << 16
+// - index list, R32UI, point indices then spot indices of each cluster
+// - point and spot lights, RGBA32F, 4 and 5 texels per light
+// Directional lights touch everything and come from the LightBuffer.
+class LightGrid {
+public:
+  LightGrid() = default;
+  LightGrid(const LightGrid &) = delete;
+  LightGrid &operator=(const LightGrid &) = delete;
+  ~LightGrid() { this->deinit(); }
+
+  // Programs and buffers, GL thread
+  void init();
+  void deinit();
+  bool is_init() const { return this->_grid_texture != 0; }
+
+  // Bins the lights for this frame, no GL call
+  void build(const glm::mat4 &view, const glm::mat4 &projection, float near,
+             float far, const std::vector<PointLight> &point_lights,
+             const std::vector<SpotLight> &spot_lights);
+  // What build() produced to the texture buffers, GL thread
+  void upload();
+  // Binds the texture buffers and sets the grid uniforms of program, which
+  // has to be in use. width and height are the viewport the grid covers.
+  void bind(const Shader &program, int width, int height) const;
+
+  // model_vertex.glsl + model_clustered.frag.glsl
+  const Shader &program() const { return this->_program; }
+
+  const LightGridStats &stats() const { return this->_stats; }
+
+private:
+  // view space sphere of one light and the clusters it may touch
+  struct Candidate {
+    glm::vec3 center;
+    float radius;
+    uint32_t index;
+    bool spot;
+    uint32_t min_x, max_x, min_y, max_y, min_z, max_z;
+  };
+
+  Shader _program;
+  bool _linked = false;
+  unsigned int _grid_buffer = 0, _grid_texture = 0;
+  unsigned int _index_buffer = 0, _index_texture = 0;
+  unsigned int _point_buffer = 0, _point_texture = 0;
+  unsigned int _spot_buffer = 0, _spot_texture = 0;
+  // GL_MAX_TEXTURE_BUFFER_SIZE, caps the index list and the lights
+  size_t _max_texels = 65536;
+
+  // view space bounds of every cluster, rebuilt when the projection changes
+  glm::mat4 _projection{0.0f};
+  float _near = 0.0f, _far = 0.0f;
+  std::vector<BoundingBox> _bounds;
+  // log(depth) * scale + bias gives the slice
+  float _slice_scale = 0.0f, _slice_bias = 0.0f;
+
+  std::vector<Candidate> _candidates;
+  // filled by the slices, each cluster only ever touched by its own slice
+  std::vector<std::vector<uint32_t>> _cluster_lights;
+  std::vector<uint32_t> _cluster_points;
+
+  // what goes up in upload()
+  std::vector<uint32_t> _grid;
+  std::vector<uint32_t> _indices;
+  std::vector<glm::vec4> _point_data;
+  std::vector<glm::vec4> _spot_data;
+  LightGridStats _stats;
+
+  void build_bounds(const glm::mat4 &projection, float near, float far);
+  bool add_candidate(const glm::mat4 &view, const glm::vec3 &position,
+                     float radius, uint32_t index, bool spot);
+  uint32_t slice(float depth) const;
+  void bin_slice(uint32_t z);
+};
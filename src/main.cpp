@@ -12,11 +12,22 @@
 #include <algorithm>
 #include <iostream>
 #include <ostream>
+#include <random>
 
 #include "camera.hpp"
+#include "deferred_renderer.hpp"
+#include "frame_constants.hpp"
 #include "light.hpp"
+#include "light_buffer.hpp"
+#include "light_grid.hpp"
 #include "model.hpp"
+#include "occlusion_culler.hpp"
+#include "pixel_uploader.hpp"
 #include "shader.hpp"
+#include "spatial_index.hpp"
+#include "texture_cache.hpp"
+#include "texture_compressor.hpp"
+#include "upload_queue.hpp"
 
 enum class RenderMode {
   None = 0,
@@ -30,6 +41,24 @@ int WIDTH = 1920;
 int HEIGHT = 1080;
 constexpr float DEFAULT_FOV = 45.0f;
 
+// LIGHTS
+constexpr float SHININESS = 32.0f;
+// Benchmark scene of the deferred and clustered paths
+constexpr size_t SPAWNED_POINT_LIGHTS = 256;
+
+// What the lit forward programs read from their Material every frame, the
+// diffuse and specular samplers are set per mesh by Mesh::bind_textures
+struct MaterialConstants {
+  int emission;
+  float shininess;
+};
+
+template <> struct UniformReflection<MaterialConstants> {
+  static constexpr auto fields =
+      std::make_tuple(UNIFORM_FIELD(MaterialConstants, emission),
+                      UNIFORM_FIELD(MaterialConstants, shininess));
+};
+
 // FLY CAMERA
 FlyCamera P_CAMERA(glm::vec3(0.0, 0.0, 3.0), DEFAULT_FOV);
 float X_POS = static_cast<float>(WIDTH) / 2;
@@ -58,6 +87,8 @@ void mouse_callback(GLFWwindow *window, double x, double y);
 void scroll_callback(GLFWwindow *window, double x, double y);
 
 void redefine_projection_matrix();
+void spawn_point_lights(std::vector<PointLight> &point_lights,
+                        const BoundingBox &box, size_t count);
 
 int main() {
   if (FcInit() == 0) {
@@ -88,6 +119,7 @@ int main() {
     std::cerr << "Erreur: Impossible de load via glad\n";
     return 1;
   }
+  detect_texture_compression();
 
   // To run destructor before we reach glfwTerminate() at the end of main
   // (avoid seg fault)
@@ -109,9 +141,6 @@ int main() {
     linear_depth_program.add_shader<FragmentShader>(
         "../src/shaders/linear_depth.frag.glsl");
     linear_depth_program.link();
-    linear_depth_program.use();
-    linear_depth_program.set_uniform("near", NEAR_PLANE);
-    linear_depth_program.set_uniform("far", FAR_PLANE);
 
     Shader model_shader_program;
     model_shader_program.add_shader<VertexShader>(
@@ -120,6 +149,14 @@ int main() {
         "../src/shaders/model_fragment.glsl");
     model_shader_program.link();
 
+    // camera of the frame, shared by every program
+    FrameConstants frame_constants;
+    frame_constants.init();
+
+    // every light of the scene, shared by the lit programs
+    LightBuffer light_buffer;
+    light_buffer.init();
+
     Shader normal_shader_program;
     normal_shader_program.add_shader<VertexShader>(
         "../src/shaders/model_vertex.glsl");
@@ -137,7 +174,26 @@ int main() {
 
     Shader *shader_in_use = &model_shader_program;
 
-    Model sponza("../assets/models/backpack/backpack.obj");
+    // Streamed in while the first frames are already rendering
+    ModelBuilder sponza_builder;
+    sponza_builder.streaming = true;
+    sponza_builder.vertex_format = {PositionFormat::UNORM16,
+                                    NormalFormat::OCTAHEDRAL, UvFormat::HALF};
+    Model sponza("../assets/models/backpack/backpack.obj", sponza_builder);
+    // occluders are the models themselves, rasterized again every frame
+    OcclusionCuller occlusion;
+    sponza.set_occlusion_culler(&occlusion);
+
+    DeferredRenderer deferred_renderer;
+    deferred_renderer.init(WIDTH, HEIGHT);
+    LightGrid light_grid;
+    light_grid.init();
+
+    // Material of the lit forward programs, resolved once per program
+    const UniformStruct<MaterialConstants> forward_material =
+        model_shader_program.uniform_struct<MaterialConstants>("material");
+    const UniformStruct<MaterialConstants> clustered_material =
+        light_grid.program().uniform_struct<MaterialConstants>("material");
 
     // Wireframe mode
     // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
@@ -160,9 +216,24 @@ int main() {
 
     const char *depth_options[] = {"None", "Normal", "Depth_Linear",
                                    "Depth_Non-Linear"};
+    const char *occlusion_options[] = {"None", "Software", "GPU queries"};
+    const char *path_options[] = {"Forward", "Deferred", "Clustered"};
+    RenderPath render_path = RenderPath::FORWARD;
     bool wireframe_mode = false;
     RenderOptions render_options;
     int depth_mode_option = 0;
+    // side of a grid of backpacks drawn with draw_instanced, 0 for just one
+    int instance_grid = 0;
+    std::vector<glm::mat4> instance_models;
+    // The placements of the grid are entities, the spatial index gives the
+    // ones in view. spatial after world, it disconnects from it on
+    // destruction.
+    entt::registry world;
+    SpatialIndex spatial(world);
+    std::vector<entt::entity> placements;
+    std::vector<entt::entity> visible_placements;
+    int placed_grid = 0;
+    BoundingBox placed_bounds = sponza.bounds();
 
     while (glfwWindowShouldClose(window) == 0) {
       LAST_TIME = TIME;
@@ -182,6 +253,66 @@ int main() {
 
         if (ImGui::CollapsingHeader("Debug")) {
           ImGui::Text("FPS: %f", fps);
+
+          UploadQueue &uploads = UploadQueue::global();
+          ImGui::Text("Pending uploads: %zu", uploads.pending());
+          ImGui::Text("Last frame: %zu bytes in %.2fms",
+                      uploads.last_uploaded_bytes(), uploads.last_upload_ms());
+          float budget_ms = static_cast<float>(uploads.budget().max_ms);
+          if (ImGui::SliderFloat("Upload budget (ms)", &budget_ms, 0.1f, 16.0f))
+            uploads.budget().max_ms = budget_ms;
+          int budget_mb = static_cast<int>(uploads.budget().max_bytes >> 20);
+          if (ImGui::SliderInt("Upload budget (MB)", &budget_mb, 1, 256))
+            uploads.budget().max_bytes = static_cast<size_t>(budget_mb) << 20;
+
+          ImGui::Text("Triangles: %zu", sponza.drawn_triangles());
+          const CullingStats culling = sponza.culling_stats();
+          ImGui::Text("Meshes: %zu visible, %zu culled, %zu occluded",
+                      culling.visible, culling.culled, culling.occluded);
+          const OcclusionStats &occlusion_stats = occlusion.stats();
+          ImGui::Text("Occlusion: %zu triangles in %.3fms",
+                      occlusion_stats.triangles, occlusion_stats.raster_ms);
+          ImGui::Text("Occlusion: %zu / %zu rejected (%.1f%%)",
+                      occlusion_stats.occluded, occlusion_stats.tested,
+                      occlusion_stats.tested
+                          ? 100.0 * static_cast<double>(
+                                        occlusion_stats.occluded) /
+                                static_cast<double>(occlusion_stats.tested)
+                          : 0.0);
+          ImGui::Text("Spatial index: %zu / %zu in view, sync %.3fms",
+                      visible_placements.size(), spatial.size(),
+                      spatial.last_sync_ms());
+          const ClusterStats clusters = sponza.cluster_stats();
+          ImGui::Text("Clusters: %zu / %zu", clusters.visible, clusters.tested);
+          const LoadStats &load = sponza.load_stats();
+          ImGui::Text("Import: %.1fms%s", load.import_ms,
+                      load.from_cache ? " (cache)" : "");
+          const MeshOptimizationStats &mesh_stats = sponza.optimization_stats();
+          if (mesh_stats.before.triangles)
+            ImGui::Text("ACMR: %.3f -> %.3f, ATVR: %.3f -> %.3f",
+                        mesh_stats.before.acmr(), mesh_stats.after.acmr(),
+                        mesh_stats.before.atvr(), mesh_stats.after.atvr());
+          else
+            ImGui::Text("ACMR: %.3f, ATVR: %.3f", mesh_stats.after.acmr(),
+                        mesh_stats.after.atvr());
+          ImGui::Text("Textures: %zu (%zu KB)", TextureCache::global().size(),
+                      TextureCache::global().resident_bytes() >> 10);
+          ImGui::Text("Lights: %zu bytes in %zu ranges",
+                      light_buffer.last_uploaded_bytes(),
+                      light_buffer.last_uploaded_ranges());
+          if (render_path == RenderPath::DEFERRED)
+            ImGui::Text("Deferred: %zu point lights, geometry %.3fms, "
+                        "lighting %.3fms",
+                        deferred_renderer.point_light_count(),
+                        deferred_renderer.geometry_ms(),
+                        deferred_renderer.lighting_ms());
+          if (render_path == RenderPath::CLUSTERED) {
+            const LightGridStats &grid_stats = light_grid.stats();
+            ImGui::Text("Light grid: %zu lights binned in %.3fms",
+                        grid_stats.lights, grid_stats.bin_ms);
+            ImGui::Text("Light grid: %zu indices, at most %zu per cluster",
+                        grid_stats.indices, grid_stats.max_per_cluster);
+          }
         }
 
         if (ImGui::CollapsingHeader("Rendering")) {
@@ -212,15 +343,33 @@ int main() {
             }
           }
 
-          bool outlining;
+          bool outlining = render_options.outline_enabled;
           if (ImGui::Checkbox("Outline", &outlining)) {
-            if (outlining) {
-              render_options = RenderOptions{
-                  true, Outline{glm::vec3(1.0, 0.0, 0.0), glm::vec3(1.01f)}};
-            } else {
-              render_options = RenderOptions();
-            }
+            render_options.outline_enabled = outlining;
+            render_options.outline =
+                outlining
+                    ? Outline{glm::vec3(1.0, 0.0, 0.0), glm::vec3(1.01f)}
+                    : RenderOptions().outline;
           }
+
+          ImGui::Checkbox("LOD", &render_options.lod_enabled);
+          ImGui::SliderFloat("LOD error (px)",
+                             &render_options.lod_error_pixels, 0.1f, 16.0f);
+          ImGui::Checkbox("Frustum culling", &render_options.frustum_culling);
+          ImGui::Checkbox("Cluster culling", &render_options.cluster_culling);
+          int occlusion_mode = static_cast<int>(render_options.occlusion);
+          if (ImGui::Combo("Occlusion", &occlusion_mode, occlusion_options,
+                           sizeof(occlusion_options) /
+                               sizeof(occlusion_options[0])))
+            render_options.occlusion =
+                static_cast<OcclusionMode>(occlusion_mode);
+          if (render_options.occlusion == OcclusionMode::QUERIES)
+            ImGui::Checkbox("Depth pre-pass", &render_options.depth_prepass);
+          ImGui::SliderInt("Instance grid", &instance_grid, 0, 64);
+          int path = static_cast<int>(render_path);
+          if (ImGui::Combo("Path", &path, path_options,
+                           sizeof(path_options) / sizeof(path_options[0])))
+            render_path = static_cast<RenderPath>(path);
         }
 
         if (ImGui::CollapsingHeader("Player")) {
@@ -287,6 +436,10 @@ int main() {
             if (ImGui::Button("Add Point Light")) {
               point_lights.push_back(PointLight{});
             }
+            ImGui::SameLine();
+            if (ImGui::Button("Spawn 256 Point Lights"))
+              spawn_point_lights(point_lights, sponza.bounds(),
+                                 SPAWNED_POINT_LIGHTS);
 
             ImGui::TreePop();
           }
@@ -389,53 +542,112 @@ int main() {
               GL_STENCIL_BUFFER_BIT);
 
       VIEW = P_CAMERA.looking_at();
-
-      // Backpack
-      shader_in_use->use();
-
-      shader_in_use->set_uniform("camera_pos", P_CAMERA.get_position());
-
-      // Give light settings (disabled for now)
-      shader_in_use->set_uniform(
-          "point_lights_count", static_cast<unsigned int>(point_lights.size()));
-      shader_in_use->set_uniform(
-          "directionnal_lights_count",
-          static_cast<unsigned int>(directionnal_lights.size()));
-      shader_in_use->set_uniform("spot_lights_count",
-                                 static_cast<unsigned int>(spot_lights.size()));
-
-      unsigned int i = 0;
-      for (const auto &point_light : point_lights) {
-        auto str = "point_lights[" + std::to_string(i) + "]";
-        shader_in_use->set_uniform_struct(str.data(), point_light);
-        i++;
+      frame_constants.update(VIEW, PROJECTION, P_CAMERA.get_position(),
+                             NEAR_PLANE, FAR_PLANE, static_cast<float>(TIME));
+
+      // GPU uploads of streamed models, bounded by the frame budget
+      UploadQueue::global().drain();
+
+      // only what the editor or gameplay changed goes up
+      light_buffer.sync(point_lights, spot_lights, directionnal_lights);
+      light_buffer.upload();
+
+      // Backpack, every model program reads its transforms per instance
+      const bool deferred = render_path == RenderPath::DEFERRED;
+      const bool clustered = render_path == RenderPath::CLUSTERED;
+      const bool instanced = instance_grid > 0;
+      const Shader *program = shader_in_use;
+      // the depth and normal views have no material
+      const UniformStruct<MaterialConstants> *material =
+          shader_in_use == &model_shader_program ? &forward_material
+                                                 : nullptr;
+      if (deferred) {
+        deferred_renderer.resize(WIDTH, HEIGHT);
+        deferred_renderer.begin_geometry();
+        program = &deferred_renderer.geometry_program();
+        program->use();
+        // shininess is a uniform of the light pass there
+        program->set_uniform("material.emission", 2);
+      } else {
+        if (clustered) {
+          light_grid.build(VIEW, PROJECTION, NEAR_PLANE, FAR_PLANE,
+                           point_lights, spot_lights);
+          light_grid.upload();
+          program = &light_grid.program();
+          material = &clustered_material;
+        }
+        program->use();
+        // the lights themselves are in light_buffer
+        if (clustered)
+          light_grid.bind(*program, WIDTH, HEIGHT);
+        if (material)
+          program->set_uniform_struct(*material,
+                                      MaterialConstants{2, SHININESS});
       }
 
-      i = 0;
-      for (const auto &directionnal_light : directionnal_lights) {
-        auto str = "directionnal_lights[" + std::to_string(i) + "]";
-        shader_in_use->set_uniform_struct(str.data(), directionnal_light);
-        i++;
+      // Drawing the model, the outline is forward only
+      RenderOptions options = render_options;
+      options.outline_enabled = options.outline_enabled && !deferred;
+      sponza.set_render_options(options);
+      const glm::mat4 sponza_model = glm::translate(
+          glm::scale(IDENTITY, glm::vec3(1.0f)), glm::vec3(0.0, 0.0, 0.0));
+      // the grid changed size, or the model finished streaming in
+      const BoundingBox &bounds = sponza.bounds();
+      if (placed_grid != instance_grid) {
+        for (const entt::entity placement : placements)
+          world.destroy(placement);
+        placements.clear();
+        const size_t side = static_cast<size_t>(instance_grid);
+        for (size_t x = 0; x < side; x++)
+          for (size_t z = 0; z < side; z++) {
+            const entt::entity placement = world.create();
+            world.emplace<WorldTransform>(
+                placement,
+                WorldTransform{glm::translate(
+                    IDENTITY, glm::vec3(static_cast<float>(x) * 5.0f, 0.0f,
+                                        -static_cast<float>(z) * 5.0f))});
+            world.emplace<LocalBounds>(placement, LocalBounds{bounds});
+            placements.push_back(placement);
+          }
+        placed_grid = instance_grid;
+        placed_bounds = bounds;
+      } else if (bounds.min != placed_bounds.min ||
+                 bounds.max != placed_bounds.max) {
+        for (const entt::entity placement : placements)
+          world.replace<LocalBounds>(placement, LocalBounds{bounds});
+        placed_bounds = bounds;
+      }
+      spatial.sync();
+      if (instanced) {
+        visible_placements.clear();
+        spatial.query_frustum(Frustum::from(PROJECTION * VIEW),
+                              visible_placements);
+        instance_models.clear();
+        for (const entt::entity placement : visible_placements)
+          instance_models.push_back(
+              world.get<WorldTransform>(placement).matrix);
       }
 
-      i = 0;
-      for (const auto &spot_light : spot_lights) {
-        auto str = "spot_lights[" + std::to_string(i) + "]";
-        shader_in_use->set_uniform_struct(str.data(), spot_light);
-        i++;
+      // Occluders of this frame before anything is tested against them
+      occlusion.begin(PROJECTION * VIEW);
+      if (render_options.occlusion == OcclusionMode::SOFTWARE) {
+        if (instanced)
+          for (const glm::mat4 &model : instance_models)
+            sponza.add_occluders(occlusion, model);
+        else
+          sponza.add_occluders(occlusion, sponza_model);
+        occlusion.rasterize();
       }
 
-      // give the camera position for lightining calculation
-      shader_in_use->set_uniform("material.shininess", 32.0f);
-      shader_in_use->set_uniform("material.emission", 2);
+      if (instanced)
+        sponza.draw_instanced(*program, VIEW, PROJECTION, instance_models);
+      else
+        sponza.draw(*program, Transform{VIEW, PROJECTION, sponza_model});
 
-      // Drawing the model
-      sponza.set_render_options(render_options);
-      sponza.draw(
-          *shader_in_use,
-          Transform{VIEW, PROJECTION,
-                    glm::translate(glm::scale(IDENTITY, glm::vec3(1.0f)),
-                                   glm::vec3(0.0, 0.0, 0.0))});
+      if (deferred) {
+        deferred_renderer.end_geometry();
+        deferred_renderer.light(VIEW, PROJECTION, SHININESS, point_lights);
+      }
 
       GLenum gl_error;
       if ((gl_error = glGetError()) != GL_NO_ERROR) {
@@ -448,6 +660,8 @@ int main() {
       glfwSwapBuffers(window);
       glfwPollEvents();
     }
+
+    PixelUploader::global().deinit();
   }
 
   glfwTerminate();
@@ -540,3 +754,26 @@ void redefine_projection_matrix() {
                        static_cast<float>(WIDTH) / static_cast<float>(HEIGHT),
                        NEAR_PLANE, FAR_PLANE);
 }
+
+// Same seed every time so both paths can be compared on the same scene
+void spawn_point_lights(std::vector<PointLight> &point_lights,
+                        const BoundingBox &box, size_t count) {
+  glm::vec3 min = box.min, max = box.max;
+  if (max.x < min.x) {
+    min = glm::vec3(-10.0f, 0.0f, -10.0f);
+    max = glm::vec3(10.0f, 5.0f, 10.0f);
+  }
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  for (size_t i = 0; i < count; i++) {
+    PointLight light{};
+    light.position = glm::vec3(min.x + (max.x - min.x) * unit(rng),
+                               min.y + (max.y - min.y) * unit(rng),
+                               min.z + (max.z - min.z) * unit(rng));
+    light.info.diffuse = glm::vec3(unit(rng), unit(rng), unit(rng));
+    light.info.specular = light.info.diffuse;
+    light.info.ambient = glm::vec3(0.0f);
+    light.attenuation_info = AttenuationInfo{1.0f, 0.7f, 1.8f};
+    point_lights.push_back(light);
+  }
+}
@@ -0,0 +1,48 @@
+#include "mapped_file.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool MappedFile::open(const std::string &path) {
+  this->close();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size <= 0) {
+    ::close(fd);
+    return false;
+  }
+
+  void *data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                    MAP_PRIVATE, fd, 0);
+  // the mapping keeps its own reference on the file
+  ::close(fd);
+  if (data == MAP_FAILED)
+    return false;
+
+  this->_data = static_cast<const unsigned char *>(data);
+  this->_size = static_cast<size_t>(st.st_size);
+  return true;
+}
+
+void MappedFile::close() {
+  if (this->_data)
+    munmap(const_cast<unsigned char *>(this->_data), this->_size);
+  this->_data = nullptr;
+  this->_size = 0;
+}
+
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed) {
+  const auto *bytes = static_cast<const unsigned char *>(data);
+  uint64_t hash = seed;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
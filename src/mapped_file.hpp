@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read only memory mapping of a whole file, unmapped on destruction
+class MappedFile {
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() { this->close(); }
+
+  bool open(const std::string &path);
+  void close();
+
+  bool is_open() const { return this->_data != nullptr; }
+  const unsigned char *data() const { return this->_data; }
+  size_t size() const { return this->_size; }
+
+private:
+  const unsigned char *_data = nullptr;
+  size_t _size = 0;
+};
+
+constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ull;
+constexpr uint64_t FNV_PRIME = 0x100000001b3ull;
+
+// FNV-1a, chain calls by passing the previous result as seed
+uint64_t hash_bytes(const void *data, size_t size,
+                    uint64_t seed = FNV_OFFSET_BASIS);
@@ -1,9 +1,183 @@
 #include "mesh.hpp"
+#include "geometry_arena.hpp"
 #include "shader.hpp"
 #include "texture2D.hpp"
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
+#include <cstring>
+#include <glm/gtc/packing.hpp>
+#include <unordered_map>
 
-void Mesh::draw(const Shader &shader) const {
+bool VertexFormat::is_packed() const {
+  return this->position != PositionFormat::FLOAT ||
+         this->normal != NormalFormat::FLOAT ||
+         this->texture_coordinate != UvFormat::FLOAT;
+}
+
+// quantized positions keep a padding short to stay 4 bytes aligned
+static size_t position_size(PositionFormat format) {
+  return format == PositionFormat::UNORM16 ? 4 * sizeof(uint16_t)
+                                           : sizeof(glm::vec3);
+}
+
+size_t VertexFormat::normal_offset() const {
+  return position_size(this->position);
+}
+
+size_t VertexFormat::texture_coordinate_offset() const {
+  return this->normal_offset() + (this->normal == NormalFormat::FLOAT
+                                      ? sizeof(glm::vec3)
+                                      : sizeof(uint32_t));
+}
+
+size_t VertexFormat::stride() const {
+  return this->texture_coordinate_offset() +
+         (this->texture_coordinate == UvFormat::FLOAT ? sizeof(glm::vec2)
+                                                      : 2 * sizeof(uint16_t));
+}
+
+uint32_t VertexFormat::bits() const {
+  return static_cast<uint32_t>(this->position) |
+         static_cast<uint32_t>(this->normal) << 4 |
+         static_cast<uint32_t>(this->texture_coordinate) << 8;
+}
+
+bool VertexFormat::from_bits(uint32_t bits, VertexFormat &format) {
+  const uint32_t position = bits & 0xF, normal = (bits >> 4) & 0xF,
+                 texture_coordinate = (bits >> 8) & 0xF;
+  if (bits >> 12 ||
+      position > static_cast<uint32_t>(PositionFormat::UNORM16) ||
+      normal > static_cast<uint32_t>(NormalFormat::OCTAHEDRAL) ||
+      texture_coordinate > static_cast<uint32_t>(UvFormat::HALF))
+    return false;
+
+  format.position = static_cast<PositionFormat>(position);
+  format.normal = static_cast<NormalFormat>(normal);
+  format.texture_coordinate = static_cast<UvFormat>(texture_coordinate);
+  return true;
+}
+
+void VertexFormat::setup_attributes() const {
+  const GLsizei vertex_stride = static_cast<GLsizei>(this->stride());
+
+  // Map position of vertex
+  glEnableVertexAttribArray(0);
+  if (this->position == PositionFormat::UNORM16)
+    glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, vertex_stride,
+                          static_cast<void *>(0));
+  else
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, vertex_stride,
+                          static_cast<void *>(0));
+
+  // Map normal of vertex
+  void *normal_offset = reinterpret_cast<void *>(this->normal_offset());
+  glEnableVertexAttribArray(1);
+  if (this->normal == NormalFormat::FLOAT)
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, vertex_stride,
+                          normal_offset);
+  else
+    glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, vertex_stride,
+                          normal_offset);
+
+  // map Texture coordinate of vertex
+  void *uv_offset =
+      reinterpret_cast<void *>(this->texture_coordinate_offset());
+  glEnableVertexAttribArray(2);
+  if (this->texture_coordinate == UvFormat::HALF)
+    glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, vertex_stride,
+                          uv_offset);
+  else
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, vertex_stride, uv_offset);
+}
+
+static uint32_t pack_snorm10(float value) {
+  const float clamped = std::clamp(value, -1.0f, 1.0f);
+  const int32_t quantized = static_cast<int32_t>(std::round(clamped * 511.0f));
+  return static_cast<uint32_t>(quantized) & 0x3FF;
+}
+
+// x, y, z on 10 bits each, the 2 bits of w flag the encoding
+static uint32_t pack_normal(float x, float y, float z, bool octahedral) {
+  const uint32_t w = octahedral ? 3u : 0u; // -1 : 0
+  return pack_snorm10(x) | pack_snorm10(y) << 10 | pack_snorm10(z) << 20 |
+         w << 30;
+}
+
+static glm::vec2 octahedral_encode(const glm::vec3 &normal) {
+  const float sum =
+      std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+  if (sum == 0.0f)
+    return glm::vec2(0.0f);
+
+  glm::vec2 encoded(normal.x / sum, normal.y / sum);
+  if (normal.z < 0.0f) {
+    const glm::vec2 folded(1.0f - std::fabs(encoded.y),
+                           1.0f - std::fabs(encoded.x));
+    encoded = glm::vec2(encoded.x >= 0.0f ? folded.x : -folded.x,
+                        encoded.y >= 0.0f ? folded.y : -folded.y);
+  }
+  return encoded;
+}
+
+void Mesh::pack_vertices(const VertexFormat &format, const glm::vec3 &offset,
+                         const glm::vec3 &scale) {
+  if (!format.is_packed())
+    return;
+  // an empty mesh still shares the arena with its packed siblings
+  this->vertex_format = format;
+  if (this->vertices.empty())
+    return;
+
+  const size_t stride = format.stride();
+  this->packed_vertices.resize(this->vertices.size() * stride);
+
+  unsigned char *out = this->packed_vertices.data();
+  for (const Vertex &vertex : this->vertices) {
+    if (format.position == PositionFormat::UNORM16) {
+      uint16_t position[4] = {0, 0, 0, 0};
+      for (int c = 0; c < 3; c++) {
+        const float normalized = std::clamp(
+            (vertex.position[c] - offset[c]) / scale[c], 0.0f, 1.0f);
+        position[c] = static_cast<uint16_t>(normalized * 65535.0f + 0.5f);
+      }
+      std::memcpy(out, position, sizeof(position));
+    } else {
+      std::memcpy(out, &vertex.position, sizeof(glm::vec3));
+    }
+
+    unsigned char *normal = out + format.normal_offset();
+    if (format.normal == NormalFormat::FLOAT) {
+      std::memcpy(normal, &vertex.normal, sizeof(glm::vec3));
+    } else {
+      uint32_t packed;
+      if (format.normal == NormalFormat::OCTAHEDRAL) {
+        const glm::vec2 encoded = octahedral_encode(vertex.normal);
+        packed = pack_normal(encoded.x, encoded.y, 0.0f, true);
+      } else {
+        packed = pack_normal(vertex.normal.x, vertex.normal.y,
+                             vertex.normal.z, false);
+      }
+      std::memcpy(normal, &packed, sizeof(packed));
+    }
+
+    unsigned char *texture_coordinate =
+        out + format.texture_coordinate_offset();
+    if (format.texture_coordinate == UvFormat::HALF) {
+      const uint16_t uv[2] = {
+          glm::packHalf1x16(vertex.texture_coordinate.x),
+          glm::packHalf1x16(vertex.texture_coordinate.y)};
+      std::memcpy(texture_coordinate, uv, sizeof(uv));
+    } else {
+      std::memcpy(texture_coordinate, &vertex.texture_coordinate,
+                  sizeof(glm::vec2));
+    }
+    out += stride;
+  }
+  this->vertices = {};
+}
+
+void Mesh::bind_textures(const Shader &shader) const {
   for (unsigned int i = 0; i < textures.size(); ++i) {
     glActiveTexture(GL_TEXTURE0 + i);
     textures[i]->bind();
@@ -13,54 +187,175 @@ void Mesh::draw(const Shader &shader) const {
       shader.set_uniform("material.specular", static_cast<int>(i));
     }
   }
-  glBindVertexArray(this->VAO);
-  glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(this->indices.size()),
-                 GL_UNSIGNED_INT, 0);
+}
 
-  glBindVertexArray(0);
+void Mesh::lod_range(size_t lod, size_t &offset, GLsizei &count) const {
+  offset = this->range.index_offset;
+  count = this->range.index_count;
+  if (lod < this->lods.size()) {
+    offset += this->lods[lod].first_index * index_size(this->range.index_type);
+    count = static_cast<GLsizei>(this->lods[lod].index_count);
+  }
+}
+
+size_t Mesh::draw(const Shader &shader, size_t lod,
+                  ClusterCuller *culler) const {
+  this->bind_textures(shader);
+  const size_t triangles = this->draw_without_texture(lod, culler);
   glActiveTexture(GL_TEXTURE0);
+  return triangles;
 }
 
-void Mesh::draw_without_texture() const {
-  glBindVertexArray(this->VAO);
-  glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(this->indices.size()),
-                 GL_UNSIGNED_INT, 0);
+size_t Mesh::draw_without_texture(size_t lod, ClusterCuller *culler) const {
+  if (culler && lod == 0 && this->clusters.size() > 0) {
+    culler->cull(this->clusters, this->range.index_offset,
+                 this->range.index_type, this->range.base_vertex);
+    size_t triangles = 0;
+    for (GLsizei count : culler->counts)
+      triangles += static_cast<size_t>(count) / 3;
+    if (!culler->counts.empty())
+      glMultiDrawElementsBaseVertex(
+          GL_TRIANGLES, culler->counts.data(), this->range.index_type,
+          culler->offsets.data(), static_cast<GLsizei>(culler->counts.size()),
+          culler->base_vertices.data());
+    return triangles;
+  }
 
-  glBindVertexArray(0);
+  size_t offset;
+  GLsizei count;
+  this->lod_range(lod, offset, count);
+  glDrawElementsBaseVertex(GL_TRIANGLES, count, this->range.index_type,
+                           reinterpret_cast<void *>(offset),
+                           this->range.base_vertex);
+  return static_cast<size_t>(count) / 3;
 }
 
-void Mesh::setup() {
-  glGenVertexArrays(1, &this->VAO);
-  glGenBuffers(1, &this->VBO);
-  glGenBuffers(1, &this->EBO);
+size_t Mesh::draw_instanced(const Shader &shader, size_t lod,
+                            size_t instance_count) const {
+  this->bind_textures(shader);
+  const size_t triangles =
+      this->draw_instanced_without_texture(lod, instance_count);
+  glActiveTexture(GL_TEXTURE0);
+  return triangles;
+}
 
-  glBindVertexArray(this->VAO);
+size_t Mesh::draw_instanced_without_texture(size_t lod,
+                                            size_t instance_count) const {
+  size_t offset;
+  GLsizei count;
+  this->lod_range(lod, offset, count);
+  glDrawElementsInstancedBaseVertex(
+      GL_TRIANGLES, count, this->range.index_type,
+      reinterpret_cast<void *>(offset), static_cast<GLsizei>(instance_count),
+      this->range.base_vertex);
+  return static_cast<size_t>(count) / 3 * instance_count;
+}
 
-  glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
-  glBufferData(
-      GL_ARRAY_BUFFER,
-      static_cast<unsigned int>(this->vertices.size() * sizeof(Vertex)),
-      &this->vertices[0], GL_STATIC_DRAW);
+void Mesh::compute_bounds() {
+  if (this->vertices.empty())
+    return;
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
-  glBufferData(
-      GL_ELEMENT_ARRAY_BUFFER,
-      static_cast<unsigned int>(this->indices.size() * sizeof(unsigned int)),
-      &this->indices[0], GL_STATIC_DRAW);
+  glm::vec3 min = this->vertices.front().position;
+  glm::vec3 max = min;
+  for (const Vertex &vertex : this->vertices) {
+    min = glm::min(min, vertex.position);
+    max = glm::max(max, vertex.position);
+  }
 
-  // Map position of vertex;
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                        static_cast<void *>(0));
-  // Map normal of vertex
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                        reinterpret_cast<void *>(offsetof(Vertex, normal)));
-  // map Texture coordinate of vertex
-  glEnableVertexAttribArray(2);
-  glVertexAttribPointer(
-      2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-      reinterpret_cast<void *>(offsetof(Vertex, texture_coordinate)));
+  this->box = BoundingBox{min, max};
+  this->bounds.center = (min + max) * 0.5f;
+  this->bounds.radius = 0.0f;
+  for (const Vertex &vertex : this->vertices)
+    this->bounds.radius =
+        std::max(this->bounds.radius,
+                 glm::length(vertex.position - this->bounds.center));
+}
+
+void Mesh::compute_closed() {
+  this->closed = false;
+  if (this->indices.empty())
+    return;
+
+  // split vertices (UV or normal seams) share a position, not an index
+  struct PositionHash {
+    size_t operator()(const glm::vec3 &p) const {
+      // -0 and 0 are equal, they must hash the same
+      const glm::vec3 q = p + glm::vec3(0.0f);
+      uint32_t bits[3];
+      std::memcpy(bits, &q, sizeof(bits));
+      return (size_t{bits[0]} * 73856093u) ^ (size_t{bits[1]} * 19349663u) ^
+             (size_t{bits[2]} * 83492791u);
+    }
+  };
+  std::unordered_map<glm::vec3, uint32_t, PositionHash> welded;
+  welded.reserve(this->vertices.size());
+  std::vector<uint32_t> remap(this->vertices.size());
+  for (size_t v = 0; v < this->vertices.size(); v++)
+    remap[v] = welded
+                   .emplace(this->vertices[v].position,
+                            static_cast<uint32_t>(welded.size()))
+                   .first->second;
+
+  // directed edge a -> b, each must appear once and its reverse once
+  std::unordered_map<uint64_t, uint32_t> edges;
+  edges.reserve(this->indices.size());
+  for (size_t i = 0; i + 2 < this->indices.size(); i += 3) {
+    const uint32_t corners[3] = {remap[this->indices[i]],
+                                 remap[this->indices[i + 1]],
+                                 remap[this->indices[i + 2]]};
+    if (corners[0] == corners[1] || corners[1] == corners[2] ||
+        corners[2] == corners[0])
+      continue;
+    for (size_t e = 0; e < 3; e++)
+      if (++edges[uint64_t{corners[e]} << 32 | corners[(e + 1) % 3]] > 1)
+        return;
+  }
+  for (const auto &[edge, uses] : edges)
+    if (edges.count(edge << 32 | edge >> 32) == 0)
+      return;
+  this->closed = !edges.empty();
+}
+
+MeshView Mesh::source() const {
+  if (this->external.vertices)
+    return this->external;
+
+  MeshView view{this->vertices.data(), this->vertices.size(), VertexFormat{},
+                this->indices.data(), this->indices.size(), GL_UNSIGNED_INT};
+  if (!this->packed_vertices.empty()) {
+    view.vertices = this->packed_vertices.data();
+    view.vertex_format = this->vertex_format;
+    view.vertex_count =
+        this->packed_vertices.size() / this->vertex_format.stride();
+  }
+  if (!this->short_indices.empty()) {
+    view.indices = this->short_indices.data();
+    view.index_count = this->short_indices.size();
+    view.index_type = GL_UNSIGNED_SHORT;
+  }
+  return view;
+}
+
+void Mesh::compact_indices() {
+  if (this->indices.empty() || this->vertices.size() > UINT16_MAX + 1u)
+    return;
+
+  this->short_indices.resize(this->indices.size());
+  for (size_t i = 0; i < this->indices.size(); i++)
+    this->short_indices[i] = static_cast<uint16_t>(this->indices[i]);
+  this->indices = {};
+}
+
+size_t Mesh::upload_size() const {
+  const MeshView view = this->source();
+  return view.vertex_count * view.vertex_format.stride() +
+         view.index_count * index_size(view.index_type);
+}
+
+void Mesh::setup(GeometryArena &arena) {
+  this->range = arena.upload(this->source());
+  this->uploaded = true;
 
-  glBindVertexArray(0);
+  // the mapping behind an external view may go away once uploaded
+  this->external = MeshView{};
 }
@@ -4,8 +4,11 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
+#include "mesh_clusters.hpp"
 #include "shader.hpp"
 #include "texture2D.hpp"
 
@@ -15,25 +18,188 @@ struct Vertex {
   glm::vec2 texture_coordinate;
 };
 
+enum class PositionFormat : uint32_t { FLOAT, UNORM16 };
+enum class NormalFormat : uint32_t { FLOAT, SNORM10, OCTAHEDRAL };
+enum class UvFormat : uint32_t { FLOAT, HALF };
+
+// GPU side layout of the vertices, everything FLOAT is Vertex as is
+struct VertexFormat {
+  // normalized to the model bounds, the decode is folded into the model
+  // matrix (see Model::draw)
+  PositionFormat position = PositionFormat::FLOAT;
+  // both packed as GL_INT_2_10_10_10_REV, octahedral ones get w < 0 so
+  // model_vertex.glsl can tell them apart without a uniform
+  NormalFormat normal = NormalFormat::FLOAT;
+  UvFormat texture_coordinate = UvFormat::FLOAT;
+
+  bool is_packed() const;
+  size_t stride() const;
+  size_t normal_offset() const;
+  size_t texture_coordinate_offset() const;
+
+  // cache key / cache file representation
+  uint32_t bits() const;
+  static bool from_bits(uint32_t bits, VertexFormat &format);
+
+  // glVertexAttribPointer for locations 0, 1 and 2 of the bound VAO / VBO
+  void setup_attributes() const;
+};
+
+// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+inline size_t index_size(GLenum index_type) {
+  return index_type == GL_UNSIGNED_SHORT ? sizeof(uint16_t)
+                                         : sizeof(unsigned int);
+}
+
+// Non owning geometry, e.g. straight out of a memory mapped cache
+struct MeshView {
+  const void *vertices;
+  size_t vertex_count;
+  VertexFormat vertex_format;
+  // uint16_t or unsigned int, see index_type
+  const void *indices;
+  size_t index_count;
+  GLenum index_type;
+};
+
+// Index range of one level of detail inside the mesh indices, level 0 is the
+// full mesh
+struct MeshLod {
+  uint32_t first_index;
+  uint32_t index_count;
+  // bound on the distance between the level and the full mesh surfaces,
+  // both ways, model units
+  float error;
+};
+
+struct BoundingSphere {
+  glm::vec3 center;
+  float radius;
+};
+
+struct BoundingBox {
+  glm::vec3 min;
+  glm::vec3 max;
+
+  // box around the transformed one, from its center and half extent (Arvo)
+  BoundingBox transformed(const glm::mat4 &m) const {
+    const glm::vec3 center =
+        glm::vec3(m * glm::vec4((this->min + this->max) * 0.5f, 1.0f));
+    const glm::vec3 extent = (this->max - this->min) * 0.5f;
+    const glm::vec3 half = glm::abs(glm::vec3(m[0])) * extent.x +
+                           glm::abs(glm::vec3(m[1])) * extent.y +
+                           glm::abs(glm::vec3(m[2])) * extent.z;
+    return BoundingBox{center - half, center + half};
+  }
+  void merge(const BoundingBox &other) {
+    this->min = glm::min(this->min, other.min);
+    this->max = glm::max(this->max, other.max);
+  }
+  bool contains(const BoundingBox &inner) const {
+    return this->min.x <= inner.min.x && this->min.y <= inner.min.y &&
+           this->min.z <= inner.min.z && inner.max.x <= this->max.x &&
+           inner.max.y <= this->max.y && inner.max.z <= this->max.z;
+  }
+};
+
+// One placement of a mesh, transform accumulated down the assimp nodes
+struct MeshInstance {
+  uint32_t mesh;
+  glm::mat4 transform;
+};
+
+// Where a mesh landed inside a GeometryArena
+struct GeometryRange {
+  GLint base_vertex = 0;
+  // bytes into the index buffer
+  size_t index_offset = 0;
+  GLsizei index_count = 0;
+  GLenum index_type = GL_UNSIGNED_INT;
+};
+
+class GeometryArena;
+
 class Mesh {
 public:
   std::vector<Vertex> vertices;
+  // Replaces vertices once pack_vertices() ran with a packed format
+  std::vector<unsigned char> packed_vertices;
+  VertexFormat vertex_format;
+  // Only one of them is filled: indices while importing, short_indices once
+  // compact_indices() found the vertices addressable on 16 bits
   std::vector<unsigned int> indices;
+  std::vector<uint16_t> short_indices;
   std::vector<Texture2D *> textures;
+  // coarser and coarser, all sharing the vertices of the full mesh
+  std::vector<MeshLod> lods;
+  // model space, before any position quantization
+  BoundingSphere bounds{glm::vec3(0.0f), 0.0f};
+  BoundingBox box{glm::vec3(0.0f), glm::vec3(0.0f)};
+  // clusters of the full level, empty when it is always drawn whole
+  ClusterTable clusters;
+  // no back face can be seen from outside, see compute_closed()
+  bool closed = false;
 
+  // Nothing touches OpenGL until setup(), meshes can be built on any thread
   Mesh(std::vector<Vertex> _vertices, std::vector<unsigned int> _indices,
        std::vector<Texture2D *> _textures)
       : vertices(std::move(_vertices)), indices(std::move(_indices)),
-        textures(std::move(_textures)) {
-    this->setup();
-  }
+        textures(std::move(_textures)) {}
+  // No CPU side copy is kept, the view must stay valid until setup()
+  Mesh(const MeshView &view, std::vector<Texture2D *> _textures)
+      : textures(std::move(_textures)), external(view) {}
   // to do (maybe ok idk) no its fine
   ~Mesh() = default;
+  // the user declared destructor would otherwise turn every move into a copy
+  Mesh(const Mesh &) = default;
+  Mesh &operator=(const Mesh &) = default;
+  Mesh(Mesh &&) noexcept = default;
+  Mesh &operator=(Mesh &&) noexcept = default;
 
-  void draw(const Shader &shader) const;
-  void draw_without_texture() const;
+  // From vertices, must run before pack_vertices()
+  void compute_bounds();
+  // Closed when, with the vertices welded by position, every edge is shared
+  // by exactly two triangles running through it in opposite directions.
+  // Must run before compact_indices() and pack_vertices().
+  void compute_closed();
+  // Call once the indices are final, halves the index buffer of every mesh
+  // under 65536 vertices
+  void compact_indices();
+  // Converts vertices to format, positions are stored as
+  // (position - offset) / scale when quantized
+  void pack_vertices(const VertexFormat &format, const glm::vec3 &offset,
+                     const glm::vec3 &scale);
+  GLenum index_type() const {
+    return this->short_indices.empty() ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+  }
+  // Whatever setup() will upload
+  MeshView source() const;
+
+  // Copies the geometry into the arena, sized for it by GeometryArena::init
+  void setup(GeometryArena &arena);
+  bool is_uploaded() const { return this->uploaded; }
+  // Bytes sent to the GPU by setup()
+  size_t upload_size() const;
+
+  // The arena the mesh was set up with must be bound and its instances too,
+  // see GeometryArena::bind_instances. With a culler the full level only
+  // submits its visible clusters. Returns the triangles drawn.
+  size_t draw(const Shader &shader, size_t lod = 0,
+              ClusterCuller *culler = nullptr) const;
+  size_t draw_without_texture(size_t lod = 0,
+                              ClusterCuller *culler = nullptr) const;
+  // instance_count transforms from the bound instances, textures bound once
+  size_t draw_instanced(const Shader &shader, size_t lod,
+                        size_t instance_count) const;
+  size_t draw_instanced_without_texture(size_t lod,
+                                        size_t instance_count) const;
 
 private:
-  unsigned int VAO, VBO, EBO;
-  void setup();
+  GeometryRange range;
+
+  void bind_textures(const Shader &shader) const;
+  // byte offset and index count of the level inside the arena
+  void lod_range(size_t lod, size_t &offset, GLsizei &count) const;
+  bool uploaded = false;
+  MeshView external{};
 };
@@ -0,0 +1,369 @@
+#include "mesh_cache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+bool MeshCache::open(const std::string &path, uint64_t source_hash) {
+  this->close();
+  if (!this->_file.open(path))
+    return false;
+
+  if (this->_file.size() < sizeof(CacheHeader)) {
+    this->close();
+    return false;
+  }
+
+  this->_header = this->at<CacheHeader>(0);
+  if (this->_header->magic != MESH_CACHE_MAGIC ||
+      this->_header->version != MESH_CACHE_VERSION ||
+      this->_header->source_hash != source_hash) {
+    this->close();
+    return false;
+  }
+
+  this->_entries = this->at<CacheMeshEntry>(sizeof(CacheHeader));
+  this->_texture_refs = this->at<CacheTextureRef>(
+      sizeof(CacheHeader) +
+      this->_header->mesh_count * sizeof(CacheMeshEntry));
+  this->_lods = this->at<CacheLod>(
+      sizeof(CacheHeader) +
+      this->_header->mesh_count * sizeof(CacheMeshEntry) +
+      this->_header->texture_ref_count * sizeof(CacheTextureRef));
+  this->_clusters = this->at<CacheCluster>(
+      sizeof(CacheHeader) +
+      this->_header->mesh_count * sizeof(CacheMeshEntry) +
+      this->_header->texture_ref_count * sizeof(CacheTextureRef) +
+      this->_header->lod_count * sizeof(CacheLod));
+  this->_instances = this->at<CacheInstance>(
+      sizeof(CacheHeader) +
+      this->_header->mesh_count * sizeof(CacheMeshEntry) +
+      this->_header->texture_ref_count * sizeof(CacheTextureRef) +
+      this->_header->lod_count * sizeof(CacheLod) +
+      this->_header->cluster_count * sizeof(CacheCluster));
+
+  if (!this->validate()) {
+    std::cerr << "Erreur: cache corrompu, il sera regenere: " << path << "\n";
+    this->close();
+    return false;
+  }
+  return true;
+}
+
+void MeshCache::close() {
+  this->_file.close();
+  this->_header = nullptr;
+  this->_entries = nullptr;
+  this->_texture_refs = nullptr;
+  this->_lods = nullptr;
+  this->_clusters = nullptr;
+  this->_instances = nullptr;
+}
+
+bool MeshCache::validate() const {
+  const uint64_t size = this->_file.size();
+  auto in_file = [size](uint64_t offset, uint64_t length, uint64_t align) {
+    return offset % align == 0 && offset <= size && length <= size - offset;
+  };
+
+  const uint64_t tables_size =
+      sizeof(CacheHeader) +
+      uint64_t{this->_header->mesh_count} * sizeof(CacheMeshEntry) +
+      uint64_t{this->_header->texture_ref_count} * sizeof(CacheTextureRef) +
+      uint64_t{this->_header->lod_count} * sizeof(CacheLod) +
+      uint64_t{this->_header->cluster_count} * sizeof(CacheCluster) +
+      uint64_t{this->_header->instance_count} * sizeof(CacheInstance);
+  if (tables_size > size)
+    return false;
+
+  for (uint32_t i = 0; i < this->_header->instance_count; i++)
+    if (this->_instances[i].mesh >= this->_header->mesh_count)
+      return false;
+
+  for (uint32_t i = 0; i < this->_header->mesh_count; i++) {
+    const CacheMeshEntry &entry = this->_entries[i];
+    VertexFormat format;
+    if ((entry.index_type != GL_UNSIGNED_SHORT &&
+         entry.index_type != GL_UNSIGNED_INT) ||
+        !VertexFormat::from_bits(entry.vertex_format, format))
+      return false;
+
+    const size_t index_bytes = index_size(entry.index_type);
+    if (!in_file(entry.vertex_offset, entry.vertex_count * format.stride(),
+                 4) ||
+        !in_file(entry.index_offset, entry.index_count * index_bytes,
+                 index_bytes) ||
+        entry.first_texture_ref > this->_header->texture_ref_count ||
+        entry.texture_ref_count >
+            this->_header->texture_ref_count - entry.first_texture_ref ||
+        entry.first_lod > this->_header->lod_count ||
+        entry.lod_count > this->_header->lod_count - entry.first_lod ||
+        entry.first_cluster > this->_header->cluster_count ||
+        entry.cluster_count >
+            this->_header->cluster_count - entry.first_cluster)
+      return false;
+
+    for (uint32_t c = 0; c < entry.cluster_count; c++) {
+      const CacheCluster &cluster = this->_clusters[entry.first_cluster + c];
+      if (cluster.first_index > entry.index_count ||
+          cluster.index_count > entry.index_count - cluster.first_index)
+        return false;
+    }
+
+    for (uint32_t l = 0; l < entry.lod_count; l++) {
+      const CacheLod &lod = this->_lods[entry.first_lod + l];
+      if (lod.first_index > entry.index_count ||
+          lod.index_count > entry.index_count - lod.first_index)
+        return false;
+    }
+  }
+
+  for (uint32_t i = 0; i < this->_header->texture_ref_count; i++) {
+    const CacheTextureRef &ref = this->_texture_refs[i];
+    if (!in_file(ref.path_offset, ref.path_length, 1) ||
+        ref.type > static_cast<uint32_t>(TextureType::EMISSION))
+      return false;
+  }
+  return true;
+}
+
+size_t MeshCache::mesh_count() const {
+  return this->_header ? this->_header->mesh_count : 0;
+}
+
+glm::mat4 MeshCache::position_decode() const {
+  glm::mat4 decode;
+  std::memcpy(&decode[0][0], this->_header->position_decode,
+              sizeof(this->_header->position_decode));
+  return decode;
+}
+
+std::vector<MeshLod> MeshCache::lods(size_t index) const {
+  const CacheMeshEntry &entry = this->_entries[index];
+  std::vector<MeshLod> lods;
+  lods.reserve(entry.lod_count);
+  for (uint32_t i = 0; i < entry.lod_count; i++) {
+    const CacheLod &lod = this->_lods[entry.first_lod + i];
+    lods.push_back(MeshLod{lod.first_index, lod.index_count, lod.error});
+  }
+  return lods;
+}
+
+BoundingSphere MeshCache::bounds(size_t index) const {
+  const float *bounds = this->_entries[index].bounds;
+  return BoundingSphere{glm::vec3(bounds[0], bounds[1], bounds[2]),
+                        bounds[3]};
+}
+
+BoundingBox MeshCache::box(size_t index) const {
+  const float *box = this->_entries[index].box;
+  return BoundingBox{glm::vec3(box[0], box[1], box[2]),
+                     glm::vec3(box[3], box[4], box[5])};
+}
+
+bool MeshCache::closed(size_t index) const {
+  return this->_entries[index].closed != 0;
+}
+
+ClusterTable MeshCache::clusters(size_t index) const {
+  const CacheMeshEntry &entry = this->_entries[index];
+  ClusterTable clusters;
+  clusters.reserve(entry.cluster_count);
+  for (uint32_t i = 0; i < entry.cluster_count; i++) {
+    const CacheCluster &cluster = this->_clusters[entry.first_cluster + i];
+    clusters.push_back(ClusterBounds{
+        cluster.first_index, cluster.index_count,
+        glm::vec3(cluster.center[0], cluster.center[1], cluster.center[2]),
+        cluster.radius, glm::vec3(cluster.min[0], cluster.min[1], cluster.min[2]),
+        glm::vec3(cluster.max[0], cluster.max[1], cluster.max[2]),
+        glm::vec3(cluster.cone_axis[0], cluster.cone_axis[1],
+                  cluster.cone_axis[2]),
+        cluster.cone_cutoff});
+  }
+  return clusters;
+}
+
+std::vector<MeshInstance> MeshCache::instances() const {
+  std::vector<MeshInstance> instances(this->_header->instance_count);
+  for (size_t i = 0; i < instances.size(); i++) {
+    instances[i].mesh = this->_instances[i].mesh;
+    std::memcpy(&instances[i].transform[0][0], this->_instances[i].transform,
+                sizeof(this->_instances[i].transform));
+  }
+  return instances;
+}
+
+MeshView MeshCache::mesh(size_t index) const {
+  const CacheMeshEntry &entry = this->_entries[index];
+  VertexFormat format;
+  VertexFormat::from_bits(entry.vertex_format, format);
+  return MeshView{this->at<void>(entry.vertex_offset), entry.vertex_count,
+                  format, this->at<void>(entry.index_offset),
+                  entry.index_count, entry.index_type};
+}
+
+std::vector<TextureRef> MeshCache::textures(size_t index) const {
+  const CacheMeshEntry &entry = this->_entries[index];
+  std::vector<TextureRef> textures;
+  textures.reserve(entry.texture_ref_count);
+
+  for (uint32_t i = 0; i < entry.texture_ref_count; i++) {
+    const CacheTextureRef &ref =
+        this->_texture_refs[entry.first_texture_ref + i];
+    textures.push_back(TextureRef{
+        std::string(this->at<char>(ref.path_offset), ref.path_length),
+        static_cast<TextureType>(ref.type)});
+  }
+  return textures;
+}
+
+bool MeshCache::write(const std::string &path, uint64_t source_hash,
+                      const std::vector<Mesh> &meshes,
+                      const std::vector<std::vector<TextureRef>> &textures,
+                      const std::vector<MeshInstance> &instances,
+                      const glm::mat4 &position_decode) {
+  std::vector<CacheMeshEntry> entries;
+  std::vector<CacheTextureRef> refs;
+  std::vector<CacheLod> lods;
+  std::vector<CacheCluster> clusters;
+  std::vector<std::string> paths;
+  entries.reserve(meshes.size());
+
+  for (size_t i = 0; i < meshes.size(); i++) {
+    const MeshView mesh = meshes[i].source();
+    CacheMeshEntry entry{};
+    entry.vertex_count = static_cast<uint32_t>(mesh.vertex_count);
+    entry.index_count = static_cast<uint32_t>(mesh.index_count);
+    entry.index_type = mesh.index_type;
+    entry.vertex_format = mesh.vertex_format.bits();
+    entry.first_lod = static_cast<uint32_t>(lods.size());
+    entry.lod_count = static_cast<uint32_t>(meshes[i].lods.size());
+    const BoundingSphere &bounds = meshes[i].bounds;
+    entry.bounds[0] = bounds.center.x;
+    entry.bounds[1] = bounds.center.y;
+    entry.bounds[2] = bounds.center.z;
+    entry.bounds[3] = bounds.radius;
+    const BoundingBox &box = meshes[i].box;
+    entry.box[0] = box.min.x;
+    entry.box[1] = box.min.y;
+    entry.box[2] = box.min.z;
+    entry.box[3] = box.max.x;
+    entry.box[4] = box.max.y;
+    entry.box[5] = box.max.z;
+    entry.closed = meshes[i].closed;
+    for (const MeshLod &lod : meshes[i].lods)
+      lods.push_back(CacheLod{lod.first_index, lod.index_count, lod.error});
+
+    entry.first_cluster = static_cast<uint32_t>(clusters.size());
+    entry.cluster_count = static_cast<uint32_t>(meshes[i].clusters.size());
+    for (size_t c = 0; c < meshes[i].clusters.size(); c++) {
+      const ClusterBounds bounds_c = meshes[i].clusters.at(c);
+      clusters.push_back(CacheCluster{
+          bounds_c.first_index,
+          bounds_c.index_count,
+          {bounds_c.center.x, bounds_c.center.y, bounds_c.center.z},
+          bounds_c.radius,
+          {bounds_c.min.x, bounds_c.min.y, bounds_c.min.z},
+          {bounds_c.max.x, bounds_c.max.y, bounds_c.max.z},
+          {bounds_c.cone_axis.x, bounds_c.cone_axis.y, bounds_c.cone_axis.z},
+          bounds_c.cone_cutoff});
+    }
+    entry.first_texture_ref = static_cast<uint32_t>(refs.size());
+    entry.texture_ref_count = static_cast<uint32_t>(textures[i].size());
+
+    // paths stay relative to the model so the cache moves with its assets
+    for (const TextureRef &texture : textures[i]) {
+      CacheTextureRef ref{};
+      ref.path_length = static_cast<uint32_t>(texture.path.size());
+      ref.type = static_cast<uint32_t>(texture.type);
+      refs.push_back(ref);
+      paths.push_back(texture.path);
+    }
+    entries.push_back(entry);
+  }
+
+  std::vector<CacheInstance> instance_table(instances.size());
+  for (size_t i = 0; i < instances.size(); i++) {
+    instance_table[i].mesh = instances[i].mesh;
+    std::memcpy(instance_table[i].transform,
+                glm::value_ptr(instances[i].transform),
+                sizeof(instance_table[i].transform));
+  }
+
+  // Every table and vertex stride is a multiple of 4 and 16 bits index
+  // blobs are padded, so offsets stay aligned for Vertex and the indices
+  auto padded = [](uint64_t size) { return (size + 3) & ~uint64_t{3}; };
+  uint64_t offset = sizeof(CacheHeader) +
+                    entries.size() * sizeof(CacheMeshEntry) +
+                    refs.size() * sizeof(CacheTextureRef) +
+                    lods.size() * sizeof(CacheLod) +
+                    clusters.size() * sizeof(CacheCluster) +
+                    instance_table.size() * sizeof(CacheInstance);
+  for (CacheMeshEntry &entry : entries) {
+    entry.vertex_offset = offset;
+    VertexFormat format;
+    VertexFormat::from_bits(entry.vertex_format, format);
+    offset += entry.vertex_count * format.stride();
+    entry.index_offset = offset;
+    offset += padded(entry.index_count * index_size(entry.index_type));
+  }
+  for (size_t i = 0; i < refs.size(); i++) {
+    refs[i].path_offset = offset;
+    offset += refs[i].path_length;
+  }
+
+  CacheHeader header{};
+  header.magic = MESH_CACHE_MAGIC;
+  header.version = MESH_CACHE_VERSION;
+  header.source_hash = source_hash;
+  header.mesh_count = static_cast<uint32_t>(entries.size());
+  header.texture_ref_count = static_cast<uint32_t>(refs.size());
+  header.lod_count = static_cast<uint32_t>(lods.size());
+  header.cluster_count = static_cast<uint32_t>(clusters.size());
+  header.instance_count = static_cast<uint32_t>(instance_table.size());
+  std::memcpy(header.position_decode, glm::value_ptr(position_decode),
+              sizeof(header.position_decode));
+
+  // Written to a temporary file first so a crash never leaves a truncated
+  // cache with a valid header behind
+  const std::string tmp_path = path + ".tmp";
+  std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    std::cerr << "Erreur: impossible d'ecrire le cache " << tmp_path << "\n";
+    return false;
+  }
+
+  auto write_bytes = [&file](const void *data, size_t size) {
+    file.write(static_cast<const char *>(data),
+               static_cast<std::streamsize>(size));
+  };
+
+  write_bytes(&header, sizeof(header));
+  write_bytes(entries.data(), entries.size() * sizeof(CacheMeshEntry));
+  write_bytes(refs.data(), refs.size() * sizeof(CacheTextureRef));
+  write_bytes(lods.data(), lods.size() * sizeof(CacheLod));
+  write_bytes(clusters.data(), clusters.size() * sizeof(CacheCluster));
+  write_bytes(instance_table.data(),
+              instance_table.size() * sizeof(CacheInstance));
+  const uint32_t zero = 0;
+  for (const Mesh &mesh : meshes) {
+    const MeshView view = mesh.source();
+    const uint64_t index_bytes =
+        view.index_count * index_size(view.index_type);
+    write_bytes(view.vertices,
+                view.vertex_count * view.vertex_format.stride());
+    write_bytes(view.indices, index_bytes);
+    write_bytes(&zero, padded(index_bytes) - index_bytes);
+  }
+  for (const std::string &texture_path : paths)
+    write_bytes(texture_path.data(), texture_path.size());
+
+  file.close();
+  if (!file || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    std::cerr << "Erreur: impossible d'ecrire le cache " << path << "\n";
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
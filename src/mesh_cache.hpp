@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "mesh.hpp"
+#include "texture2D.hpp"
+
+// Baked model written next to the source file (backpack.obj ->
+// backpack.obj.kmesh). Layout, native endianness:
+//   CacheHeader
+//   CacheMeshEntry[mesh_count]
+//   CacheTextureRef[texture_ref_count]
+//   CacheLod[lod_count]
+//   CacheCluster[cluster_count]
+//   CacheInstance[instance_count]
+//   vertex / index blobs of every mesh
+//   texture paths (not null terminated)
+// Every offset is absolute from the start of the file.
+constexpr const char *MESH_CACHE_EXTENSION = ".kmesh";
+constexpr uint32_t MESH_CACHE_MAGIC = 0x48534D4B; // "KMSH"
+constexpr uint32_t MESH_CACHE_VERSION = 11;
+
+struct CacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t source_hash;
+  uint32_t mesh_count;
+  uint32_t texture_ref_count;
+  // column major, dequantizes UNORM16 positions
+  float position_decode[16];
+  uint32_t lod_count;
+  uint32_t cluster_count;
+  uint32_t instance_count;
+  uint32_t padding;
+};
+
+struct CacheMeshEntry {
+  uint64_t vertex_offset;
+  uint64_t index_offset;
+  uint32_t vertex_count;
+  uint32_t index_count;
+  uint32_t first_texture_ref;
+  uint32_t texture_ref_count;
+  // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+  uint32_t index_type;
+  // VertexFormat::bits()
+  uint32_t vertex_format;
+  uint32_t first_lod;
+  uint32_t lod_count;
+  // BoundingSphere center and radius
+  float bounds[4];
+  uint32_t first_cluster;
+  uint32_t cluster_count;
+  // BoundingBox min and max
+  float box[6];
+  // Mesh::closed
+  uint32_t closed;
+  uint32_t padding;
+};
+
+struct CacheLod {
+  uint32_t first_index;
+  uint32_t index_count;
+  float error;
+};
+
+// ClusterBounds without the glm types
+struct CacheCluster {
+  uint32_t first_index;
+  uint32_t index_count;
+  float center[3];
+  float radius;
+  float min[3];
+  float max[3];
+  float cone_axis[3];
+  float cone_cutoff;
+};
+
+struct CacheInstance {
+  uint32_t mesh;
+  // column major
+  float transform[16];
+};
+
+struct CacheTextureRef {
+  uint64_t path_offset;
+  uint32_t path_length;
+  uint32_t type;
+};
+
+class MeshCache {
+public:
+  // false when the file is missing, corrupted or baked from another source
+  bool open(const std::string &path, uint64_t source_hash);
+  void close();
+
+  size_t mesh_count() const;
+  glm::mat4 position_decode() const;
+  // Points directly inside the mapping, only valid while the cache is open
+  MeshView mesh(size_t index) const;
+  std::vector<TextureRef> textures(size_t index) const;
+  std::vector<MeshLod> lods(size_t index) const;
+  BoundingSphere bounds(size_t index) const;
+  BoundingBox box(size_t index) const;
+  bool closed(size_t index) const;
+  ClusterTable clusters(size_t index) const;
+  std::vector<MeshInstance> instances() const;
+
+  static bool write(const std::string &path, uint64_t source_hash,
+                    const std::vector<Mesh> &meshes,
+                    const std::vector<std::vector<TextureRef>> &textures,
+                    const std::vector<MeshInstance> &instances,
+                    const glm::mat4 &position_decode);
+
+private:
+  MappedFile _file;
+  const CacheHeader *_header = nullptr;
+  const CacheMeshEntry *_entries = nullptr;
+  const CacheTextureRef *_texture_refs = nullptr;
+  const CacheLod *_lods = nullptr;
+  const CacheCluster *_clusters = nullptr;
+  const CacheInstance *_instances = nullptr;
+
+  bool validate() const;
+  template <typename T> const T *at(uint64_t offset) const {
+    return static_cast<const T *>(
+        static_cast<const void *>(this->_file.data() + offset));
+  }
+};
@@ -0,0 +1,331 @@
+#include "mesh_clusters.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "mesh.hpp"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+constexpr size_t NO_TRIANGLE = SIZE_MAX;
+
+void ClusterTable::reserve(size_t count) {
+  for (auto *column : {&this->first_index, &this->index_count})
+    column->reserve(count);
+  for (auto *column :
+       {&this->center_x, &this->center_y, &this->center_z, &this->radius,
+        &this->min_x, &this->min_y, &this->min_z, &this->max_x, &this->max_y,
+        &this->max_z, &this->cone_x, &this->cone_y, &this->cone_z,
+        &this->cone_cutoff})
+    column->reserve(count);
+}
+
+void ClusterTable::push_back(const ClusterBounds &cluster) {
+  this->first_index.push_back(cluster.first_index);
+  this->index_count.push_back(cluster.index_count);
+  this->center_x.push_back(cluster.center.x);
+  this->center_y.push_back(cluster.center.y);
+  this->center_z.push_back(cluster.center.z);
+  this->radius.push_back(cluster.radius);
+  this->min_x.push_back(cluster.min.x);
+  this->min_y.push_back(cluster.min.y);
+  this->min_z.push_back(cluster.min.z);
+  this->max_x.push_back(cluster.max.x);
+  this->max_y.push_back(cluster.max.y);
+  this->max_z.push_back(cluster.max.z);
+  this->cone_x.push_back(cluster.cone_axis.x);
+  this->cone_y.push_back(cluster.cone_axis.y);
+  this->cone_z.push_back(cluster.cone_axis.z);
+  this->cone_cutoff.push_back(cluster.cone_cutoff);
+}
+
+ClusterBounds ClusterTable::at(size_t i) const {
+  return ClusterBounds{
+      this->first_index[i],
+      this->index_count[i],
+      glm::vec3(this->center_x[i], this->center_y[i], this->center_z[i]),
+      this->radius[i],
+      glm::vec3(this->min_x[i], this->min_y[i], this->min_z[i]),
+      glm::vec3(this->max_x[i], this->max_y[i], this->max_z[i]),
+      glm::vec3(this->cone_x[i], this->cone_y[i], this->cone_z[i]),
+      this->cone_cutoff[i]};
+}
+
+static ClusterBounds cluster_bounds(const unsigned int *indices,
+                                    uint32_t first_index, uint32_t index_count,
+                                    const std::vector<Vertex> &vertices) {
+  ClusterBounds cluster{};
+  cluster.first_index = first_index;
+  cluster.index_count = index_count;
+
+  const unsigned int *begin = indices + first_index;
+  const unsigned int *end = begin + index_count;
+  cluster.min = cluster.max = vertices[*begin].position;
+  for (const unsigned int *index = begin; index != end; index++) {
+    cluster.min = glm::min(cluster.min, vertices[*index].position);
+    cluster.max = glm::max(cluster.max, vertices[*index].position);
+  }
+  cluster.center = (cluster.min + cluster.max) * 0.5f;
+  for (const unsigned int *index = begin; index != end; index++)
+    cluster.radius = std::max(
+        cluster.radius,
+        glm::length(vertices[*index].position - cluster.center));
+
+  // Normal cone: average normal, opened enough to contain all of them
+  std::vector<glm::vec3> normals;
+  normals.reserve(index_count / 3);
+  glm::vec3 axis(0.0f);
+  for (const unsigned int *index = begin; index != end; index += 3) {
+    const glm::vec3 &a = vertices[index[0]].position;
+    const glm::vec3 &b = vertices[index[1]].position;
+    const glm::vec3 &c = vertices[index[2]].position;
+    const glm::vec3 normal = glm::cross(b - a, c - a);
+    const float length = glm::length(normal);
+    if (length == 0.0f)
+      continue;
+    normals.push_back(normal / length);
+    axis += normals.back();
+  }
+
+  cluster.cone_cutoff = 1.0f;
+  const float axis_length = glm::length(axis);
+  if (axis_length > 0.0f && !normals.empty()) {
+    axis = axis / axis_length;
+    float min_dot = 1.0f;
+    for (const glm::vec3 &normal : normals)
+      min_dot = std::min(min_dot, glm::dot(axis, normal));
+    cluster.cone_axis = axis;
+    if (min_dot > 0.0f)
+      cluster.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+  }
+  return cluster;
+}
+
+ClusterTable build_clusters(std::vector<unsigned int> &indices,
+                            size_t index_count,
+                            const std::vector<Vertex> &vertices) {
+  ClusterTable table;
+  const size_t triangle_count = index_count / 3;
+  const size_t vertex_count = vertices.size();
+  if (triangle_count == 0)
+    return table;
+
+  std::vector<size_t> offsets(vertex_count + 1, 0);
+  for (size_t i = 0; i < index_count; i++)
+    offsets[indices[i] + 1]++;
+  for (size_t v = 0; v < vertex_count; v++)
+    offsets[v + 1] += offsets[v];
+  std::vector<size_t> adjacency(index_count);
+  std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+  for (size_t i = 0; i < index_count; i++)
+    adjacency[fill[indices[i]]++] = i / 3;
+
+  std::vector<bool> emitted(triangle_count, false);
+  // cluster each vertex was last added to
+  std::vector<size_t> owner(vertex_count, SIZE_MAX);
+  std::vector<unsigned int> cluster_vertices;
+  std::vector<unsigned int> result;
+  result.reserve(index_count);
+  table.reserve(triangle_count / (CLUSTER_MAX_TRIANGLES / 2) + 1);
+
+  size_t seed = 0;
+  for (size_t cluster = 0;; cluster++) {
+    while (seed < triangle_count && emitted[seed])
+      seed++;
+    if (seed == triangle_count)
+      break;
+
+    const uint32_t first_index = static_cast<uint32_t>(result.size());
+    cluster_vertices.clear();
+    glm::vec3 vertex_sum(0.0f);
+    size_t triangles = 0;
+
+    for (size_t next = seed; next != NO_TRIANGLE;) {
+      for (size_t c = 0; c < 3; c++) {
+        const unsigned int vertex = indices[next * 3 + c];
+        result.push_back(vertex);
+        if (owner[vertex] != cluster) {
+          owner[vertex] = cluster;
+          cluster_vertices.push_back(vertex);
+          vertex_sum += vertices[vertex].position;
+        }
+      }
+      emitted[next] = true;
+      if (++triangles == CLUSTER_MAX_TRIANGLES)
+        break;
+
+      // Grow towards the triangle sharing the most vertices with the
+      // cluster, the closest to its center on ties
+      const glm::vec3 center =
+          vertex_sum / static_cast<float>(cluster_vertices.size());
+      next = NO_TRIANGLE;
+      size_t best_shared = 0;
+      float best_distance = std::numeric_limits<float>::max();
+      for (unsigned int vertex : cluster_vertices)
+        for (size_t k = offsets[vertex]; k < offsets[vertex + 1]; k++) {
+          const size_t triangle = adjacency[k];
+          if (emitted[triangle])
+            continue;
+
+          size_t shared = 0;
+          glm::vec3 centroid(0.0f);
+          for (size_t c = 0; c < 3; c++) {
+            const unsigned int corner = indices[triangle * 3 + c];
+            shared += owner[corner] == cluster;
+            centroid += vertices[corner].position;
+          }
+          if (cluster_vertices.size() + 3 - shared > CLUSTER_MAX_VERTICES)
+            continue;
+
+          const float distance = glm::length(centroid / 3.0f - center);
+          if (shared > best_shared ||
+              (shared == best_shared && distance < best_distance)) {
+            next = triangle;
+            best_shared = shared;
+            best_distance = distance;
+          }
+        }
+    }
+
+    table.push_back(cluster_bounds(
+        result.data(), first_index,
+        static_cast<uint32_t>(result.size()) - first_index, vertices));
+  }
+
+  std::copy(result.begin(), result.end(), indices.begin());
+  return table;
+}
+
+void ClusterCuller::begin(const Frustum &frustum, const glm::vec3 &camera,
+                          bool cull_backfaces) {
+  this->_frustum = frustum;
+  this->_camera = camera;
+  this->_cull_backfaces = cull_backfaces;
+}
+
+bool ClusterCuller::backface_culling_enabled() {
+  if (!glIsEnabled(GL_CULL_FACE))
+    return false;
+  GLint mode = 0, front = 0;
+  glGetIntegerv(GL_CULL_FACE_MODE, &mode);
+  glGetIntegerv(GL_FRONT_FACE, &front);
+  return mode == GL_BACK && front == GL_CCW;
+}
+
+void ClusterCuller::cull(const ClusterTable &clusters, size_t index_offset,
+                         GLenum index_type, GLint base_vertex) {
+  const size_t count = clusters.size();
+  this->_visible.resize(count);
+  const glm::vec4 *planes = this->_frustum.planes;
+  const glm::vec3 &camera = this->_camera;
+  const bool cull_backfaces = this->_cull_backfaces;
+
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128 zero = _mm_setzero_ps();
+  for (; i + 4 <= count; i += 4) {
+    const __m128 min_x = _mm_loadu_ps(&clusters.min_x[i]);
+    const __m128 min_y = _mm_loadu_ps(&clusters.min_y[i]);
+    const __m128 min_z = _mm_loadu_ps(&clusters.min_z[i]);
+    const __m128 max_x = _mm_loadu_ps(&clusters.max_x[i]);
+    const __m128 max_y = _mm_loadu_ps(&clusters.max_y[i]);
+    const __m128 max_z = _mm_loadu_ps(&clusters.max_z[i]);
+
+    // AABB against every plane, the furthest corner along the normal
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (size_t p = 0; p < 6; p++) {
+      const __m128 px = _mm_set1_ps(planes[p].x);
+      const __m128 py = _mm_set1_ps(planes[p].y);
+      const __m128 pz = _mm_set1_ps(planes[p].z);
+      __m128 distance = _mm_set1_ps(planes[p].w);
+      distance = _mm_add_ps(distance, _mm_max_ps(_mm_mul_ps(px, min_x),
+                                                 _mm_mul_ps(px, max_x)));
+      distance = _mm_add_ps(distance, _mm_max_ps(_mm_mul_ps(py, min_y),
+                                                 _mm_mul_ps(py, max_y)));
+      distance = _mm_add_ps(distance, _mm_max_ps(_mm_mul_ps(pz, min_z),
+                                                 _mm_mul_ps(pz, max_z)));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, zero));
+    }
+
+    const int frustum_mask = _mm_movemask_ps(inside);
+    if (!cull_backfaces) {
+      for (size_t lane = 0; lane < 4; lane++)
+        this->_visible[i + lane] =
+            static_cast<uint8_t>((frustum_mask >> lane) & 1);
+      continue;
+    }
+
+    // backfacing when dot(center - camera, axis) >= cutoff * |center -
+    // camera| + radius
+    const __m128 to_x = _mm_sub_ps(_mm_loadu_ps(&clusters.center_x[i]),
+                                   _mm_set1_ps(camera.x));
+    const __m128 to_y = _mm_sub_ps(_mm_loadu_ps(&clusters.center_y[i]),
+                                   _mm_set1_ps(camera.y));
+    const __m128 to_z = _mm_sub_ps(_mm_loadu_ps(&clusters.center_z[i]),
+                                   _mm_set1_ps(camera.z));
+    const __m128 along = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(to_x, _mm_loadu_ps(&clusters.cone_x[i])),
+                   _mm_mul_ps(to_y, _mm_loadu_ps(&clusters.cone_y[i]))),
+        _mm_mul_ps(to_z, _mm_loadu_ps(&clusters.cone_z[i])));
+    const __m128 distance = _mm_sqrt_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(to_x, to_x), _mm_mul_ps(to_y, to_y)),
+                   _mm_mul_ps(to_z, to_z)));
+    const __m128 limit =
+        _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&clusters.cone_cutoff[i]), distance),
+                   _mm_loadu_ps(&clusters.radius[i]));
+    inside = _mm_andnot_ps(_mm_cmpge_ps(along, limit), inside);
+
+    const int mask = _mm_movemask_ps(inside);
+    for (size_t lane = 0; lane < 4; lane++)
+      this->_visible[i + lane] = static_cast<uint8_t>((mask >> lane) & 1);
+  }
+#endif
+
+  for (; i < count; i++) {
+    const glm::vec3 min(clusters.min_x[i], clusters.min_y[i],
+                        clusters.min_z[i]);
+    const glm::vec3 max(clusters.max_x[i], clusters.max_y[i],
+                        clusters.max_z[i]);
+    if (!cull_backfaces) {
+      this->_visible[i] = this->_frustum.intersects_aabb(min, max);
+      continue;
+    }
+    const glm::vec3 to_center =
+        glm::vec3(clusters.center_x[i], clusters.center_y[i],
+                  clusters.center_z[i]) -
+        camera;
+    const glm::vec3 axis(clusters.cone_x[i], clusters.cone_y[i],
+                         clusters.cone_z[i]);
+    const bool backfacing =
+        glm::dot(to_center, axis) >=
+        clusters.cone_cutoff[i] * glm::length(to_center) + clusters.radius[i];
+    this->_visible[i] =
+        this->_frustum.intersects_aabb(min, max) && !backfacing;
+  }
+
+  // neighbouring visible clusters are contiguous indices, one range for all
+  this->counts.clear();
+  this->offsets.clear();
+  this->base_vertices.clear();
+  const size_t stride = index_size(index_type);
+  uint32_t range_end = UINT32_MAX;
+  for (size_t c = 0; c < count; c++) {
+    if (!this->_visible[c])
+      continue;
+
+    this->visible++;
+    if (clusters.first_index[c] == range_end) {
+      this->counts.back() += static_cast<GLsizei>(clusters.index_count[c]);
+    } else {
+      this->counts.push_back(static_cast<GLsizei>(clusters.index_count[c]));
+      this->offsets.push_back(reinterpret_cast<const void *>(
+          index_offset + clusters.first_index[c] * stride));
+      this->base_vertices.push_back(base_vertex);
+    }
+    range_end = clusters.first_index[c] + clusters.index_count[c];
+  }
+  this->tested += count;
+}
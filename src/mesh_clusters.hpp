@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "frustum.hpp"
+#include "glad/glad.h"
+
+struct Vertex;
+
+constexpr size_t CLUSTER_MAX_VERTICES = 64;
+constexpr size_t CLUSTER_MAX_TRIANGLES = 124;
+
+// One cluster as built and as stored in the cache
+struct ClusterBounds {
+  // range of the mesh indices
+  uint32_t first_index;
+  uint32_t index_count;
+  glm::vec3 center;
+  float radius;
+  glm::vec3 min;
+  glm::vec3 max;
+  // every triangle faces away from a camera inside the cone, cutoff 1
+  // disables the test
+  glm::vec3 cone_axis;
+  float cone_cutoff;
+};
+
+// Structure of arrays so the culling loop reads 4 clusters per load
+struct ClusterTable {
+  std::vector<uint32_t> first_index, index_count;
+  std::vector<float> center_x, center_y, center_z, radius;
+  std::vector<float> min_x, min_y, min_z, max_x, max_y, max_z;
+  std::vector<float> cone_x, cone_y, cone_z, cone_cutoff;
+
+  size_t size() const { return this->first_index.size(); }
+  void reserve(size_t count);
+  void push_back(const ClusterBounds &cluster);
+  ClusterBounds at(size_t index) const;
+};
+
+// Greedy clusters of adjacent triangles, at most CLUSTER_MAX_VERTICES and
+// CLUSTER_MAX_TRIANGLES each. Reorders indices[0, index_count) cluster by
+// cluster, seeds follow the current order so the overdraw sort mostly holds.
+ClusterTable build_clusters(std::vector<unsigned int> &indices,
+                            size_t index_count,
+                            const std::vector<Vertex> &vertices);
+
+// Per draw scratch: rejects clusters outside the frustum or facing away
+// from the camera and merges the survivors into multi draw ranges
+class ClusterCuller {
+public:
+  // Both in the mesh model space, once per placement of the meshes.
+  // Clusters facing away are only dropped when cull_backfaces is set, GL
+  // would draw them otherwise.
+  void begin(const Frustum &frustum, const glm::vec3 &camera,
+             bool cull_backfaces);
+  void reset() { this->tested = this->visible = 0; }
+
+  // Whether the current GL state culls the back faces of counter clockwise
+  // triangles, the ones the normal cones are built for
+  static bool backface_culling_enabled();
+
+  // Fills counts / offsets / base_vertices for glMultiDrawElementsBaseVertex,
+  // index_offset is where the mesh indices start in the bound index buffer
+  void cull(const ClusterTable &clusters, size_t index_offset,
+            GLenum index_type, GLint base_vertex);
+
+  std::vector<GLsizei> counts;
+  std::vector<const void *> offsets;
+  std::vector<GLint> base_vertices;
+
+  // totals since reset()
+  size_t tested = 0;
+  size_t visible = 0;
+
+private:
+  Frustum _frustum{};
+  glm::vec3 _camera{0.0f};
+  bool _cull_backfaces = false;
+  std::vector<uint8_t> _visible;
+};
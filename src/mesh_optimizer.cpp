@@ -0,0 +1,308 @@
+#include "mesh_optimizer.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+constexpr size_t NO_VERTEX = SIZE_MAX;
+
+float VertexCacheStats::acmr() const {
+  return this->triangles ? static_cast<float>(this->transformed) /
+                               static_cast<float>(this->triangles)
+                         : 0.0f;
+}
+
+float VertexCacheStats::atvr() const {
+  return this->vertices ? static_cast<float>(this->transformed) /
+                              static_cast<float>(this->vertices)
+                        : 0.0f;
+}
+
+void VertexCacheStats::add(const VertexCacheStats &other) {
+  this->triangles += other.triangles;
+  this->vertices += other.vertices;
+  this->transformed += other.transformed;
+}
+
+// FIFO simulated with timestamps: a vertex is still cached while less than
+// cache_size misses happened since it was loaded
+struct CacheSimulation {
+  std::vector<unsigned int> timestamps;
+  unsigned int timestamp;
+  unsigned int cache_size;
+
+  CacheSimulation(size_t vertex_count, unsigned int _cache_size)
+      : timestamps(vertex_count, 0), timestamp(_cache_size + 1),
+        cache_size(_cache_size) {}
+
+  bool access(unsigned int vertex) {
+    if (this->timestamp - this->timestamps[vertex] <= this->cache_size)
+      return false;
+    this->timestamps[vertex] = this->timestamp++;
+    return true;
+  }
+  void flush() { this->timestamp += this->cache_size + 1; }
+};
+
+template <typename Index>
+static VertexCacheStats analyze(const Index *indices, size_t index_count,
+                                size_t vertex_count, unsigned int cache_size) {
+  VertexCacheStats stats;
+  stats.triangles = index_count / 3;
+  stats.vertices = vertex_count;
+
+  CacheSimulation cache(vertex_count, cache_size);
+  for (size_t i = 0; i < index_count; i++)
+    if (cache.access(indices[i]))
+      stats.transformed++;
+  return stats;
+}
+
+VertexCacheStats analyze_vertex_cache(const unsigned int *indices,
+                                      size_t index_count, size_t vertex_count,
+                                      unsigned int cache_size) {
+  return analyze(indices, index_count, vertex_count, cache_size);
+}
+
+VertexCacheStats analyze_vertex_cache(const MeshView &view,
+                                      unsigned int cache_size) {
+  if (view.index_type == GL_UNSIGNED_SHORT)
+    return analyze(static_cast<const uint16_t *>(view.indices),
+                   view.index_count, view.vertex_count, cache_size);
+  return analyze(static_cast<const unsigned int *>(view.indices),
+                 view.index_count, view.vertex_count, cache_size);
+}
+
+std::vector<size_t> optimize_vertex_cache(std::vector<unsigned int> &indices,
+                                          size_t vertex_count,
+                                          unsigned int cache_size) {
+  std::vector<size_t> clusters;
+  const size_t triangle_count = indices.size() / 3;
+  if (triangle_count == 0)
+    return clusters;
+
+  // triangles of every vertex, offsets[v] .. offsets[v + 1] in adjacency
+  std::vector<size_t> offsets(vertex_count + 1, 0);
+  for (unsigned int vertex : indices)
+    offsets[vertex + 1]++;
+  for (size_t v = 0; v < vertex_count; v++)
+    offsets[v + 1] += offsets[v];
+
+  std::vector<size_t> adjacency(indices.size());
+  std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+  for (size_t i = 0; i < indices.size(); i++)
+    adjacency[fill[indices[i]]++] = i / 3;
+
+  std::vector<size_t> live(vertex_count);
+  for (size_t v = 0; v < vertex_count; v++)
+    live[v] = offsets[v + 1] - offsets[v];
+
+  std::vector<unsigned int> timestamps(vertex_count, 0);
+  unsigned int timestamp = cache_size + 1;
+  std::vector<bool> emitted(triangle_count, false);
+  std::vector<unsigned int> dead_end;
+  std::vector<unsigned int> candidates;
+  std::vector<unsigned int> result;
+  dead_end.reserve(indices.size());
+  result.reserve(indices.size());
+
+  size_t cursor = 0;
+  while (cursor < vertex_count && live[cursor] == 0)
+    cursor++;
+  size_t fanning = cursor < vertex_count ? cursor : NO_VERTEX;
+  clusters.push_back(0);
+
+  while (fanning != NO_VERTEX) {
+    // emit every remaining triangle around the fanning vertex
+    candidates.clear();
+    for (size_t k = offsets[fanning]; k < offsets[fanning + 1]; k++) {
+      const size_t triangle = adjacency[k];
+      if (emitted[triangle])
+        continue;
+
+      for (size_t c = 0; c < 3; c++) {
+        const unsigned int vertex = indices[triangle * 3 + c];
+        result.push_back(vertex);
+        dead_end.push_back(vertex);
+        candidates.push_back(vertex);
+        live[vertex]--;
+        if (timestamp - timestamps[vertex] > cache_size)
+          timestamps[vertex] = timestamp++;
+      }
+      emitted[triangle] = true;
+    }
+
+    // next one is the oldest candidate that stays cached while its own fan
+    // is emitted, any live candidate otherwise
+    size_t next = NO_VERTEX;
+    size_t best = 0;
+    for (unsigned int vertex : candidates) {
+      if (live[vertex] == 0)
+        continue;
+
+      size_t priority = 0;
+      const size_t age = timestamp - timestamps[vertex];
+      if (age + 2 * live[vertex] <= cache_size)
+        priority = age;
+      if (next == NO_VERTEX || priority > best) {
+        next = vertex;
+        best = priority;
+      }
+    }
+
+    if (next == NO_VERTEX) {
+      // dead end, back to a recently used vertex or the next unprocessed one
+      while (!dead_end.empty() && next == NO_VERTEX) {
+        const unsigned int vertex = dead_end.back();
+        dead_end.pop_back();
+        if (live[vertex] > 0)
+          next = vertex;
+      }
+      while (next == NO_VERTEX && cursor < vertex_count) {
+        if (live[cursor] > 0)
+          next = cursor;
+        else
+          cursor++;
+      }
+      if (next != NO_VERTEX)
+        clusters.push_back(result.size() / 3);
+    }
+    fanning = next;
+  }
+
+  indices = std::move(result);
+  return clusters;
+}
+
+void optimize_overdraw(std::vector<unsigned int> &indices,
+                       const std::vector<size_t> &clusters,
+                       const std::vector<Vertex> &vertices,
+                       unsigned int cache_size, float threshold) {
+  const size_t triangle_count = indices.size() / 3;
+  if (clusters.empty() || triangle_count == 0)
+    return;
+
+  CacheSimulation cache(vertices.size(), cache_size);
+  auto misses = [&](size_t triangle) {
+    size_t count = 0;
+    for (size_t c = 0; c < 3; c++)
+      if (cache.access(indices[triangle * 3 + c]))
+        count++;
+    return count;
+  };
+
+  // Soft boundaries: a cluster is cut as soon as its running ACMR gets
+  // within threshold of the whole cluster's, smaller clusters sort better
+  std::vector<size_t> splits;
+  for (size_t c = 0; c < clusters.size(); c++) {
+    const size_t start = clusters[c];
+    const size_t end =
+        c + 1 < clusters.size() ? clusters[c + 1] : triangle_count;
+
+    cache.flush();
+    size_t cluster_misses = 0;
+    for (size_t t = start; t < end; t++)
+      cluster_misses += misses(t);
+    const float target = threshold * static_cast<float>(cluster_misses) /
+                         static_cast<float>(end - start);
+
+    cache.flush();
+    splits.push_back(start);
+    size_t running_misses = 0, running_triangles = 0;
+    for (size_t t = start; t < end; t++) {
+      running_misses += misses(t);
+      running_triangles++;
+      if (t + 1 < end && static_cast<float>(running_misses) <=
+                             target * static_cast<float>(running_triangles)) {
+        splits.push_back(t + 1);
+        cache.flush();
+        running_misses = running_triangles = 0;
+      }
+    }
+  }
+
+  glm::vec3 mesh_center(0.0f);
+  for (const Vertex &vertex : vertices)
+    mesh_center += vertex.position;
+  mesh_center /= static_cast<float>(std::max<size_t>(vertices.size(), 1));
+
+  // Clusters facing away from the center are drawn first, they are the most
+  // likely to occlude the rest of the mesh
+  struct Cluster {
+    size_t start, end;
+    float sort_key;
+  };
+  std::vector<Cluster> sorted;
+  sorted.reserve(splits.size());
+  for (size_t s = 0; s < splits.size(); s++) {
+    Cluster cluster{splits[s],
+                    s + 1 < splits.size() ? splits[s + 1] : triangle_count,
+                    0.0f};
+
+    glm::vec3 normal(0.0f), centroid(0.0f);
+    float area = 0.0f;
+    for (size_t t = cluster.start; t < cluster.end; t++) {
+      const glm::vec3 &a = vertices[indices[t * 3 + 0]].position;
+      const glm::vec3 &b = vertices[indices[t * 3 + 1]].position;
+      const glm::vec3 &c = vertices[indices[t * 3 + 2]].position;
+      const glm::vec3 cross = glm::cross(b - a, c - a);
+      const float triangle_area = glm::length(cross);
+
+      normal += cross;
+      centroid += (a + b + c) * (triangle_area / 3.0f);
+      area += triangle_area;
+    }
+
+    const float normal_length = glm::length(normal);
+    if (area > 0.0f && normal_length > 0.0f)
+      cluster.sort_key =
+          glm::dot(centroid / area - mesh_center, normal / normal_length);
+    sorted.push_back(cluster);
+  }
+
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const Cluster &a, const Cluster &b) {
+                     return a.sort_key > b.sort_key;
+                   });
+
+  std::vector<unsigned int> result;
+  result.reserve(indices.size());
+  for (const Cluster &cluster : sorted)
+    result.insert(result.end(), indices.data() + cluster.start * 3,
+                  indices.data() + cluster.end * 3);
+  indices = std::move(result);
+}
+
+void optimize_vertex_fetch(std::vector<Vertex> &vertices,
+                           std::vector<unsigned int> &indices) {
+  constexpr unsigned int UNUSED = UINT32_MAX;
+  std::vector<unsigned int> remap(vertices.size(), UNUSED);
+  std::vector<Vertex> result;
+  result.reserve(vertices.size());
+
+  for (unsigned int &index : indices) {
+    if (remap[index] == UNUSED) {
+      remap[index] = static_cast<unsigned int>(result.size());
+      result.push_back(vertices[index]);
+    }
+    index = remap[index];
+  }
+  vertices = std::move(result);
+}
+
+MeshOptimizationStats optimize_mesh(std::vector<Vertex> &vertices,
+                                    std::vector<unsigned int> &indices,
+                                    float overdraw_threshold) {
+  MeshOptimizationStats stats;
+  stats.before =
+      analyze_vertex_cache(indices.data(), indices.size(), vertices.size());
+
+  const std::vector<size_t> clusters =
+      optimize_vertex_cache(indices, vertices.size(), VERTEX_CACHE_SIZE);
+  optimize_overdraw(indices, clusters, vertices, VERTEX_CACHE_SIZE,
+                    overdraw_threshold);
+  optimize_vertex_fetch(vertices, indices);
+
+  stats.after =
+      analyze_vertex_cache(indices.data(), indices.size(), vertices.size());
+  return stats;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "mesh.hpp"
+
+// FIFO size the reordering targets and the statistics are simulated with,
+// close enough to what current GPUs behave like
+constexpr unsigned int VERTEX_CACHE_SIZE = 16;
+
+struct VertexCacheStats {
+  size_t triangles = 0;
+  size_t vertices = 0;
+  // cache misses, i.e. vertex shader invocations
+  size_t transformed = 0;
+
+  // average cache miss ratio, transformed vertices per triangle (0.5 - 3)
+  float acmr() const;
+  // average transform to vertex ratio, 1 is the best possible
+  float atvr() const;
+  void add(const VertexCacheStats &other);
+};
+
+struct MeshOptimizationStats {
+  // left empty when the meshes came out of an already optimized cache
+  VertexCacheStats before;
+  VertexCacheStats after;
+};
+
+VertexCacheStats
+analyze_vertex_cache(const unsigned int *indices, size_t index_count,
+                     size_t vertex_count,
+                     unsigned int cache_size = VERTEX_CACHE_SIZE);
+// 16 or 32 bits indices, e.g. a mesh out of the cache
+VertexCacheStats
+analyze_vertex_cache(const MeshView &view,
+                     unsigned int cache_size = VERTEX_CACHE_SIZE);
+
+// Tipsify (Sander et al. 2007), returns the start of every hard cluster, the
+// places where the walk hit a dead end and had to jump elsewhere
+std::vector<size_t> optimize_vertex_cache(std::vector<unsigned int> &indices,
+                                          size_t vertex_count,
+                                          unsigned int cache_size);
+// Splits the clusters further while the cache efficiency stays within
+// threshold of the cluster's and sorts them outward facing first
+void optimize_overdraw(std::vector<unsigned int> &indices,
+                       const std::vector<size_t> &clusters,
+                       const std::vector<Vertex> &vertices,
+                       unsigned int cache_size, float threshold);
+// Vertices in first use order, unreferenced ones are dropped
+void optimize_vertex_fetch(std::vector<Vertex> &vertices,
+                           std::vector<unsigned int> &indices);
+
+// Runs the three passes, overdraw_threshold is how much ACMR may be traded
+// for a better cluster order (1.05 = 5%)
+MeshOptimizationStats optimize_mesh(std::vector<Vertex> &vertices,
+                                    std::vector<unsigned int> &indices,
+                                    float overdraw_threshold);
@@ -0,0 +1,245 @@
+#include "mesh_simplifier.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+
+// Symmetric 4x4 error matrix of the planes around a vertex, weighted by the
+// triangle areas so the error is a mean squared distance
+struct Quadric {
+  double a2 = 0, ab = 0, ac = 0, ad = 0;
+  double b2 = 0, bc = 0, bd = 0;
+  double c2 = 0, cd = 0;
+  double d2 = 0;
+  double weight = 0;
+
+  void add_plane(const glm::vec3 &normal, float distance, double area) {
+    const double a = normal.x, b = normal.y, c = normal.z, d = distance;
+    this->a2 += area * a * a;
+    this->ab += area * a * b;
+    this->ac += area * a * c;
+    this->ad += area * a * d;
+    this->b2 += area * b * b;
+    this->bc += area * b * c;
+    this->bd += area * b * d;
+    this->c2 += area * c * c;
+    this->cd += area * c * d;
+    this->d2 += area * d * d;
+    this->weight += area;
+  }
+
+  Quadric operator+(const Quadric &other) const {
+    Quadric sum = *this;
+    sum.a2 += other.a2;
+    sum.ab += other.ab;
+    sum.ac += other.ac;
+    sum.ad += other.ad;
+    sum.b2 += other.b2;
+    sum.bc += other.bc;
+    sum.bd += other.bd;
+    sum.c2 += other.c2;
+    sum.cd += other.cd;
+    sum.d2 += other.d2;
+    sum.weight += other.weight;
+    return sum;
+  }
+
+  // mean squared distance of p to the planes
+  double error(const glm::vec3 &p) const {
+    const double x = p.x, y = p.y, z = p.z;
+    const double e = this->a2 * x * x + this->b2 * y * y + this->c2 * z * z +
+                     2 * (this->ab * x * y + this->ac * x * z +
+                          this->bc * y * z + this->ad * x + this->bd * y +
+                          this->cd * z) +
+                     this->d2;
+    return this->weight > 0 ? std::fabs(e) / this->weight : 0.0;
+  }
+};
+
+struct Collapse {
+  unsigned int from;
+  unsigned int to;
+  double error;
+};
+
+static uint64_t edge_key(unsigned int a, unsigned int b) {
+  return a < b ? uint64_t{a} << 32 | b : uint64_t{b} << 32 | a;
+}
+
+static glm::vec3 triangle_normal(const glm::vec3 &a, const glm::vec3 &b,
+                                 const glm::vec3 &c) {
+  return glm::cross(b - a, c - a);
+}
+
+std::vector<unsigned int>
+simplify_mesh(const std::vector<unsigned int> &indices,
+              const std::vector<Vertex> &vertices, size_t target_index_count,
+              float max_error, std::vector<float> &deviation, float &error) {
+  std::vector<unsigned int> result = indices;
+  const size_t vertex_count = vertices.size();
+  deviation.resize(vertex_count, 0.0f);
+  error = 0.0f;
+  for (unsigned int vertex : result)
+    error = std::max(error, deviation[vertex]);
+  if (result.size() <= target_index_count || vertex_count == 0)
+    return result;
+
+  // An edge used by a single triangle is a border in index space: either an
+  // open boundary or an attribute seam, both must stay where they are
+  std::unordered_map<uint64_t, unsigned int> edge_uses;
+  edge_uses.reserve(result.size());
+  for (size_t i = 0; i < result.size(); i += 3)
+    for (size_t e = 0; e < 3; e++)
+      edge_uses[edge_key(result[i + e], result[i + (e + 1) % 3])]++;
+
+  std::vector<bool> locked(vertex_count, false);
+  for (const auto &[key, uses] : edge_uses)
+    if (uses == 1) {
+      locked[static_cast<size_t>(key >> 32)] = true;
+      locked[static_cast<size_t>(key & 0xFFFFFFFF)] = true;
+    }
+
+  std::vector<Quadric> quadrics(vertex_count);
+  for (size_t i = 0; i < result.size(); i += 3) {
+    const glm::vec3 &a = vertices[result[i]].position;
+    const glm::vec3 &b = vertices[result[i + 1]].position;
+    const glm::vec3 &c = vertices[result[i + 2]].position;
+    const glm::vec3 cross = triangle_normal(a, b, c);
+    const float length = glm::length(cross);
+    if (length == 0.0f)
+      continue;
+
+    const glm::vec3 normal = cross / length;
+    const float distance = -glm::dot(normal, a);
+    for (size_t c_i = 0; c_i < 3; c_i++)
+      quadrics[result[i + c_i]].add_plane(normal, distance, 0.5 * length);
+  }
+
+  std::vector<size_t> offsets(vertex_count + 1);
+  std::vector<size_t> adjacency;
+  std::vector<Collapse> collapses;
+  std::vector<unsigned int> remap(vertex_count);
+  std::vector<bool> used(vertex_count);
+
+  while (result.size() > target_index_count) {
+    // triangles around every vertex for this pass
+    std::fill(offsets.begin(), offsets.end(), 0);
+    for (unsigned int vertex : result)
+      offsets[vertex + 1]++;
+    for (size_t v = 0; v < vertex_count; v++)
+      offsets[v + 1] += offsets[v];
+    adjacency.resize(result.size());
+    std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < result.size(); i++)
+      adjacency[fill[result[i]]++] = i / 3;
+
+    // cheapest direction of every edge, shared edges show up twice which is
+    // harmless since a vertex collapses at most once per pass
+    collapses.clear();
+    for (size_t i = 0; i < result.size(); i += 3)
+      for (size_t e = 0; e < 3; e++) {
+        const unsigned int a = result[i + e], b = result[i + (e + 1) % 3];
+        if (locked[a] && locked[b])
+          continue;
+
+        const Quadric sum = quadrics[a] + quadrics[b];
+        const double a_to_b =
+            locked[a] ? INFINITY : sum.error(vertices[b].position);
+        const double b_to_a =
+            locked[b] ? INFINITY : sum.error(vertices[a].position);
+        if (a_to_b <= b_to_a)
+          collapses.push_back(Collapse{a, b, a_to_b});
+        else
+          collapses.push_back(Collapse{b, a, b_to_a});
+      }
+    std::sort(collapses.begin(), collapses.end(),
+              [](const Collapse &x, const Collapse &y) {
+                return x.error < y.error;
+              });
+
+    for (size_t v = 0; v < vertex_count; v++)
+      remap[v] = static_cast<unsigned int>(v);
+    std::fill(used.begin(), used.end(), false);
+
+    const size_t triangle_goal = target_index_count / 3;
+    size_t triangles = result.size() / 3;
+    size_t collapsed = 0;
+    for (const Collapse &collapse : collapses) {
+      if (triangles <= triangle_goal)
+        break;
+      if (used[collapse.from] || used[collapse.to])
+        continue;
+
+      // the quadric only orders the collapses, what bounds them is how far
+      // the vertices merged into from end up
+      const glm::vec3 &target = vertices[collapse.to].position;
+      const float moved =
+          deviation[collapse.from] +
+          glm::length(vertices[collapse.from].position - target);
+      if (moved > max_error)
+        continue;
+
+      // moving from onto to must not flip any of the remaining triangles
+      bool flips = false;
+      size_t removed = 0;
+      for (size_t k = offsets[collapse.from]; k < offsets[collapse.from + 1];
+           k++) {
+        const size_t t = adjacency[k] * 3;
+        const unsigned int v0 = result[t], v1 = result[t + 1],
+                           v2 = result[t + 2];
+        if (v0 == collapse.to || v1 == collapse.to || v2 == collapse.to) {
+          removed++;
+          continue;
+        }
+
+        const glm::vec3 before =
+            triangle_normal(vertices[v0].position, vertices[v1].position,
+                            vertices[v2].position);
+        const glm::vec3 after = triangle_normal(
+            v0 == collapse.from ? target : vertices[v0].position,
+            v1 == collapse.from ? target : vertices[v1].position,
+            v2 == collapse.from ? target : vertices[v2].position);
+        if (glm::dot(before, after) <= 0.0f) {
+          flips = true;
+          break;
+        }
+      }
+      if (flips)
+        continue;
+
+      // the whole fan is frozen until the next pass, its flip checks above
+      // assumed none of these vertices move
+      for (size_t k = offsets[collapse.from]; k < offsets[collapse.from + 1];
+           k++) {
+        const size_t t = adjacency[k] * 3;
+        used[result[t]] = used[result[t + 1]] = used[result[t + 2]] = true;
+      }
+      remap[collapse.from] = collapse.to;
+      quadrics[collapse.to] = quadrics[collapse.to] + quadrics[collapse.from];
+      deviation[collapse.to] = std::max(deviation[collapse.to], moved);
+      triangles -= std::min(triangles, removed);
+      collapsed++;
+    }
+    if (collapsed == 0)
+      break;
+
+    // apply the pass, dropping the triangles that became degenerate
+    size_t write = 0;
+    for (size_t i = 0; i < result.size(); i += 3) {
+      const unsigned int v0 = remap[result[i]], v1 = remap[result[i + 1]],
+                         v2 = remap[result[i + 2]];
+      if (v0 == v1 || v1 == v2 || v0 == v2)
+        continue;
+      result[write++] = v0;
+      result[write++] = v1;
+      result[write++] = v2;
+    }
+    result.resize(write);
+  }
+
+  error = 0.0f;
+  for (unsigned int vertex : result)
+    error = std::max(error, deviation[vertex]);
+  return result;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "mesh.hpp"
+
+// Quadric error edge collapse (Garland & Heckbert) restricted to the existing
+// vertices: only the index buffer changes, so every level of detail keeps
+// using the vertices of the base mesh. Vertices on a border, UV or normal
+// seams included, never move.
+// Stops once index_count <= target_index_count or when no collapse is left
+// that keeps the surface within max_error (model units) of the reference.
+// deviation holds, for every vertex, how far the reference vertices merged
+// into it are from it: zeros for the full mesh, then passed along from one
+// level to the next. Each simplified triangle is the image of a reference
+// triangle, so error, the largest deviation left, bounds the distance
+// between both surfaces both ways.
+std::vector<unsigned int>
+simplify_mesh(const std::vector<unsigned int> &indices,
+              const std::vector<Vertex> &vertices, size_t target_index_count,
+              float max_error, std::vector<float> &deviation, float &error);
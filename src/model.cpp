@@ -3,133 +3,1013 @@
 #include "assimp/material.h"
 #include "assimp/postprocess.h"
 #include "assimp/scene.h"
+#include "mesh_simplifier.hpp"
 #include "texture2D.hpp"
+#include "texture_cache.hpp"
+#include "texture_loader.hpp"
+#include "upload_queue.hpp"
+#include "vertex_conversion.hpp"
+#include <algorithm>
+#include <cctype>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <cstring>
+#include <iostream>
+#include <limits>
 #include <stdexcept>
+#include <unordered_map>
+
+Model::~Model() {
+  UploadQueue::global().cancel(this);
+  // the import job reads this->dir
+  if (this->_streaming && this->_streaming->pending.valid())
+    this->_streaming->pending.wait();
+}
 
 void Model::load_model(const std::string &path, const ModelBuilder &builder) {
-  Assimp::Importer importer;
+  this->dir = path.substr(0, path.find_last_of('/'));
+  this->start_uploads(this->import_model(path, builder), true);
+}
+
+void Model::start_streaming(const std::string &path,
+                            const ModelBuilder &builder) {
+  this->dir = path.substr(0, path.find_last_of('/'));
+  this->_streaming = std::make_unique<Streaming>();
+  this->_streaming->path = path;
+  this->_streaming->pending = ThreadPool::global().submit(
+      [this, path, builder]() { return this->import_model(path, builder); });
+}
+
+static float max_scale(const glm::mat4 &model) {
+  return std::max({glm::length(glm::vec3(model[0])),
+                   glm::length(glm::vec3(model[1])),
+                   glm::length(glm::vec3(model[2]))});
+}
+
+// With several placements an instance gets the finest level any of them needs
+void Model::select_lods(const glm::mat4 &view, const glm::mat4 &projection,
+                        const glm::mat4 *models, size_t count) {
+  this->_lods.assign(this->_instances.size(), 0);
+  if (!this->_options.lod_enabled)
+    return;
+
+  // pixels covered by one unit seen from a distance of one
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  const float pixels_per_unit =
+      projection[1][1] * static_cast<float>(viewport[3]) * 0.5f;
+
+  const glm::vec3 camera = glm::vec3(glm::inverse(view)[3]);
+  for (size_t i = 0; i < this->_instances.size(); i++) {
+    const MeshInstance &instance = this->_instances[i];
+    const Mesh &mesh = this->meshes[instance.mesh];
+    size_t selected = mesh.lods.empty() ? 0 : mesh.lods.size() - 1;
+    for (size_t k = 0; k < count && selected > 0; k++) {
+      const glm::mat4 model = models[k] * instance.transform;
+      const float scale = max_scale(model);
+      const glm::vec3 center =
+          glm::vec3(model * glm::vec4(mesh.bounds.center, 1.0f));
+      const float distance =
+          glm::length(center - camera) - mesh.bounds.radius * scale;
+      if (distance <= 0.0f) {
+        selected = 0;
+        break;
+      }
+
+      // errors only grow with the level
+      size_t level = 0;
+      while (level + 1 < mesh.lods.size() &&
+             mesh.lods[level + 1].error * scale / distance * pixels_per_unit <=
+                 this->_options.lod_error_pixels)
+        level++;
+      selected = std::min(selected, level);
+    }
+    this->_lods[i] = selected;
+  }
+}
+
+// the sphere goes first, it is cheaper and rejects most of what is out
+bool Model::is_visible(const Frustum &frustum, const Mesh &mesh,
+                       const glm::mat4 &model) const {
+  const glm::vec3 center =
+      glm::vec3(model * glm::vec4(mesh.bounds.center, 1.0f));
+  if (!frustum.intersects_sphere(center,
+                                 mesh.bounds.radius * max_scale(model)))
+    return false;
+  const BoundingBox box = mesh.box.transformed(model);
+  return frustum.intersects_aabb(box.min, box.max);
+}
+
+void Model::add_occluders(OcclusionCuller &culler,
+                          const glm::mat4 &model) const {
+  if (this->_occluders.empty())
+    return;
+  for (const MeshInstance &instance : this->_instances)
+    culler.add_occluder(this->_occluders[instance.mesh],
+                        model * instance.transform);
+}
+
+void Model::cull_instances(const Frustum &frustum, const glm::mat4 &model) {
+  this->_visible.assign(this->_instances.size(), 1);
+  this->_culling = CullingStats{this->_instances.size(), 0, 0};
+  const bool culling = this->_options.frustum_culling;
+  OcclusionCuller *occlusion = this->occlusion_culler();
+  if (!culling && !occlusion)
+    return;
+
+  const BoundingBox box = this->_box.transformed(model);
+  const bool model_visible =
+      !culling || frustum.intersects_aabb(box.min, box.max);
+  for (size_t i = 0; i < this->_instances.size(); i++) {
+    const MeshInstance &instance = this->_instances[i];
+    const Mesh &mesh = this->meshes[instance.mesh];
+    const glm::mat4 instance_model = model * instance.transform;
+    // occlusion only for what is in view, its test costs more
+    if (culling &&
+        (!model_visible || !this->is_visible(frustum, mesh, instance_model))) {
+      this->_culling.culled++;
+    } else if (occlusion && occlusion->is_occluded(mesh.box, instance_model)) {
+      this->_culling.occluded++;
+    } else {
+      continue;
+    }
+    this->_visible[i] = 0;
+    this->_culling.visible--;
+  }
+}
+
+// Reads back whatever answers are in. Nothing here waits on the GPU, an
+// answer that is late keeps the previous one.
+void Model::poll_occlusion_queries() {
+  OcclusionQueries &queries = this->_occlusion_queries;
+  queries.init();
+  this->_queries.resize(this->_instances.size());
+  for (InstanceQuery &query : this->_queries) {
+    bool passed = false;
+    if (query.query && QueryPool::poll(query.query, passed)) {
+      query.visible = passed;
+      queries.pool().release(query.query);
+      query.query = 0;
+    }
+  }
+}
+
+// Fills the depth with what was visible then queries the boxes of every
+// instance in view against it, the batches must be uploaded
+void Model::query_occlusion(const Transform &transform) {
+  OcclusionQueries &queries = this->_occlusion_queries;
+  if (this->_options.depth_prepass) {
+    queries.depth_program().use();
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glStencilMask(0x00);
+    this->_geometry.bind();
+    for (const DrawBatch &batch : this->_batches) {
+      // shared batches only hold instances visible last frame
+      const size_t i = this->_batch_order[batch.first];
+      if (!this->_queries[i].visible)
+        continue;
+      this->_geometry.bind_instances(batch.first);
+      this->meshes[this->_instances[i].mesh].draw_instanced_without_texture(
+          this->_lods[i], batch.count);
+    }
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glStencilMask(0xFF);
+  }
+
+  // A box the camera is in, or close enough for the near plane to cut it,
+  // would fail its query while the mesh is right there
+  const glm::mat4 &projection = transform.projection;
+  const float near = projection[3][2] / (projection[2][2] - 1.0f);
+  const float margin =
+      near * std::sqrt(1.0f + 1.0f / (projection[0][0] * projection[0][0]) +
+                       1.0f / (projection[1][1] * projection[1][1]));
+  const glm::vec3 camera = glm::vec3(glm::inverse(transform.view)[3]);
+
+  queries.begin();
+  for (size_t i = 0; i < this->_instances.size(); i++) {
+    InstanceQuery &query = this->_queries[i];
+    // one in flight at a time, a late one goes on serving as the condition
+    if (!this->_visible[i] || query.query)
+      continue;
+
+    const MeshInstance &instance = this->_instances[i];
+    const Mesh &mesh = this->meshes[instance.mesh];
+    const glm::mat4 model = transform.model * instance.transform;
+    const BoundingBox box = mesh.box.transformed(model);
+    const glm::vec3 low = box.min - glm::vec3(margin);
+    const glm::vec3 high = box.max + glm::vec3(margin);
+    if (camera.x >= low.x && camera.y >= low.y && camera.z >= low.z &&
+        camera.x <= high.x && camera.y <= high.y && camera.z <= high.z) {
+      query.visible = true;
+      continue;
+    }
+    query.query = queries.query_box(mesh.box, model);
+  }
+  queries.end();
+  // the pre-pass already wrote the depth the lit pass will find
+  glDepthFunc(GL_LEQUAL);
+
+  for (size_t i = 0; i < this->_instances.size(); i++)
+    if (this->_visible[i] && !this->_queries[i].visible) {
+      this->_culling.visible--;
+      this->_culling.occluded++;
+    }
+}
+
+void Model::draw(const Shader &shader, const Transform &transfrom) {
+  this->poll_streaming();
+  if (this->_failed)
+    return;
+
+  if (_options.outline_enabled) {
+    glStencilFunc(GL_ALWAYS, 1, 0xFF);
+    glStencilMask(0xFF);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+  }
+
+  this->select_lods(transfrom.view, transfrom.projection, &transfrom.model,
+                    1);
+
+  // clusters are in the unpacked model space, before _position_decode
+  ClusterCuller *culler = _options.cluster_culling ? &this->_culler : nullptr;
+  this->_culler.reset();
+
+  const Frustum frustum = Frustum::from(transfrom.projection * transfrom.view);
+  this->cull_instances(frustum, transfrom.model);
+  const bool queries = _options.occlusion == OcclusionMode::QUERIES &&
+                       this->_geometry.is_init();
+  if (queries)
+    this->poll_occlusion_queries();
+  this->batch_instances(culler != nullptr, transfrom.model);
+  this->upload_batches(transfrom.model);
+  if (queries) {
+    this->query_occlusion(transfrom);
+    shader.use();
+  }
+
+  // one VAO for every mesh, each one is a range of it
+  this->_geometry.bind();
+  this->begin_face_culling();
+  this->_drawn_triangles = 0;
+  for (const DrawBatch &batch : this->_batches)
+    this->_drawn_triangles +=
+        this->draw_batch(&shader, batch, transfrom, transfrom.model, culler);
+  this->_cluster_stats = ClusterStats{this->_culler.tested,
+                                      this->_culler.visible};
+
+  if (_options.outline_enabled) {
+    glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
+    glStencilMask(0x00);
+    _outline.use();
+    _outline.set_uniform("outline_color", _options.outline.color);
+
+    // the lit pass may still read the previous transforms, they are orphaned
+    const glm::mat4 scaled =
+        glm::scale(transfrom.model, _options.outline.scale);
+    this->upload_batches(scaled);
+    for (const DrawBatch &batch : this->_batches)
+      this->draw_batch(nullptr, batch, transfrom, scaled, culler);
+    glStencilMask(0xFF);
+    glStencilFunc(GL_ALWAYS, 1, 0xFF);
+  }
+  this->end_face_culling();
+  this->_geometry.bind_instances(0);
+  this->_geometry.unbind();
+  if (queries)
+    glDepthFunc(GL_LESS);
+
+  shader.use();
+}
+
+void Model::batch_instances(bool clusters, const glm::mat4 &model) {
+  this->_batch_order.clear();
+  for (size_t i = 0; i < this->_instances.size(); i++)
+    if (this->_visible[i] &&
+        this->meshes[this->_instances[i].mesh].is_uploaded())
+      this->_batch_order.push_back(i);
+  // already by mesh since the import, the levels may still interleave
+  std::stable_sort(this->_batch_order.begin(), this->_batch_order.end(),
+                   [this](size_t a, size_t b) {
+                     const uint32_t mesh_a = this->_instances[a].mesh;
+                     const uint32_t mesh_b = this->_instances[b].mesh;
+                     return mesh_a < mesh_b ||
+                            (mesh_a == mesh_b &&
+                             this->_lods[a] < this->_lods[b]);
+                   });
+
+  const bool queries = this->_options.occlusion == OcclusionMode::QUERIES &&
+                       !this->_queries.empty();
+  this->_batches.clear();
+  for (size_t k = 0; k < this->_batch_order.size(); k++) {
+    const size_t i = this->_batch_order[k];
+    const uint32_t mesh = this->_instances[i].mesh;
+    const bool single =
+        (queries && !this->_queries[i].visible) ||
+        (clusters && this->_lods[i] == 0 &&
+         this->meshes[mesh].clusters.size() > 0);
+    const bool mirrored =
+        glm::determinant(glm::mat3(model * this->_instances[i].transform)) <
+        0.0f;
+    if (!single && !this->_batches.empty()) {
+      DrawBatch &last = this->_batches.back();
+      const size_t j = this->_batch_order[last.first];
+      if (!last.single && last.mirrored == mirrored &&
+          this->_instances[j].mesh == mesh &&
+          this->_lods[j] == this->_lods[i]) {
+        last.count++;
+        continue;
+      }
+    }
+    this->_batches.push_back(DrawBatch{k, 1, single, mirrored});
+  }
+}
+
+void Model::upload_batches(const glm::mat4 &model) {
+  this->_instance_transforms.clear();
+  for (size_t i : this->_batch_order) {
+    const glm::mat4 instance_model = model * this->_instances[i].transform;
+    this->_instance_transforms.push_back(
+        InstanceTransform{instance_model * this->_position_decode,
+                          normal_matrix(instance_model)});
+  }
+  if (!this->_instance_transforms.empty())
+    this->_geometry.upload_instances(this->_instance_transforms.data(),
+                                     this->_instance_transforms.size());
+}
+
+size_t Model::draw_batch(const Shader *shader, const DrawBatch &batch,
+                         const Transform &transform, const glm::mat4 &model,
+                         ClusterCuller *culler) {
+  const size_t i = this->_batch_order[batch.first];
+  const Mesh &mesh = this->meshes[this->_instances[i].mesh];
+  const bool cull_backfaces = this->cull_faces(mesh.closed, batch.mirrored);
+  this->_geometry.bind_instances(batch.first);
+  if (!batch.single)
+    return shader ? mesh.draw_instanced(*shader, this->_lods[i], batch.count)
+                  : mesh.draw_instanced_without_texture(this->_lods[i],
+                                                        batch.count);
+
+  // a plain draw reads the first transform of the bound instances
+  if (culler)
+    this->begin_culling(transform, model * this->_instances[i].transform,
+                        cull_backfaces);
+  // the GPU skips it if the box query of this frame is already back and
+  // failed, it is drawn if the answer is not there yet
+  const GLuint condition = this->draw_condition(i);
+  if (condition)
+    glBeginConditionalRender(condition, GL_QUERY_NO_WAIT);
+  const size_t triangles =
+      shader ? mesh.draw(*shader, this->_lods[i], culler)
+             : mesh.draw_without_texture(this->_lods[i], culler);
+  if (condition)
+    glEndConditionalRender();
+  return triangles;
+}
+
+void Model::draw_instanced(const Shader &shader, const glm::mat4 &view,
+                           const glm::mat4 &projection,
+                           const glm::mat4 *models, size_t count) {
+  this->poll_streaming();
+  this->_drawn_triangles = 0;
+  this->_culler.reset();
+  if (count == 0 || this->_failed || !this->_geometry.is_init())
+    return;
+
+  this->select_lods(view, projection, models, count);
+
+  // whole model first so placements out of view skip the per mesh tests
+  const Frustum frustum = Frustum::from(projection * view);
+  const bool culling = this->_options.frustum_culling;
+  OcclusionCuller *occlusion = this->occlusion_culler();
+  this->_visible.assign(count, 1);
+  if (culling)
+    for (size_t k = 0; k < count; k++) {
+      const BoundingBox box = this->_box.transformed(models[k]);
+      this->_visible[k] = frustum.intersects_aabb(box.min, box.max);
+    }
+
+  // visible placements of instance i are at [firsts[i], firsts[i + 1])
+  this->_culling = CullingStats{};
+  this->_instance_transforms.clear();
+  this->_instance_firsts.assign(1, 0);
+  for (size_t i = 0; i < this->_instances.size(); i++) {
+    const MeshInstance &instance = this->_instances[i];
+    const Mesh &mesh = this->meshes[instance.mesh];
+    for (size_t k = 0; k < count; k++) {
+      const glm::mat4 model = models[k] * instance.transform;
+      if (culling &&
+          (!this->_visible[k] || !this->is_visible(frustum, mesh, model))) {
+        this->_culling.culled++;
+        continue;
+      }
+      if (occlusion && occlusion->is_occluded(mesh.box, model)) {
+        this->_culling.occluded++;
+        continue;
+      }
+      this->_culling.visible++;
+      this->_instance_transforms.push_back(InstanceTransform{
+          model * this->_position_decode, normal_matrix(model)});
+    }
+    this->_instance_firsts.push_back(this->_instance_transforms.size());
+  }
+  if (this->_instance_transforms.empty())
+    return;
+  this->_geometry.upload_instances(this->_instance_transforms.data(),
+                                   this->_instance_transforms.size());
+
+  // one draw per mesh, faces are only culled if every placement winds the
+  // same way
+  size_t mirrored = 0;
+  for (size_t k = 0; k < count; k++)
+    mirrored += glm::determinant(glm::mat3(models[k])) < 0.0f;
+  const bool same_winding = mirrored == 0 || mirrored == count;
+
+  this->_geometry.bind();
+  this->begin_face_culling();
+  for (size_t i = 0; i < this->_instances.size(); i++) {
+    const Mesh &mesh = this->meshes[this->_instances[i].mesh];
+    const size_t first = this->_instance_firsts[i];
+    const size_t visible = this->_instance_firsts[i + 1] - first;
+    if (!mesh.is_uploaded() || visible == 0)
+      continue;
+
+    this->cull_faces(
+        mesh.closed && same_winding,
+        (mirrored == count) !=
+            (glm::determinant(glm::mat3(this->_instances[i].transform)) <
+             0.0f));
+    this->_geometry.bind_instances(first);
+    this->_drawn_triangles +=
+        mesh.draw_instanced(shader, this->_lods[i], visible);
+  }
+  this->end_face_culling();
+  this->_geometry.bind_instances(0);
+  this->_geometry.unbind();
+}
+
+// Frustum and camera brought into the space of the mesh vertices
+void Model::begin_culling(const Transform &transform, const glm::mat4 &model,
+                          bool cull_backfaces) {
+  const glm::vec3 camera = glm::vec3(glm::inverse(transform.view)[3]);
+  this->_culler.begin(
+      Frustum::from(transform.projection * transform.view * model),
+      glm::vec3(glm::inverse(model) * glm::vec4(camera, 1.0f)),
+      cull_backfaces);
+}
+
+void Model::begin_face_culling() {
+  const bool caller = glIsEnabled(GL_CULL_FACE) == GL_TRUE;
+  this->_face_culling = FaceCulling{
+      caller, caller && ClusterCuller::backface_culling_enabled(), caller,
+      false};
+}
+
+// A closed mesh never shows its back faces, culling them halves its
+// rasterization and lets the normal cones drop whole clusters. A mirroring
+// transform turns its counter clockwise triangles clockwise on screen.
+bool Model::cull_faces(bool closed, bool mirrored) {
+  FaceCulling &state = this->_face_culling;
+  if (state.caller)
+    return state.caller_backfaces && !mirrored;
+
+  if (closed != state.enabled) {
+    if (closed) {
+      glEnable(GL_CULL_FACE);
+      glCullFace(GL_BACK);
+    } else {
+      glDisable(GL_CULL_FACE);
+    }
+    state.enabled = closed;
+  }
+  if (closed && mirrored != state.clockwise) {
+    glFrontFace(mirrored ? GL_CW : GL_CCW);
+    state.clockwise = mirrored;
+  }
+  return closed;
+}
+
+void Model::end_face_culling() {
+  FaceCulling &state = this->_face_culling;
+  if (state.caller)
+    return;
+  if (state.enabled)
+    glDisable(GL_CULL_FACE);
+  if (state.clockwise)
+    glFrontFace(GL_CCW);
+  state.enabled = state.clockwise = false;
+}
+
+void Model::poll_streaming() {
+  if (!this->_streaming)
+    return;
+
+  if (this->_streaming->import) {
+    if (this->_streaming->remaining_uploads == 0)
+      this->_streaming.reset();
+    return;
+  }
+
+  if (this->_streaming->pending.wait_for(std::chrono::seconds(0)) !=
+      std::future_status::ready)
+    return;
+  // this runs in the middle of a frame, a failed import only takes this
+  // model out instead of unwinding the render loop
+  try {
+    this->start_uploads(this->_streaming->pending.get(), false);
+  } catch (const std::exception &error) {
+    std::cerr << "Erreur: Impossible de streamer le modele "
+              << this->_streaming->path << "\n -> " << error.what() << "\n";
+    UploadQueue::global().cancel(this);
+    this->_streaming.reset();
+    this->_failed = true;
+  }
+}
+
+void Model::start_uploads(ModelImport import, bool immediate) {
+  if (!this->_streaming)
+    this->_streaming = std::make_unique<Streaming>();
+
+  ModelImport &imported = this->_streaming->import.emplace(std::move(import));
+  this->meshes = std::move(imported.meshes);
+  this->_optimization = imported.optimization;
+  this->_load = imported.load;
+  this->_position_decode = imported.position_decode;
+  this->_instances = imported.instances;
+  this->_occluders = std::move(imported.occluders);
+  if (!this->_instances.empty()) {
+    const MeshInstance &first = this->_instances.front();
+    this->_box =
+        this->meshes[first.mesh].box.transformed(first.transform);
+    for (const MeshInstance &instance : this->_instances)
+      this->_box.merge(this->meshes[instance.mesh].box.transformed(
+          instance.transform));
+  }
+  for (const auto &[path, handle] : imported.resolved)
+    this->texture_handles.push_back(handle);
+  this->_streaming->remaining_uploads =
+      imported.textures.size() + this->meshes.size();
+
+  // sized for the whole model up front, meshes fill it as they are uploaded
+  std::vector<MeshView> views;
+  views.reserve(this->meshes.size());
+  for (const Mesh &mesh : this->meshes)
+    views.push_back(mesh.source());
+  this->_geometry.init(views);
+
+  // Immediate mode still goes through the queue for meshes waiting on a
+  // texture another model is currently loading
+  auto submit = [this](bool run_now, std::function<bool()> ready,
+                       std::function<size_t()> run) {
+    if (run_now)
+      run();
+    else
+      UploadQueue::global().push(UploadJob{this, ready, run});
+  };
+
+  // Textures go first so meshes are not waiting on them in the queue
+  // Streamed textures go through the staging buffers so the transfer does
+  // not block the frame, a synchronous load copies from client memory and
+  // waits on its own decodes in upload()
+  PixelUploader *uploader = immediate ? nullptr : &PixelUploader::global();
+  for (size_t i = 0; i < imported.textures.size(); i++) {
+    submit(
+        immediate,
+        [&imported, i, uploader]() {
+          return imported.textures.is_decoded(i) &&
+                 (!uploader || uploader->has_free_buffer());
+        },
+        [this, &imported, i, uploader]() {
+          this->_streaming->remaining_uploads--;
+          return this->upload_texture(imported, i, uploader);
+        });
+  }
+  for (size_t i = 0; i < this->meshes.size(); i++) {
+    submit(immediate && this->mesh_textures_ready(imported, i),
+           [this, &imported, i]() {
+             return this->mesh_textures_ready(imported, i);
+           },
+           [this, &imported, i]() {
+             this->_streaming->remaining_uploads--;
+             return this->upload_mesh(imported, i);
+           });
+  }
+
+  if (this->_streaming->remaining_uploads == 0)
+    this->_streaming.reset();
+}
+
+// From the uploaded levels so cached and fresh imports get the same ones
+static void build_occluders(ModelImport &import, const ModelBuilder &builder) {
+  if (!builder.occluders)
+    return;
+  import.occluders.reserve(import.meshes.size());
+  for (const Mesh &mesh : import.meshes)
+    import.occluders.push_back(make_occluder(mesh.source(), mesh.lods,
+                                             import.position_decode,
+                                             builder.occluder_triangles));
+}
+
+// mtllib lines of an .obj, assimp reads these files next to it
+static std::vector<std::string>
+material_libraries(const MappedFile &source) {
+  std::vector<std::string> names;
+  const char *text = reinterpret_cast<const char *>(source.data());
+  const char *end = text + source.size();
+  for (const char *line = text; line < end;) {
+    const char *next = std::find(line, end, '\n');
+    while (line < next && (*line == ' ' || *line == '\t'))
+      line++;
+    if (next - line > 7 && std::strncmp(line, "mtllib", 6) == 0 &&
+        (line[6] == ' ' || line[6] == '\t')) {
+      std::string name(line + 7, next);
+      while (!name.empty() && std::isspace(static_cast<unsigned char>(
+                                  name.back())))
+        name.pop_back();
+      names.push_back(name);
+    }
+    line = next + 1;
+  }
+  return names;
+}
+
+// Source content, its material libraries and every builder option that
+// changes the baked data
+static uint64_t cache_key(const std::string &path,
+                          const ModelBuilder &builder) {
+  MappedFile source;
+  if (!source.open(path))
+    throw std::runtime_error("Erreur: Impossible d'ouvrir le modele: " +
+                             path + "\n");
+
+  uint64_t materials = FNV_OFFSET_BASIS;
+  const size_t dot = path.find_last_of('.');
+  std::string extension = dot == std::string::npos ? "" : path.substr(dot);
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  if (extension == ".obj") {
+    const std::string dir = path.substr(0, path.find_last_of('/') + 1);
+    for (const std::string &name : material_libraries(source)) {
+      // a missing library still changes the key once it shows up
+      materials = hash_bytes(name.data(), name.size(), materials);
+      MappedFile library;
+      if (library.open(dir + name))
+        materials = hash_bytes(library.data(), library.size(), materials);
+    }
+  }
+
+  const uint32_t flags = (builder.flip_y ? 1u : 0u) |
+                         (builder.optimize_meshes ? 2u : 0u) |
+                         (builder.build_clusters ? 4u : 0u) |
+                         builder.vertex_format.bits() << 8;
+  uint64_t key = hash_bytes(&flags, sizeof(flags),
+                            hash_bytes(source.data(), source.size()));
+  key = hash_bytes(&materials, sizeof(materials), key);
+  key = hash_bytes(builder.lods.data(),
+                   builder.lods.size() * sizeof(LodSettings), key);
+  if (builder.optimize_meshes)
+    key = hash_bytes(&builder.overdraw_threshold,
+                     sizeof(builder.overdraw_threshold), key);
+  return key;
+}
+
+// One quantization grid for the whole model so a single decode matrix
+// covers every mesh
+static void pack_vertices(ModelImport &import, const VertexFormat &format) {
+  if (!format.is_packed())
+    return;
+
+  glm::vec3 min(std::numeric_limits<float>::max());
+  glm::vec3 max(std::numeric_limits<float>::lowest());
+  for (const Mesh &mesh : import.meshes)
+    for (const Vertex &vertex : mesh.vertices) {
+      min = glm::min(min, vertex.position);
+      max = glm::max(max, vertex.position);
+    }
+  if (min.x > max.x)
+    min = max = glm::vec3(0.0f);
+
+  glm::vec3 scale = max - min;
+  for (int c = 0; c < 3; c++)
+    if (scale[c] <= 0.0f)
+      scale[c] = 1.0f;
+
+  if (format.position == PositionFormat::UNORM16)
+    import.position_decode =
+        glm::scale(glm::translate(glm::mat4(1.0f), min), scale);
+  for (Mesh &mesh : import.meshes)
+    mesh.pack_vertices(format, min, scale);
+}
+
+ModelImport Model::import_model(const std::string &path,
+                                const ModelBuilder &builder) const {
+  ModelImport import;
+  const std::string cache_path = path + MESH_CACHE_EXTENSION;
+  const uint64_t key = builder.use_cache ? cache_key(path, builder) : 0;
+
   auto start = std::chrono::high_resolution_clock::now();
+  import.cache = std::make_unique<MeshCache>();
+  if (builder.use_cache && import.cache->open(cache_path, key)) {
+    this->import_from_cache(import, builder);
+    auto end = std::chrono::high_resolution_clock::now();
+    import.load.import_ms =
+        std::chrono::duration<double, std::milli>(end - start).count();
+    import.load.from_cache = true;
+    return import;
+  }
+  import.cache.reset();
+
+  Assimp::Importer importer;
   const aiScene *scene =
-      importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+      importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs |
+                                  aiProcess_JoinIdenticalVertices);
   if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
       !scene->mRootNode) {
     throw std::runtime_error(
         "Erreur: (ASSIMP) Impossible de load le modele: " + path + "\n -> " +
         importer.GetErrorString() + "\n");
   }
+
+  std::vector<uint32_t> converted(scene->mNumMeshes, UINT32_MAX);
+  this->process_node(scene->mRootNode, scene, builder, glm::mat4(1.0f),
+                     converted, import);
+  // instances of the same mesh next to each other, draw() batches them
+  std::stable_sort(import.instances.begin(), import.instances.end(),
+                   [](const MeshInstance &a, const MeshInstance &b) {
+                     return a.mesh < b.mesh;
+                   });
+  this->request_textures(import, builder);
+
+  pack_vertices(import, builder.vertex_format);
+  if (builder.use_cache)
+    MeshCache::write(cache_path, key, import.meshes, import.mesh_textures,
+                     import.instances, import.position_decode);
+  build_occluders(import, builder);
   auto end = std::chrono::high_resolution_clock::now();
-  std::cout << "Load time: "
-            << std::chrono::duration_cast<std::chrono::milliseconds>(end -
-                                                                     start)
-                   .count()
-            << "ms\n";
+  import.load.import_ms =
+      std::chrono::duration<double, std::milli>(end - start).count();
+  return import;
+}
 
-  this->dir = path.substr(0, path.find_last_of('/'));
-  this->process_node(scene->mRootNode, scene, builder);
+void Model::import_from_cache(ModelImport &import,
+                              const ModelBuilder &builder) const {
+  const MeshCache &cache = *import.cache;
+  import.mesh_textures.reserve(cache.mesh_count());
+  import.meshes.reserve(cache.mesh_count());
+  import.position_decode = cache.position_decode();
+  import.instances = cache.instances();
+
+  for (size_t i = 0; i < cache.mesh_count(); i++) {
+    import.mesh_textures.push_back(cache.textures(i));
+    // glBufferData will read straight from the mapping
+    Mesh &mesh =
+        import.meshes.emplace_back(cache.mesh(i), std::vector<Texture2D *>{});
+    mesh.lods = cache.lods(i);
+    mesh.bounds = cache.bounds(i);
+    mesh.box = cache.box(i);
+    mesh.closed = cache.closed(i);
+    mesh.clusters = cache.clusters(i);
+
+    // already optimized, only the result of the full level can be measured
+    MeshView full = cache.mesh(i);
+    if (!mesh.lods.empty())
+      full.index_count = mesh.lods.front().index_count;
+    import.optimization.after.add(analyze_vertex_cache(full));
+  }
+  build_occluders(import, builder);
+  this->request_textures(import, builder);
+}
+
+void Model::generate_lods(Mesh &mesh, const ModelBuilder &builder) const {
+  const uint32_t full_count = static_cast<uint32_t>(mesh.indices.size());
+  mesh.lods = {MeshLod{0, full_count, 0.0f}};
+
+  std::vector<unsigned int> previous = mesh.indices;
+  // each level is simplified from the previous one, the deviations carry
+  // the distance to the full mesh along the chain
+  std::vector<float> deviation(mesh.vertices.size(), 0.0f);
+  for (const LodSettings &settings : builder.lods) {
+    const size_t target =
+        static_cast<size_t>(static_cast<float>(full_count) * settings.ratio) /
+        3 * 3;
+    float error;
+    std::vector<unsigned int> level =
+        simplify_mesh(previous, mesh.vertices, target,
+                      settings.max_error * mesh.bounds.radius, deviation,
+                      error);
+
+    // not worth a level, and the next ones would not get any further
+    if (level.empty() || level.size() * 20 > previous.size() * 19)
+      break;
+
+    if (builder.optimize_meshes)
+      optimize_vertex_cache(level, mesh.vertices.size(), VERTEX_CACHE_SIZE);
+
+    mesh.lods.push_back(
+        MeshLod{static_cast<uint32_t>(mesh.indices.size()),
+                static_cast<uint32_t>(level.size()), error});
+    mesh.indices.insert(mesh.indices.end(), level.begin(), level.end());
+    previous = std::move(level);
+  }
+}
+
+static glm::mat4 to_glm(const aiMatrix4x4 &m) {
+  // assimp is row major
+  return glm::mat4(glm::vec4(m.a1, m.b1, m.c1, m.d1),
+                   glm::vec4(m.a2, m.b2, m.c2, m.d2),
+                   glm::vec4(m.a3, m.b3, m.c3, m.d3),
+                   glm::vec4(m.a4, m.b4, m.c4, m.d4));
 }
 
 void Model::process_node(aiNode *node, const aiScene *scene,
-                         const ModelBuilder &builder) {
+                         const ModelBuilder &builder, const glm::mat4 &parent,
+                         std::vector<uint32_t> &converted,
+                         ModelImport &import) const {
+  const glm::mat4 transform = parent * to_glm(node->mTransformation);
   for (unsigned int i = 0; i < node->mNumMeshes; i++) {
-    aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-    this->meshes.push_back(this->process_mesh(mesh, scene, builder));
+    // every aiMesh is converted once, the next nodes using it only add an
+    // instance
+    const unsigned int source = node->mMeshes[i];
+    if (converted[source] == UINT32_MAX) {
+      converted[source] = static_cast<uint32_t>(import.meshes.size());
+      this->add_mesh(scene->mMeshes[source], scene, builder, import);
+    }
+    import.instances.push_back(MeshInstance{converted[source], transform});
   }
 
   for (unsigned int i = 0; i < node->mNumChildren; i++)
-    this->process_node(node->mChildren[i], scene, builder);
+    this->process_node(node->mChildren[i], scene, builder, transform,
+                       converted, import);
 }
 
-Mesh Model::process_mesh(aiMesh *mesh, const aiScene *scene,
-                         const ModelBuilder &builder) {
-  std::vector<Vertex> vertices;
+void Model::add_mesh(aiMesh *mesh, const aiScene *scene,
+                     const ModelBuilder &builder, ModelImport &import) const {
+  import.mesh_textures.emplace_back();
+  Mesh &imported = import.meshes.emplace_back(
+      this->process_mesh(mesh, scene, builder, import.mesh_textures.back()));
+
+  MeshOptimizationStats stats;
+  if (builder.optimize_meshes)
+    stats = optimize_mesh(imported.vertices, imported.indices,
+                          builder.overdraw_threshold);
+  imported.compute_bounds();
+  imported.compute_closed();
+  // only the full level is clustered, the coarser ones are cheap already
+  if (builder.build_clusters) {
+    imported.clusters = ::build_clusters(
+        imported.indices, imported.indices.size(), imported.vertices);
+    if (builder.optimize_meshes)
+      stats.after = analyze_vertex_cache(
+          imported.indices.data(), imported.indices.size(),
+          imported.vertices.size(), VERTEX_CACHE_SIZE);
+  }
+  if (builder.optimize_meshes) {
+    import.optimization.before.add(stats.before);
+    import.optimization.after.add(stats.after);
+  }
+  this->generate_lods(imported, builder);
+  imported.compact_indices();
+}
+
+static_assert(sizeof(aiVector3D) == 3 * sizeof(float),
+              "assimp must be built with float ai_real");
+
+static const float *components(const aiVector3D *vectors) {
+  return vectors ? &vectors[0].x : nullptr;
+}
+
+static std::vector<unsigned int> convert_indices(const aiMesh *mesh) {
   std::vector<unsigned int> indices;
-  std::vector<Texture2D *> textures;
-
-  // process vertices
-  for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
-    Vertex vertex;
-    vertex.position.x = mesh->mVertices[i].x;
-    vertex.position.y = mesh->mVertices[i].y;
-    vertex.position.z = mesh->mVertices[i].z;
-
-    vertex.normal.x = mesh->mNormals[i].x;
-    vertex.normal.y = mesh->mNormals[i].y;
-    vertex.normal.z = mesh->mNormals[i].z;
-
-    if (mesh->mTextureCoords[0]) {
-      vertex.texture_coordinate.x = mesh->mTextureCoords[0][i].x;
-      vertex.texture_coordinate.y =
-          (builder.flip_y ? -1 : 1) * mesh->mTextureCoords[0][i].y;
-    } else {
-      vertex.texture_coordinate = glm::vec2(0.0f);
-    }
 
-    vertices.push_back(std::move(vertex));
+  // aiProcess_Triangulate leaves triangle only meshes in the common case
+  if (mesh->mPrimitiveTypes == aiPrimitiveType_TRIANGLE) {
+    indices.resize(size_t{mesh->mNumFaces} * 3);
+    unsigned int *out = indices.data();
+    for (unsigned int i = 0; i < mesh->mNumFaces; i++, out += 3) {
+      const unsigned int *face = mesh->mFaces[i].mIndices;
+      out[0] = face[0];
+      out[1] = face[1];
+      out[2] = face[2];
+    }
+    return indices;
   }
 
-  // process indices
+  // points and lines can't go through GL_TRIANGLES, they are dropped
+  size_t count = 0;
+  for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+    if (mesh->mFaces[i].mNumIndices == 3)
+      count += 3;
+
+  indices.reserve(count);
   for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
-    aiFace face = mesh->mFaces[i];
-    for (unsigned int j = 0; j < face.mNumIndices; j++) {
-      indices.push_back(face.mIndices[j]);
-    }
+    const aiFace &face = mesh->mFaces[i];
+    if (face.mNumIndices == 3)
+      indices.insert(indices.end(), face.mIndices, face.mIndices + 3);
   }
+  return indices;
+}
+
+Mesh Model::process_mesh(aiMesh *mesh, const aiScene *scene,
+                         const ModelBuilder &builder,
+                         std::vector<TextureRef> &textures) const {
+  std::vector<Vertex> vertices(mesh->mNumVertices);
+  convert_vertices(components(mesh->mVertices), components(mesh->mNormals),
+                   components(mesh->mTextureCoords[0]), mesh->mNumVertices,
+                   builder.flip_y, vertices.data());
+  std::vector<unsigned int> indices = convert_indices(mesh);
 
   // process textures
   aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-  std::vector<Texture2D *> diffuse_maps =
-      this->load_material_textures(material, aiTextureType_DIFFUSE);
-  std::vector<Texture2D *> specular_maps =
-      this->load_material_textures(material, aiTextureType_SPECULAR);
+  this->load_material_textures(material, aiTextureType_DIFFUSE, textures);
+  this->load_material_textures(material, aiTextureType_SPECULAR, textures);
 
-  textures.insert(textures.end(), diffuse_maps.begin(), diffuse_maps.end());
-  textures.insert(textures.end(), specular_maps.begin(), specular_maps.end());
-
-  return Mesh(vertices, indices, textures);
+  return Mesh(std::move(vertices), std::move(indices), {});
 }
 
-std::vector<Texture2D *> Model::load_material_textures(aiMaterial *material,
-                                                       aiTextureType type) {
-  std::vector<Texture2D *> textures;
+void Model::load_material_textures(aiMaterial *material, aiTextureType type,
+                                   std::vector<TextureRef> &textures) const {
+  TextureType texture_type = TextureType::DIFFUSE;
+  switch (type) {
+  case aiTextureType_DIFFUSE:
+    texture_type = TextureType::DIFFUSE;
+    break;
+  case aiTextureType_SPECULAR:
+    texture_type = TextureType::SPECULAR;
+    break;
+  default:
+    break;
+  }
+
   for (unsigned int i = 0; i < material->GetTextureCount(type); i++) {
     aiString path;
     material->GetTexture(type, i, &path);
+    textures.push_back(TextureRef{path.C_Str(), texture_type});
+  }
+}
 
-    if (std::find_if(this->loaded_textures.begin(), this->loaded_textures.end(),
-                     [path](const auto &t) {
-                       return !std::strcmp(path.C_Str(),
-                                           t->get_local_path().data());
-                     }) != this->loaded_textures.end()) {
-      // std::cout << "Already loaded texture! " << path.C_Str() << std::endl;
-      continue;
-    }
+void Model::request_textures(ModelImport &import,
+                             const ModelBuilder &builder) const {
+  std::vector<TextureLoadRequest> requests;
+  for (const auto &textures : import.mesh_textures) {
+    for (const TextureRef &ref : textures) {
+      if (import.resolved.count(ref.path))
+        continue;
 
-    Texture2DBuilder builder;
-    switch (type) {
-    case aiTextureType_DIFFUSE:
-      builder.type = TextureType::DIFFUSE;
-      break;
-    case aiTextureType_SPECULAR:
-      builder.type = TextureType::SPECULAR;
-      break;
-    default:
-      break;
-    }
+      Texture2DBuilder texture_builder;
+      texture_builder.type = ref.type;
+      texture_builder.compress = builder.compress_textures;
+      const std::string file_path = this->dir + "/" + ref.path;
+
+      // Already resident or being loaded by another model: nothing to decode
+      bool needs_load = false;
+      import.resolved.emplace(
+          ref.path, TextureCache::global().acquire(
+                        TextureKey::from(file_path, texture_builder),
+                        needs_load));
+      if (!needs_load)
+        continue;
 
-    auto tex_start = std::chrono::high_resolution_clock::now();
-    Texture2D *texture =
-        new Texture2D((this->dir + "/" + path.C_Str()).data(), builder);
-    auto tex_end = std::chrono::high_resolution_clock::now();
-    std::cout << "Texture load time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(
-                     tex_end - tex_start)
-                     .count()
-              << "ms (" << path.C_Str() << ")\n";
+      requests.push_back(TextureLoadRequest{file_path, texture_builder});
+      import.texture_paths.push_back(ref.path);
+    }
+  }
+  import.textures.decode(std::move(requests));
+}
 
-    textures.push_back(texture);
-    this->loaded_textures.push_back(std::move(texture));
+// The entry can't stay empty, meshes of every model sharing the texture
+// wait for it before they upload
+size_t Model::upload_texture(ModelImport &import, size_t index,
+                             PixelUploader *uploader) {
+  Texture2D *texture;
+  try {
+    texture = import.textures.upload(index, uploader);
+  } catch (const std::exception &error) {
+    const TextureLoadRequest &request = import.textures.request(index);
+    std::cerr << "Erreur: texture remplacee par une couleur unie: "
+              << request.file_path << "\n -> " << error.what() << "\n";
+    texture = new Texture2D(
+        DecodedImage::placeholder(request.builder.type, request.file_path),
+        request.builder);
   }
-  return textures;
+  TextureCache::global().fulfill(
+      import.resolved.at(import.texture_paths[index]), texture);
+  return texture->get_byte_size();
+}
+
+size_t Model::upload_mesh(ModelImport &import, size_t index) {
+  Mesh &mesh = this->meshes[index];
+  for (const TextureRef &ref : import.mesh_textures[index])
+    mesh.textures.push_back(import.resolved.at(ref.path).get());
+
+  const size_t bytes = mesh.upload_size();
+  mesh.setup(this->_geometry);
+  return bytes;
+}
+
+bool Model::mesh_textures_ready(const ModelImport &import,
+                                size_t index) const {
+  for (const TextureRef &ref : import.mesh_textures[index])
+    if (!import.resolved.at(ref.path).get())
+      return false;
+  return true;
 }
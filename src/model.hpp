@@ -1,13 +1,60 @@
 #pragma once
 
 #include "assimp/scene.h"
+#include "frustum.hpp"
+#include "geometry_arena.hpp"
 #include "mesh.hpp"
+#include "mesh_cache.hpp"
+#include "mesh_optimizer.hpp"
+#include "occlusion_culler.hpp"
+#include "occlusion_queries.hpp"
 #include "shader.hpp"
 #include "texture2D.hpp"
+#include "texture_cache.hpp"
+#include "texture_loader.hpp"
+#include <future>
 #include <glm/ext/matrix_transform.hpp>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+
+// ratio of the full mesh index count, max_error relative to the mesh radius,
+// whichever is reached first ends the level
+struct LodSettings {
+  float ratio;
+  float max_error;
+};
 
 struct ModelBuilder {
   bool flip_y = true;
+  // Bake the imported meshes next to the source file and reuse them on the
+  // next launches as long as the source did not change
+  bool use_cache = true;
+  // Import on the thread pool and upload through UploadQueue::global(), the
+  // model starts empty and its meshes show up as they become resident
+  bool streaming = false;
+  // see Texture2DBuilder::compress. The first import of each texture runs
+  // the encoder and writes a .ktx next to it, bench/texture_bench compares.
+  bool compress_textures = false;
+  // Reorder triangles for the post transform cache and overdraw, then
+  // vertices for fetch locality. Baked in the cache like the rest.
+  bool optimize_meshes = true;
+  float overdraw_threshold = 1.05f;
+  // e.g. UNORM16 / OCTAHEDRAL / HALF is 16 bytes per vertex instead of 32
+  VertexFormat vertex_format;
+  // Levels of detail generated by edge collapse, coarser and coarser.
+  // Empty to only keep the full meshes.
+  std::vector<LodSettings> lods = {
+      {0.5f, 0.01f}, {0.25f, 0.02f}, {0.1f, 0.05f}, {0.03f, 0.1f}};
+  // Split the full level of every mesh in small clusters that draw() can
+  // frustum cull on their own, backface cull too when GL culls back faces
+  // (always for closed meshes), see ClusterCuller
+  bool build_clusters = true;
+  // Keep a low poly copy of every mesh for OcclusionCuller, the finest level
+  // with at most occluder_triangles inset by its error. Alpha tested meshes
+  // are treated as solid, turn it off for models made of foliage.
+  bool occluders = true;
+  size_t occluder_triangles = 512;
 };
 
 struct Outline {
@@ -15,81 +62,274 @@ struct Outline {
   glm::vec3 scale;
 };
 
+// view and projection only drive culling and LOD selection, the shaders take
+// the camera from the Frame block, see FrameConstants
 struct Transform {
   glm::mat4 view;
   glm::mat4 projection;
   glm::mat4 model;
 };
 
+enum class OcclusionMode {
+  NONE,
+  // OcclusionCuller given to Model::set_occlusion_culler, same frame
+  SOFTWARE,
+  // box queries after a depth pre-pass, answers used a frame or more late,
+  // draw() only
+  QUERIES,
+};
+
 struct RenderOptions {
   bool outline_enabled = false;
   Outline outline = Outline{glm::vec3(1.0), glm::vec3(1.0)};
+  // coarsest level whose error stays under lod_error_pixels on screen
+  bool lod_enabled = true;
+  float lod_error_pixels = 1.0f;
+  // only for meshes drawn at their full level and built with clusters
+  bool cluster_culling = true;
+  // skip the whole model, then each mesh instance, outside the view
+  bool frustum_culling = true;
+  // for the mesh instances left by the frustum
+  OcclusionMode occlusion = OcclusionMode::SOFTWARE;
+  // QUERIES only: what was visible last frame fills the depth first
+  bool depth_prepass = true;
+};
+
+// Mesh instances of the last draw, one per placement for draw_instanced
+struct CullingStats {
+  size_t visible = 0;
+  size_t culled = 0;
+  // with QUERIES the last answer, they still go through conditional
+  // rendering in case it changed since
+  size_t occluded = 0;
+};
+
+struct ClusterStats {
+  size_t tested = 0;
+  size_t visible = 0;
+};
+
+// How long import_model() took, from the .kmesh cache or through assimp
+struct LoadStats {
+  double import_ms = 0.0;
+  bool from_cache = false;
+};
+
+// CPU side result of an import, built without touching OpenGL
+struct ModelImport {
+  std::vector<Mesh> meshes;
+  std::vector<std::vector<TextureRef>> mesh_textures;
+  // unique texture paths, same order as the loader requests
+  std::vector<std::string> texture_paths;
+  TextureLoader textures;
+  // cached meshes point inside its mapping until they are uploaded
+  std::unique_ptr<MeshCache> cache;
+
+  // every texture of the model by relative path, requested or shared
+  std::unordered_map<std::string, TextureHandle> resolved;
+
+  // what draw() goes through, several can share a mesh
+  std::vector<MeshInstance> instances;
+  // by mesh, empty when ModelBuilder::occluders is off
+  std::vector<Occluder> occluders;
+
+  MeshOptimizationStats optimization;
+  LoadStats load;
+  // identity unless the positions are quantized
+  glm::mat4 position_decode = glm::mat4(1.0f);
 };
 
 class Model {
 public:
   Model(const char *path, const ModelBuilder builder = {}) {
-    this->load_model(path, builder);
+    if (builder.streaming)
+      this->start_streaming(path, builder);
+    else
+      this->load_model(path, builder);
 
     _outline.add_shader<VertexShader>("../src/shaders/model_vertex.glsl");
     _outline.add_shader<FragmentShader>(
         "../src/shaders/outline_models.frag.glsl");
     _outline.link();
   }
-  ~Model() {
-    for (Texture2D *tex_ptr : loaded_textures)
-      delete tex_ptr;
-  }
+  ~Model();
+
+  // false while a streamed model still has uploads in flight
+  bool is_ready() const { return !this->_streaming; }
+  // the background import threw, the model draws nothing
+  bool has_failed() const { return this->_failed; }
 
-  void draw(const Shader &shader, const Transform &transfrom) {
-    if (_options.outline_enabled) {
-      glStencilFunc(GL_ALWAYS, 1, 0xFF);
-      glStencilMask(0xFF);
-      glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-    }
-
-    shader.set_uniform("view", transfrom.view);
-    shader.set_uniform("projection", transfrom.projection);
-    shader.set_uniform("model", transfrom.model);
-
-    for (const Mesh &mesh : this->meshes)
-      mesh.draw(shader);
-
-    if (_options.outline_enabled) {
-      glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
-      glStencilMask(0x00);
-      _outline.use();
-
-      _outline.set_uniform("view", transfrom.view);
-      _outline.set_uniform("projection", transfrom.projection);
-      _outline.set_uniform("model",
-                           glm::scale(transfrom.model, _options.outline.scale));
-      _outline.set_uniform("outline_color", _options.outline.color);
-
-      for (const Mesh &mesh : this->meshes)
-        mesh.draw_without_texture();
-      glStencilMask(0xFF);
-      glStencilFunc(GL_ALWAYS, 1, 0xFF);
-    }
-
-    shader.use();
+  // Visible instances sharing a mesh and a level go in one instanced draw,
+  // the shader reads their transforms from the instance attributes, see
+  // model_vertex.glsl
+  void draw(const Shader &shader, const Transform &transfrom);
+
+  // Same model at every matrix of models in one instanced draw per mesh.
+  // Frustum culling is done per placement, no outline nor cluster culling.
+  void draw_instanced(const Shader &shader, const glm::mat4 &view,
+                      const glm::mat4 &projection, const glm::mat4 *models,
+                      size_t count);
+  void draw_instanced(const Shader &shader, const glm::mat4 &view,
+                      const glm::mat4 &projection,
+                      const std::vector<glm::mat4> &models) {
+    this->draw_instanced(shader, view, projection, models.data(),
+                         models.size());
   }
 
   void set_render_options(RenderOptions options) { _options = options; }
+  // Rasterized for the current frame before draw() / draw_instanced(),
+  // nullptr to stop testing against it
+  void set_occlusion_culler(OcclusionCuller *culler) {
+    this->_occlusion = culler;
+  }
+  // Queues the occluder of every mesh instance, the model placed at model
+  void add_occluders(OcclusionCuller &culler, const glm::mat4 &model) const;
+  // Triangles of the levels drawn by the last draw(), outline pass excluded
+  size_t drawn_triangles() const { return this->_drawn_triangles; }
+  // Totals over every mesh, empty until the import is done
+  const MeshOptimizationStats &optimization_stats() const {
+    return this->_optimization;
+  }
+  CullingStats culling_stats() const { return this->_culling; }
+  // Zero until the import is done
+  const LoadStats &load_stats() const { return this->_load; }
+  // Model space, every instance included. Zero until the import is done.
+  const BoundingBox &bounds() const { return this->_box; }
+  // Clusters of the last draw(), zero when cluster culling is off
+  ClusterStats cluster_stats() const {
+    return _options.cluster_culling ? this->_cluster_stats : ClusterStats{};
+  }
 
 private:
   std::vector<Mesh> meshes;
-  std::vector<Texture2D *> loaded_textures;
+  GeometryArena _geometry;
+  // keeps the shared textures used by the meshes alive
+  std::vector<TextureHandle> texture_handles;
   std::string dir;
 
   RenderOptions _options;
   Shader _outline;
+  MeshOptimizationStats _optimization;
+  LoadStats _load;
+  glm::mat4 _position_decode = glm::mat4(1.0f);
+  std::vector<MeshInstance> _instances;
+  BoundingBox _box{glm::vec3(0.0f), glm::vec3(0.0f)};
+  // per instance, filled by cull_instances()
+  std::vector<uint8_t> _visible;
+  CullingStats _culling;
+  // level of detail of every instance for the current draw
+  std::vector<size_t> _lods;
+  size_t _drawn_triangles = 0;
+  // scratch of both draws, kept to reuse its capacity
+  std::vector<InstanceTransform> _instance_transforms;
+  std::vector<size_t> _instance_firsts;
+  // Instances of one draw() call, the visible ones of _batch_order[first,
+  // first + count) with their transforms at the same place in
+  // _instance_transforms. Single ones cull their clusters or wait on a
+  // query, they cannot share a draw. Mirrored ones wind the other way.
+  struct DrawBatch {
+    size_t first;
+    size_t count;
+    bool single;
+    bool mirrored;
+  };
+  std::vector<DrawBatch> _batches;
+  std::vector<size_t> _batch_order;
+  ClusterCuller _culler;
+  ClusterStats _cluster_stats;
+  std::vector<Occluder> _occluders;
+  OcclusionCuller *_occlusion = nullptr;
+  // per instance, query is 0 once its answer was read
+  struct InstanceQuery {
+    GLuint query = 0;
+    bool visible = true;
+  };
+  std::vector<InstanceQuery> _queries;
+  OcclusionQueries _occlusion_queries;
+  // GL face culling during a draw: closed meshes get it when the caller
+  // left it off, a caller that turned it on keeps its own state
+  struct FaceCulling {
+    bool caller;
+    // the caller culls the back of counter clockwise triangles
+    bool caller_backfaces;
+    bool enabled;
+    bool clockwise;
+  };
+  FaceCulling _face_culling{};
+
+  struct Streaming {
+    std::string path;
+    std::future<ModelImport> pending;
+    std::optional<ModelImport> import;
+    size_t remaining_uploads = 0;
+  };
+  std::unique_ptr<Streaming> _streaming;
+  bool _failed = false;
 
   void load_model(const std::string &path, const ModelBuilder &builder);
+  void start_streaming(const std::string &path, const ModelBuilder &builder);
+  void poll_streaming();
+  void start_uploads(ModelImport import, bool immediate);
+  void select_lods(const glm::mat4 &view, const glm::mat4 &projection,
+                   const glm::mat4 *models, size_t count);
+  void begin_culling(const Transform &transform, const glm::mat4 &model,
+                     bool cull_backfaces);
+  void begin_face_culling();
+  // Whether GL culls exactly the back faces of the mesh afterwards, the
+  // ones its normal cones are built for
+  bool cull_faces(bool closed, bool mirrored);
+  void end_face_culling();
+  void cull_instances(const Frustum &frustum, const glm::mat4 &model);
+  void batch_instances(bool clusters, const glm::mat4 &model);
+  // Transforms of the batched instances placed at model, in batch order
+  void upload_batches(const glm::mat4 &model);
+  // without textures when shader is nullptr, returns the triangles drawn
+  size_t draw_batch(const Shader *shader, const DrawBatch &batch,
+                    const Transform &transform, const glm::mat4 &model,
+                    ClusterCuller *culler);
+  bool is_visible(const Frustum &frustum, const Mesh &mesh,
+                  const glm::mat4 &model) const;
+  // nullptr unless occlusion culling is on and a culler was given
+  OcclusionCuller *occlusion_culler() const {
+    return this->_options.occlusion == OcclusionMode::SOFTWARE
+               ? this->_occlusion
+               : nullptr;
+  }
+  void poll_occlusion_queries();
+  void query_occlusion(const Transform &transform);
+  // 0 when the instance has to be drawn without a condition
+  GLuint draw_condition(size_t instance) const {
+    if (this->_options.occlusion != OcclusionMode::QUERIES ||
+        this->_queries.empty() || this->_queries[instance].visible)
+      return 0;
+    return this->_queries[instance].query;
+  }
+
+  // Import side, runs on whichever thread imports and never touches GL
+  ModelImport import_model(const std::string &path,
+                           const ModelBuilder &builder) const;
+  void import_from_cache(ModelImport &import,
+                         const ModelBuilder &builder) const;
+  void generate_lods(Mesh &mesh, const ModelBuilder &builder) const;
+  // converted maps the scene meshes to import.meshes, UINT32_MAX until the
+  // first node using them
   void process_node(aiNode *node, const aiScene *scene,
-                    const ModelBuilder &builder);
+                    const ModelBuilder &builder, const glm::mat4 &parent,
+                    std::vector<uint32_t> &converted,
+                    ModelImport &import) const;
+  void add_mesh(aiMesh *mesh, const aiScene *scene,
+                const ModelBuilder &builder, ModelImport &import) const;
   Mesh process_mesh(aiMesh *mesh, const aiScene *scene,
-                    const ModelBuilder &builder);
-  std::vector<Texture2D *> load_material_textures(aiMaterial *mat,
-                                                  aiTextureType type);
+                    const ModelBuilder &builder,
+                    std::vector<TextureRef> &textures) const;
+  void load_material_textures(aiMaterial *mat, aiTextureType type,
+                              std::vector<TextureRef> &textures) const;
+  void request_textures(ModelImport &import,
+                        const ModelBuilder &builder) const;
+
+  // GL thread only, the mesh is drawable once its textures are uploaded
+  size_t upload_texture(ModelImport &import, size_t index,
+                        PixelUploader *uploader);
+  size_t upload_mesh(ModelImport &import, size_t index);
+  bool mesh_textures_ready(const ModelImport &import, size_t index) const;
 };
@@ -0,0 +1,456 @@
+#include "occlusion_culler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <thread>
+
+#include "thread_pool.hpp"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+constexpr int TILES_X = OCCLUSION_WIDTH / OCCLUSION_TILE;
+constexpr int TILES_Y = OCCLUSION_HEIGHT / OCCLUSION_TILE;
+
+// pixels per edge function evaluation, a row starts on a multiple of it
+#if defined(__AVX2__)
+constexpr int RASTER_LANES = 8;
+#elif defined(__SSE2__)
+constexpr int RASTER_LANES = 4;
+#else
+constexpr int RASTER_LANES = 1;
+#endif
+static_assert(OCCLUSION_WIDTH % RASTER_LANES == 0,
+              "a row must be a whole number of blocks");
+
+// cosine between a vertex normal and one of its triangles under which the
+// inset would move the vertex more than 4 times the level error
+constexpr float OCCLUDER_MIN_MITER = 0.25f;
+
+Occluder make_occluder(const MeshView &view, const std::vector<MeshLod> &lods,
+                       const glm::mat4 &position_decode,
+                       size_t max_triangles) {
+  // levels only get coarser, the finest that fits needs the least inset
+  size_t first = 0, count = view.index_count;
+  float error = 0.0f;
+  for (const MeshLod &lod : lods) {
+    first = lod.first_index;
+    count = lod.index_count;
+    error = lod.error;
+    if (count / 3 <= max_triangles)
+      break;
+  }
+
+  const size_t stride = view.vertex_format.stride();
+  const unsigned char *vertices =
+      static_cast<const unsigned char *>(view.vertices);
+  auto position_at = [&](uint32_t index) {
+    const unsigned char *vertex = vertices + index * stride;
+    if (view.vertex_format.position == PositionFormat::UNORM16) {
+      uint16_t packed[3];
+      std::memcpy(packed, vertex, sizeof(packed));
+      const glm::vec4 normalized(static_cast<float>(packed[0]) / 65535.0f,
+                                 static_cast<float>(packed[1]) / 65535.0f,
+                                 static_cast<float>(packed[2]) / 65535.0f,
+                                 1.0f);
+      return glm::vec3(position_decode * normalized);
+    }
+    glm::vec3 position;
+    std::memcpy(&position, vertex, sizeof(position));
+    return position;
+  };
+  auto index_at = [&view](size_t i) -> uint32_t {
+    if (view.index_type == GL_UNSIGNED_SHORT)
+      return static_cast<const uint16_t *>(view.indices)[i];
+    return static_cast<const unsigned int *>(view.indices)[i];
+  };
+
+  Occluder occluder;
+  occluder.indices.reserve(count);
+  std::vector<uint32_t> remap(view.vertex_count, UINT32_MAX);
+  for (size_t i = first; i < first + count; i++) {
+    const uint32_t index = index_at(i);
+    if (remap[index] == UINT32_MAX) {
+      remap[index] = static_cast<uint32_t>(occluder.positions.size());
+      occluder.positions.push_back(position_at(index));
+    }
+    occluder.indices.push_back(remap[index]);
+  }
+
+  // A simplified level stays within its error of the mesh surface but can
+  // bulge out of it by that much, hiding what is right behind the real
+  // silhouette. Each vertex goes back along its normal until every one of
+  // its triangles receded by the error, a miter, so all of them stay inside.
+  // Too sharp a vertex drops its triangles instead. Those holes, and the
+  // cracks of split seam vertices, only let more through.
+  if (error > 0.0f) {
+    const size_t vertex_count = occluder.positions.size();
+    std::vector<glm::vec3> normals(vertex_count, glm::vec3(0.0f));
+    for (size_t i = 0; i + 2 < occluder.indices.size(); i += 3) {
+      const uint32_t a = occluder.indices[i];
+      const uint32_t b = occluder.indices[i + 1];
+      const uint32_t c = occluder.indices[i + 2];
+      // area weighted
+      const glm::vec3 normal =
+          glm::cross(occluder.positions[b] - occluder.positions[a],
+                     occluder.positions[c] - occluder.positions[a]);
+      normals[a] += normal;
+      normals[b] += normal;
+      normals[c] += normal;
+    }
+    for (glm::vec3 &normal : normals) {
+      const float length = glm::length(normal);
+      normal = length > 0.0f ? normal / length : glm::vec3(0.0f);
+    }
+
+    // smallest cosine between each vertex normal and its triangles
+    std::vector<float> miter(vertex_count, 1.0f);
+    for (size_t i = 0; i + 2 < occluder.indices.size(); i += 3) {
+      const uint32_t corners[3] = {occluder.indices[i],
+                                   occluder.indices[i + 1],
+                                   occluder.indices[i + 2]};
+      const glm::vec3 cross =
+          glm::cross(occluder.positions[corners[1]] -
+                         occluder.positions[corners[0]],
+                     occluder.positions[corners[2]] -
+                         occluder.positions[corners[0]]);
+      const float length = glm::length(cross);
+      if (length == 0.0f)
+        continue;
+      for (uint32_t corner : corners)
+        miter[corner] =
+            std::min(miter[corner], glm::dot(normals[corner], cross) / length);
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i + 2 < occluder.indices.size(); i += 3) {
+      if (miter[occluder.indices[i]] < OCCLUDER_MIN_MITER ||
+          miter[occluder.indices[i + 1]] < OCCLUDER_MIN_MITER ||
+          miter[occluder.indices[i + 2]] < OCCLUDER_MIN_MITER)
+        continue;
+      for (size_t k = 0; k < 3; k++)
+        occluder.indices[kept++] = occluder.indices[i + k];
+    }
+    occluder.indices.resize(kept);
+    for (size_t i = 0; i < vertex_count; i++)
+      if (miter[i] >= OCCLUDER_MIN_MITER)
+        occluder.positions[i] -= normals[i] * (error / miter[i]);
+  }
+  return occluder;
+}
+
+OcclusionCuller::OcclusionCuller()
+    : _bins(static_cast<size_t>(TILES_Y)),
+      _depth(static_cast<size_t>(OCCLUSION_WIDTH * OCCLUSION_HEIGHT), 0.0f),
+      _tiles(static_cast<size_t>(TILES_X * TILES_Y), 0.0f) {}
+
+void OcclusionCuller::begin(const glm::mat4 &view_projection) {
+  this->_view_projection = view_projection;
+  this->_queued.clear();
+  std::fill(this->_depth.begin(), this->_depth.end(), 0.0f);
+  std::fill(this->_tiles.begin(), this->_tiles.end(), 0.0f);
+  this->_stats = OcclusionStats{};
+}
+
+void OcclusionCuller::add_occluder(const Occluder &occluder,
+                                   const glm::mat4 &model) {
+  if (!occluder.empty())
+    this->_queued.push_back(Queued{&occluder, model});
+}
+
+void OcclusionCuller::setup_triangles() {
+  this->_triangles.clear();
+  for (std::vector<uint32_t> &bin : this->_bins)
+    bin.clear();
+  const float width = static_cast<float>(OCCLUSION_WIDTH);
+  const float height = static_cast<float>(OCCLUSION_HEIGHT);
+
+  for (const Queued &queued : this->_queued) {
+    const Occluder &occluder = *queued.occluder;
+    const glm::mat4 clip_matrix = this->_view_projection * queued.model;
+    this->_clip.resize(occluder.positions.size());
+    for (size_t i = 0; i < occluder.positions.size(); i++)
+      this->_clip[i] = clip_matrix * glm::vec4(occluder.positions[i], 1.0f);
+
+    for (size_t t = 0; t + 2 < occluder.indices.size(); t += 3) {
+      float x[3], y[3], w[3];
+      bool clipped = false;
+      for (size_t k = 0; k < 3; k++) {
+        const glm::vec4 &clip = this->_clip[occluder.indices[t + k]];
+        // dropping a triangle crossing the near plane only loses occlusion
+        if (clip.w <= 0.0f || clip.z < -clip.w) {
+          clipped = true;
+          break;
+        }
+        w[k] = 1.0f / clip.w;
+        x[k] = (clip.x * w[k] * 0.5f + 0.5f) * width;
+        y[k] = (clip.y * w[k] * 0.5f + 0.5f) * height;
+      }
+      if (clipped)
+        continue;
+
+      // counter clockwise is front facing, back faces are hidden by the
+      // front ones of a closed mesh anyway
+      const float area =
+          (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+      if (area <= 0.0f)
+        continue;
+
+      Triangle triangle;
+      auto bound = [](float value, float max) {
+        return static_cast<int>(std::clamp(value, 0.0f, max));
+      };
+      triangle.min_x = bound(std::floor(std::min({x[0], x[1], x[2]})), width);
+      triangle.max_x = bound(std::ceil(std::max({x[0], x[1], x[2]})), width);
+      triangle.min_y = bound(std::floor(std::min({y[0], y[1], y[2]})), height);
+      triangle.max_y = bound(std::ceil(std::max({y[0], y[1], y[2]})), height);
+      if (triangle.min_x >= triangle.max_x || triangle.min_y >= triangle.max_y)
+        continue;
+
+      // inside is on the left of every edge
+      for (size_t k = 0; k < 3; k++) {
+        const size_t next = (k + 1) % 3;
+        triangle.edge_a[k] = y[k] - y[next];
+        triangle.edge_b[k] = x[next] - x[k];
+        triangle.edge_c[k] =
+            -(triangle.edge_a[k] * x[k] + triangle.edge_b[k] * y[k]);
+      }
+      // 1 / w is linear in screen space
+      const float d1 = w[1] - w[0], d2 = w[2] - w[0];
+      triangle.depth_a = (d1 * (y[2] - y[0]) - d2 * (y[1] - y[0])) / area;
+      triangle.depth_b = (d2 * (x[1] - x[0]) - d1 * (x[2] - x[0])) / area;
+      triangle.depth_c =
+          w[0] - triangle.depth_a * x[0] - triangle.depth_b * y[0];
+      const uint32_t index = static_cast<uint32_t>(this->_triangles.size());
+      for (int band = triangle.min_y / OCCLUSION_TILE;
+           band <= (triangle.max_y - 1) / OCCLUSION_TILE; band++)
+        this->_bins[static_cast<size_t>(band)].push_back(index);
+      this->_triangles.push_back(triangle);
+    }
+  }
+  this->_stats.triangles = this->_triangles.size();
+}
+
+void OcclusionCuller::rasterize_band(int band) {
+  const int band_min = band * OCCLUSION_TILE;
+  const int band_max = band_min + OCCLUSION_TILE;
+
+  for (uint32_t index : this->_bins[static_cast<size_t>(band)]) {
+    const Triangle &triangle = this->_triangles[index];
+    const int first_row = std::max(triangle.min_y, band_min);
+    const int last_row = std::min(triangle.max_y, band_max);
+    const int first_column = triangle.min_x & ~(RASTER_LANES - 1);
+
+    for (int row = first_row; row < last_row; row++) {
+      const float center_y = static_cast<float>(row) + 0.5f;
+      float *line = &this->_depth[static_cast<size_t>(row * OCCLUSION_WIDTH)];
+      float row_edge[3];
+      for (size_t k = 0; k < 3; k++)
+        row_edge[k] = triangle.edge_b[k] * center_y + triangle.edge_c[k];
+      const float row_depth = triangle.depth_b * center_y + triangle.depth_c;
+
+#if defined(__AVX2__)
+      const __m256 offsets =
+          _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+      const __m256 zero = _mm256_setzero_ps();
+      const __m256 a0 = _mm256_set1_ps(triangle.edge_a[0]);
+      const __m256 a1 = _mm256_set1_ps(triangle.edge_a[1]);
+      const __m256 a2 = _mm256_set1_ps(triangle.edge_a[2]);
+      const __m256 c0 = _mm256_set1_ps(row_edge[0]);
+      const __m256 c1 = _mm256_set1_ps(row_edge[1]);
+      const __m256 c2 = _mm256_set1_ps(row_edge[2]);
+      const __m256 depth_a = _mm256_set1_ps(triangle.depth_a);
+      const __m256 depth_c = _mm256_set1_ps(row_depth);
+      for (int column = first_column; column < triangle.max_x; column += 8) {
+        const __m256 center_x =
+            _mm256_add_ps(_mm256_set1_ps(static_cast<float>(column)), offsets);
+        __m256 inside = _mm256_cmp_ps(
+            _mm256_add_ps(_mm256_mul_ps(a0, center_x), c0), zero, _CMP_GE_OQ);
+        inside = _mm256_and_ps(
+            inside,
+            _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(a1, center_x), c1),
+                          zero, _CMP_GE_OQ));
+        inside = _mm256_and_ps(
+            inside,
+            _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(a2, center_x), c2),
+                          zero, _CMP_GE_OQ));
+        if (_mm256_movemask_ps(inside) == 0)
+          continue;
+
+        const __m256 depth =
+            _mm256_add_ps(_mm256_mul_ps(depth_a, center_x), depth_c);
+        const __m256 stored = _mm256_loadu_ps(line + column);
+        _mm256_storeu_ps(line + column,
+                         _mm256_blendv_ps(stored,
+                                          _mm256_max_ps(stored, depth),
+                                          inside));
+      }
+#elif defined(__SSE2__)
+      const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+      const __m128 zero = _mm_setzero_ps();
+      const __m128 a0 = _mm_set1_ps(triangle.edge_a[0]);
+      const __m128 a1 = _mm_set1_ps(triangle.edge_a[1]);
+      const __m128 a2 = _mm_set1_ps(triangle.edge_a[2]);
+      const __m128 c0 = _mm_set1_ps(row_edge[0]);
+      const __m128 c1 = _mm_set1_ps(row_edge[1]);
+      const __m128 c2 = _mm_set1_ps(row_edge[2]);
+      const __m128 depth_a = _mm_set1_ps(triangle.depth_a);
+      const __m128 depth_c = _mm_set1_ps(row_depth);
+      for (int column = first_column; column < triangle.max_x; column += 4) {
+        const __m128 center_x =
+            _mm_add_ps(_mm_set1_ps(static_cast<float>(column)), offsets);
+        __m128 inside =
+            _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, center_x), c0), zero);
+        inside = _mm_and_ps(
+            inside,
+            _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, center_x), c1), zero));
+        inside = _mm_and_ps(
+            inside,
+            _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, center_x), c2), zero));
+        if (_mm_movemask_ps(inside) == 0)
+          continue;
+
+        const __m128 depth =
+            _mm_add_ps(_mm_mul_ps(depth_a, center_x), depth_c);
+        const __m128 stored = _mm_loadu_ps(line + column);
+        const __m128 nearest = _mm_max_ps(stored, depth);
+        _mm_storeu_ps(line + column,
+                      _mm_or_ps(_mm_and_ps(inside, nearest),
+                                _mm_andnot_ps(inside, stored)));
+      }
+#else
+      for (int column = first_column; column < triangle.max_x; column++) {
+        const float center_x = static_cast<float>(column) + 0.5f;
+        if (triangle.edge_a[0] * center_x + row_edge[0] < 0.0f ||
+            triangle.edge_a[1] * center_x + row_edge[1] < 0.0f ||
+            triangle.edge_a[2] * center_x + row_edge[2] < 0.0f)
+          continue;
+        line[column] =
+            std::max(line[column], triangle.depth_a * center_x + row_depth);
+      }
+#endif
+    }
+  }
+
+  // farthest of each tile for the early outs of is_occluded()
+  for (int tile = 0; tile < TILES_X; tile++) {
+    float farthest = std::numeric_limits<float>::max();
+    for (int row = band_min; row < band_max; row++) {
+      const float *line =
+          &this->_depth[static_cast<size_t>(row * OCCLUSION_WIDTH +
+                                            tile * OCCLUSION_TILE)];
+      for (int column = 0; column < OCCLUSION_TILE; column++)
+        farthest = std::min(farthest, line[column]);
+    }
+    this->_tiles[static_cast<size_t>(band * TILES_X + tile)] = farthest;
+  }
+}
+
+void OcclusionCuller::rasterize() {
+  auto start = std::chrono::high_resolution_clock::now();
+  this->setup_triangles();
+
+  if (!this->_triangles.empty()) {
+    // Workers and caller pull bands until none is left. The caller never
+    // waits on a band nobody started, so a pool busy with imports only
+    // means the caller does more of them. A worker starting after the
+    // frame finds the counter exhausted and never touches this.
+    struct Bands {
+      std::atomic<int> next{0};
+      std::atomic<int> done{0};
+    };
+    auto bands = std::make_shared<Bands>();
+    auto work = [this, bands]() {
+      for (int band = bands->next++; band < TILES_Y; band = bands->next++) {
+        this->rasterize_band(band);
+        bands->done++;
+      }
+    };
+
+    ThreadPool &pool = ThreadPool::global();
+    const size_t helpers = std::min(pool.worker_count(),
+                                    static_cast<size_t>(TILES_Y - 1));
+    for (size_t i = 0; i < helpers; i++)
+      pool.submit(work);
+    work();
+    while (bands->done < TILES_Y)
+      std::this_thread::yield();
+  }
+
+  auto end = std::chrono::high_resolution_clock::now();
+  this->_stats.raster_ms =
+      std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+bool OcclusionCuller::is_occluded(const BoundingBox &box,
+                                  const glm::mat4 &model) {
+  this->_stats.tested++;
+  if (this->_triangles.empty())
+    return false;
+
+  const glm::mat4 clip_matrix = this->_view_projection * model;
+  const float width = static_cast<float>(OCCLUSION_WIDTH);
+  const float height = static_cast<float>(OCCLUSION_HEIGHT);
+  glm::vec2 min(width, height), max(0.0f);
+  float nearest = 0.0f;
+  for (int corner = 0; corner < 8; corner++) {
+    const glm::vec4 position(corner & 1 ? box.max.x : box.min.x,
+                             corner & 2 ? box.max.y : box.min.y,
+                             corner & 4 ? box.max.z : box.min.z, 1.0f);
+    const glm::vec4 clip = clip_matrix * position;
+    if (clip.w <= 0.0f || clip.z < -clip.w)
+      return false;
+
+    const float w = 1.0f / clip.w;
+    const glm::vec2 screen((clip.x * w * 0.5f + 0.5f) * width,
+                           (clip.y * w * 0.5f + 0.5f) * height);
+    min = glm::min(min, screen);
+    max = glm::max(max, screen);
+    nearest = std::max(nearest, w);
+  }
+
+  // every pixel the box touches, even partly
+  const int min_x =
+      static_cast<int>(std::clamp(std::floor(min.x), 0.0f, width));
+  const int max_x =
+      static_cast<int>(std::clamp(std::ceil(max.x), 0.0f, width));
+  const int min_y =
+      static_cast<int>(std::clamp(std::floor(min.y), 0.0f, height));
+  const int max_y =
+      static_cast<int>(std::clamp(std::ceil(max.y), 0.0f, height));
+  // off screen is for the frustum test to say
+  if (min_x >= max_x || min_y >= max_y)
+    return false;
+
+  const float limit = nearest * OCCLUSION_DEPTH_BIAS;
+  for (int tile_y = min_y / OCCLUSION_TILE;
+       tile_y <= (max_y - 1) / OCCLUSION_TILE; tile_y++) {
+    for (int tile_x = min_x / OCCLUSION_TILE;
+         tile_x <= (max_x - 1) / OCCLUSION_TILE; tile_x++) {
+      if (this->_tiles[static_cast<size_t>(tile_y * TILES_X + tile_x)] > limit)
+        continue;
+
+      // the tile has something behind the box, maybe outside of it
+      const int row_end = std::min(max_y, (tile_y + 1) * OCCLUSION_TILE);
+      const int column_end = std::min(max_x, (tile_x + 1) * OCCLUSION_TILE);
+      for (int row = std::max(min_y, tile_y * OCCLUSION_TILE); row < row_end;
+           row++) {
+        const float *line =
+            &this->_depth[static_cast<size_t>(row * OCCLUSION_WIDTH)];
+        for (int column = std::max(min_x, tile_x * OCCLUSION_TILE);
+             column < column_end; column++)
+          if (line[column] <= limit)
+            return false;
+      }
+    }
+  }
+
+  this->_stats.occluded++;
+  return true;
+}
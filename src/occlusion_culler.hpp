@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mesh.hpp"
+
+constexpr int OCCLUSION_WIDTH = 320;
+constexpr int OCCLUSION_HEIGHT = 192;
+constexpr int OCCLUSION_TILE = 8;
+// a box has to be this much further than the occluders, relative to its
+// depth, to be hidden. Absorbs the interpolation error of coplanar surfaces.
+constexpr float OCCLUSION_DEPTH_BIAS = 1.001f;
+
+// Occluder geometry of one mesh, model space (position decode applied)
+struct Occluder {
+  std::vector<glm::vec3> positions;
+  std::vector<uint32_t> indices;
+
+  bool empty() const { return this->indices.empty(); }
+};
+
+// Finest level of detail with at most max_triangles, the coarsest one when
+// none is small enough. Only the vertices it references are kept, moved
+// inward so every triangle recedes by the level error and the occluder never
+// covers more than the mesh.
+Occluder make_occluder(const MeshView &view, const std::vector<MeshLod> &lods,
+                       const glm::mat4 &position_decode, size_t max_triangles);
+
+struct OcclusionStats {
+  // transform, setup and rasterization of every occluder
+  double raster_ms = 0.0;
+  // front facing and in front of the near plane, the ones drawn
+  size_t triangles = 0;
+  size_t tested = 0;
+  size_t occluded = 0;
+};
+
+// Software depth buffer for occlusion culling, no GPU round trip so it
+// behaves the same on every driver. Occluders are rasterized at low
+// resolution keeping the nearest 1 / w per pixel, each 8x8 tile also keeps
+// its farthest one so most box tests stop at the tile level.
+// Rows are split in bands of one tile, shared between the caller and the
+// thread pool. Edge functions are evaluated 8 pixels at a time with AVX2
+// (ENGINE_AVX2), 4 with SSE2 otherwise.
+// Triangles crossing the near plane are skipped and boxes crossing it are
+// visible, both sides stay conservative.
+class OcclusionCuller {
+public:
+  OcclusionCuller();
+
+  // Clears the buffer and the queued occluders, once per frame
+  void begin(const glm::mat4 &view_projection);
+  // Queued until rasterize(), occluder has to outlive it
+  void add_occluder(const Occluder &occluder, const glm::mat4 &model);
+  void rasterize();
+
+  // true when box, in the space of model, is behind the rasterized occluders
+  bool is_occluded(const BoundingBox &box, const glm::mat4 &model);
+
+  const OcclusionStats &stats() const { return this->_stats; }
+  // 1 / w of every pixel, bottom row first, 0 where nothing was drawn
+  const std::vector<float> &depth() const { return this->_depth; }
+
+private:
+  // Screen space edge functions and 1 / w plane, e = a * x + b * y + c
+  struct Triangle {
+    float edge_a[3], edge_b[3], edge_c[3];
+    float depth_a, depth_b, depth_c;
+    int min_x, max_x, min_y, max_y;
+  };
+  struct Queued {
+    const Occluder *occluder;
+    glm::mat4 model;
+  };
+
+  glm::mat4 _view_projection{1.0f};
+  std::vector<Queued> _queued;
+  std::vector<Triangle> _triangles;
+  // triangles overlapping each band
+  std::vector<std::vector<uint32_t>> _bins;
+  // scratch of rasterize(), clip space vertices of one occluder
+  std::vector<glm::vec4> _clip;
+  std::vector<float> _depth;
+  // farthest 1 / w of each tile
+  std::vector<float> _tiles;
+  OcclusionStats _stats;
+
+  void setup_triangles();
+  void rasterize_band(int band);
+};
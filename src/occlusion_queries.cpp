@@ -0,0 +1,121 @@
+#include "occlusion_queries.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+QueryPool::~QueryPool() {
+  if (!this->_queries.empty())
+    glDeleteQueries(static_cast<GLsizei>(this->_queries.size()),
+                    this->_queries.data());
+}
+
+GLuint QueryPool::acquire() {
+  if (this->_free.empty()) {
+    const size_t first = this->_queries.size();
+    this->_queries.resize(first + QUERY_POOL_BATCH);
+    glGenQueries(static_cast<GLsizei>(QUERY_POOL_BATCH),
+                 this->_queries.data() + first);
+    this->_free.assign(this->_queries.begin() +
+                           static_cast<std::ptrdiff_t>(first),
+                       this->_queries.end());
+  }
+
+  const GLuint query = this->_free.back();
+  this->_free.pop_back();
+  return query;
+}
+
+void QueryPool::release(GLuint query) { this->_free.push_back(query); }
+
+bool QueryPool::poll(GLuint query, bool &passed) {
+  GLuint available = 0;
+  glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+  if (!available)
+    return false;
+
+  GLuint result = 0;
+  glGetQueryObjectuiv(query, GL_QUERY_RESULT, &result);
+  passed = result != 0;
+  return true;
+}
+
+OcclusionQueries::~OcclusionQueries() {
+  if (this->VAO) {
+    glDeleteVertexArrays(1, &this->VAO);
+    glDeleteBuffers(1, &this->VBO);
+    glDeleteBuffers(1, &this->EBO);
+  }
+}
+
+void OcclusionQueries::init() {
+  if (this->is_init())
+    return;
+
+  this->_box_program.add_shader<VertexShader>(
+      "../src/shaders/occlusion_box.vert.glsl");
+  this->_box_program.add_shader<FragmentShader>(
+      "../src/shaders/depth_only.frag.glsl");
+  this->_box_program.link();
+  this->_depth_program.add_shader<VertexShader>(
+      "../src/shaders/model_vertex.glsl");
+  this->_depth_program.add_shader<FragmentShader>(
+      "../src/shaders/depth_only.frag.glsl");
+  this->_depth_program.link();
+
+  // unit cube, corner i has x = i & 1, y = i & 2, z = i & 4
+  float corners[8 * 3];
+  for (unsigned int i = 0; i < 8; i++) {
+    corners[i * 3 + 0] = (i & 1) ? 1.0f : 0.0f;
+    corners[i * 3 + 1] = (i & 2) ? 1.0f : 0.0f;
+    corners[i * 3 + 2] = (i & 4) ? 1.0f : 0.0f;
+  }
+  // faces are not culled, winding does not matter
+  const uint8_t faces[36] = {0, 1, 3, 0, 3, 2, 4, 6, 7, 4, 7, 5,
+                             0, 4, 5, 0, 5, 1, 2, 3, 7, 2, 7, 6,
+                             0, 2, 6, 0, 6, 4, 1, 5, 7, 1, 7, 3};
+
+  glGenVertexArrays(1, &this->VAO);
+  glGenBuffers(1, &this->VBO);
+  glGenBuffers(1, &this->EBO);
+
+  glBindVertexArray(this->VAO);
+  glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(faces), faces, GL_STATIC_DRAW);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float),
+                        nullptr);
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void OcclusionQueries::begin() {
+  this->_box_program.use();
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  glDepthMask(GL_FALSE);
+  glStencilMask(0x00);
+  glBindVertexArray(this->VAO);
+}
+
+GLuint OcclusionQueries::query_box(const BoundingBox &box,
+                                   const glm::mat4 &model) {
+  // flat boxes keep a zero scale, their two large faces still rasterize
+  const glm::mat4 unit_to_box =
+      glm::scale(glm::translate(glm::mat4(1.0f), box.min), box.max - box.min);
+  this->_box_program.set_uniform("box", model * unit_to_box);
+
+  const GLuint query = this->_pool.acquire();
+  glBeginQuery(GL_ANY_SAMPLES_PASSED, query);
+  glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, nullptr);
+  glEndQuery(GL_ANY_SAMPLES_PASSED);
+  return query;
+}
+
+void OcclusionQueries::end() {
+  glBindVertexArray(0);
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  glDepthMask(GL_TRUE);
+  glStencilMask(0xFF);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "glad/glad.h"
+#include "mesh.hpp"
+#include "shader.hpp"
+#include <glm/glm.hpp>
+
+// queries created at once when the pool runs dry
+constexpr size_t QUERY_POOL_BATCH = 64;
+
+// Query objects recycled instead of created and deleted every frame.
+// GL thread only.
+class QueryPool {
+public:
+  QueryPool() = default;
+  QueryPool(const QueryPool &) = delete;
+  QueryPool &operator=(const QueryPool &) = delete;
+  ~QueryPool();
+
+  GLuint acquire();
+  // only once its result was read, or it will never be
+  void release(GLuint query);
+  // false while the GPU has not answered yet, never waits for it
+  static bool poll(GLuint query, bool &passed);
+
+  // every query created, free or not
+  size_t size() const { return this->_queries.size(); }
+  size_t in_use() const { return this->_queries.size() - this->_free.size(); }
+
+private:
+  std::vector<GLuint> _queries;
+  std::vector<GLuint> _free;
+};
+
+// Bounding boxes drawn under GL_ANY_SAMPLES_PASSED queries, color, depth and
+// stencil writes off, against the depth already in the framebuffer. Also
+// holds the depth only program of the pre-pass that fills it.
+// GL thread only.
+class OcclusionQueries {
+public:
+  OcclusionQueries() = default;
+  OcclusionQueries(const OcclusionQueries &) = delete;
+  OcclusionQueries &operator=(const OcclusionQueries &) = delete;
+  ~OcclusionQueries();
+
+  // Programs and cube, once before the first begin()
+  void init();
+  bool is_init() const { return this->VAO != 0; }
+
+  // Binds the cube and the box program, restored by end(). The camera is
+  // the one of the Frame block.
+  void begin();
+  // box is in the space of model, the result goes to the returned query
+  GLuint query_box(const BoundingBox &box, const glm::mat4 &model);
+  void end();
+
+  QueryPool &pool() { return this->_pool; }
+  // model_vertex.glsl writing depth only, same inputs as the lit program
+  const Shader &depth_program() const { return this->_depth_program; }
+
+private:
+  QueryPool _pool;
+  Shader _box_program;
+  Shader _depth_program;
+  unsigned int VAO = 0, VBO = 0, EBO = 0;
+};
@@ -0,0 +1,96 @@
+#include "pixel_uploader.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+PixelUploader &PixelUploader::global() {
+  static PixelUploader uploader;
+  return uploader;
+}
+
+void PixelUploader::deinit() {
+  for (Slot &slot : this->_slots) {
+    if (slot.fence)
+      glDeleteSync(slot.fence);
+    glDeleteBuffers(1, &slot.pbo);
+  }
+  this->_slots.clear();
+  this->_current = nullptr;
+}
+
+// timeout of 0: only polls, never stalls the frame
+bool PixelUploader::is_free(const Slot &slot) const {
+  if (!slot.fence)
+    return true;
+  const GLenum status = glClientWaitSync(slot.fence, 0, 0);
+  return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+}
+
+// Only looks, the buffer is created by acquire() once something is staged
+bool PixelUploader::has_free_buffer() const {
+  if (this->_slots.size() < this->_max_buffers)
+    return true;
+  for (const Slot &slot : this->_slots)
+    if (this->is_free(slot))
+      return true;
+  return false;
+}
+
+PixelUploader::Slot *PixelUploader::acquire() {
+  for (Slot &slot : this->_slots) {
+    if (!this->is_free(slot))
+      continue;
+    if (slot.fence) {
+      glDeleteSync(slot.fence);
+      slot.fence = nullptr;
+    }
+    return &slot;
+  }
+
+  if (this->_slots.size() >= this->_max_buffers)
+    return nullptr;
+
+  this->_slots.emplace_back();
+  glGenBuffers(1, &this->_slots.back().pbo);
+  return &this->_slots.back();
+}
+
+void PixelUploader::stage(const void *data, size_t size) {
+  Slot *slot = this->acquire();
+  if (!slot)
+    throw std::runtime_error(
+        "Erreur: aucun pixel buffer libre pour l'upload de texture");
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->pbo);
+  if (slot->capacity < size) {
+    // only grows, big textures keep their buffer for the next ones
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(size),
+                 nullptr, GL_STREAM_DRAW);
+    slot->capacity = size;
+  }
+
+  // The fence guarantees the GPU is done with the previous content, no need
+  // for the driver to synchronize
+  void *mapped = glMapBufferRange(
+      GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(size),
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT |
+          GL_MAP_UNSYNCHRONIZED_BIT);
+  if (mapped) {
+    std::memcpy(mapped, data, size);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+  } else {
+    glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(size),
+                    data);
+  }
+
+  this->_current = slot;
+}
+
+void PixelUploader::finish() {
+  if (!this->_current)
+    return;
+
+  this->_current->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  this->_current = nullptr;
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
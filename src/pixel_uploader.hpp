@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "glad/glad.h"
+
+// Pool of pixel unpack buffers reused across texture uploads. A buffer is
+// recycled once the fence placed after its transfer is signaled, so the copy
+// into it never waits on the GPU and glTexImage2D returns right away.
+// GL thread only.
+class PixelUploader {
+public:
+  explicit PixelUploader(size_t max_buffers = 4)
+      : _max_buffers(max_buffers) {}
+  PixelUploader(const PixelUploader &) = delete;
+  PixelUploader &operator=(const PixelUploader &) = delete;
+  // GL objects are only released by deinit(), the context may be gone here
+  ~PixelUploader() = default;
+
+  static PixelUploader &global();
+  void deinit();
+
+  // false while every buffer is still in flight, changes nothing
+  bool has_free_buffer() const;
+  // Copies size bytes at offset 0 of a free buffer left bound to
+  // GL_PIXEL_UNPACK_BUFFER, texture calls then take offsets instead of
+  // pointers. has_free_buffer() must be true.
+  void stage(const void *data, size_t size);
+  // Fences the transfers issued since stage() and unbinds the buffer
+  void finish();
+
+private:
+  struct Slot {
+    GLuint pbo = 0;
+    size_t capacity = 0;
+    GLsync fence = nullptr;
+  };
+
+  size_t _max_buffers;
+  std::vector<Slot> _slots;
+  Slot *_current = nullptr;
+
+  bool is_free(const Slot &slot) const;
+  // a free buffer, created if the pool can still grow
+  Slot *acquire();
+};
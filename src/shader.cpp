@@ -1,5 +1,8 @@
 #include "shader.hpp"
 
+#include <algorithm>
+#include <utility>
+
 void Shader::deinit() {
   delete_shaders();
   glDeleteProgram(this->id);
@@ -7,6 +10,12 @@ void Shader::deinit() {
 
 void Shader::delete_shaders() { this->shader_ids.clear(); }
 
+// GL 3.3 has no layout(binding) for them, done here once instead
+static const std::pair<const char *, unsigned int> UNIFORM_BLOCK_BINDINGS[] = {
+    {"Frame", FRAME_BINDING},
+    {"Lights", LIGHTS_BINDING},
+};
+
 void Shader::link() {
   auto success = 0;
   glLinkProgram(this->id);
@@ -19,7 +28,104 @@ void Shader::link() {
               << "-> " << info_log << std::endl;
   }
 
+  for (const auto &[block, binding] : UNIFORM_BLOCK_BINDINGS) {
+    const GLuint index = glGetUniformBlockIndex(this->id, block);
+    if (index != GL_INVALID_INDEX)
+      glUniformBlockBinding(this->id, index, binding);
+  }
+  this->reflect_uniforms();
+
   delete_shaders();
 }
 
 void Shader::use() const { glUseProgram(this->id); }
+
+void Shader::reflect_uniforms() {
+  this->_uniforms.clear();
+  this->_uniform_count = 0;
+
+  GLint count = 0, max_length = 0;
+  glGetProgramiv(this->id, GL_ACTIVE_UNIFORMS, &count);
+  glGetProgramiv(this->id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+  std::vector<char> buffer(static_cast<size_t>(std::max(max_length, 1)));
+  for (GLint i = 0; i < count; i++) {
+    GLsizei length = 0;
+    GLint size = 0;
+    GLenum type = 0;
+    glGetActiveUniform(this->id, static_cast<GLuint>(i),
+                       static_cast<GLsizei>(buffer.size()), &length, &size,
+                       &type, buffer.data());
+    const std::string name(buffer.data(), static_cast<size_t>(length));
+    // members of uniform blocks have no location
+    const int location = glGetUniformLocation(this->id, name.c_str());
+    if (location == -1)
+      continue;
+    this->insert_uniform(uniform_hash(name), name, location);
+
+    // arrays of basic types only list their first element, "a[0]", the
+    // array name and the other elements resolve too
+    const std::string_view suffix = "[0]";
+    if (name.size() > suffix.size() &&
+        name.compare(name.size() - suffix.size(), suffix.size(), suffix) ==
+            0) {
+      const std::string base = name.substr(0, name.size() - suffix.size());
+      this->insert_uniform(uniform_hash(base), base, location);
+      for (GLint element = 1; element < size; element++) {
+        const std::string element_name =
+            base + "[" + std::to_string(element) + "]";
+        this->insert_uniform(
+            uniform_hash(element_name), element_name,
+            glGetUniformLocation(this->id, element_name.c_str()));
+      }
+    }
+  }
+}
+
+void Shader::insert_uniform(uint32_t hash, std::string_view name,
+                            int location) const {
+  // kept under half full, probes stay short
+  if ((this->_uniform_count + 1) * 2 > this->_uniforms.size()) {
+    std::vector<UniformSlot> old = std::move(this->_uniforms);
+    this->_uniforms.assign(std::max<size_t>(16, old.size() * 2),
+                           UniformSlot{});
+    this->_uniform_count = 0;
+    for (UniformSlot &slot : old)
+      if (!slot.name.empty())
+        this->insert_uniform(slot.hash, slot.name, slot.location);
+  }
+
+  const size_t mask = this->_uniforms.size() - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    UniformSlot &slot = this->_uniforms[i];
+    if (slot.name.empty()) {
+      slot = UniformSlot{hash, location, std::string(name)};
+      this->_uniform_count++;
+      return;
+    }
+    if (slot.hash == hash && slot.name == name)
+      return;
+  }
+}
+
+int Shader::find_uniform(uint32_t hash, std::string_view name) const {
+  if (!this->_uniforms.empty()) {
+    const size_t mask = this->_uniforms.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      const UniformSlot &slot = this->_uniforms[i];
+      if (slot.name.empty())
+        break;
+      if (slot.hash == hash && slot.name == name)
+        return slot.location;
+    }
+  }
+
+  // optimized out or misspelled, said once instead of every frame
+  std::cerr << "Erreur: Impossible de trouver l'uniform " << name << "\n";
+  this->insert_uniform(hash, name, -1);
+  return -1;
+}
+
+UniformLocation Shader::uniform(std::string_view uniform_name) const {
+  return UniformLocation{
+      this->find_uniform(uniform_hash(uniform_name), uniform_name)};
+}
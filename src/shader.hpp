@@ -1,18 +1,51 @@
 #pragma once
 
 #include "glad/glad.h"
-#include <cstdio>
+#include <cstdint>
+#include <cstring>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <array>
 #include <fstream>
 #include <iostream>
 #include <stdexcept>
+#include <string>
 #include <string_view>
 #include <vector>
 
-#include "light.hpp"
+#include "uniform_reflection.hpp"
+
+// Binding points of the uniform blocks shared between programs, link()
+// points a block there when the program declares it
+constexpr unsigned int FRAME_BINDING = 0;
+constexpr unsigned int LIGHTS_BINDING = 1;
+
+// FNV-1a of a uniform name, folded at compile time for literals
+constexpr uint32_t uniform_hash(std::string_view name) {
+  uint32_t hash = 2166136261u;
+  for (char c : name) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// Resolved once with Shader::uniform(), -1 when the program has no such
+// active uniform and setting it does nothing
+struct UniformLocation {
+  int location = -1;
+
+  bool is_valid() const { return this->location != -1; }
+};
+
+// Resolved with Shader::uniform_struct(), one location per reflected field
+// and per array element
+template <typename T> struct UniformStruct {
+  std::vector<std::array<UniformLocation, reflected_field_count<T>>> elements;
+};
 
 struct VertexShader {};
 struct FragmentShader {};
@@ -30,19 +63,55 @@ public:
   template <typename T>
   void set_uniform(const char *uniform_name, const T &value) const;
   template <typename T>
-  void set_uniform_struct(std::string_view uniform_struct_name,
-                          const T &value) const;
+  void set_uniform(UniformLocation uniform, const T &value) const;
+  // For uniforms set in a loop, no lookup left in it
+  UniformLocation uniform(std::string_view uniform_name) const;
+  // Locations of every field of a reflected struct, or of each element of
+  // an array of them when count isn't 0. Resolve once per program.
+  template <typename T>
+  UniformStruct<T> uniform_struct(std::string_view uniform_struct_name,
+                                  size_t count = 0) const;
+  // The first count elements, extra values are ignored
+  template <typename T>
+  void set_uniform_struct(const UniformStruct<T> &uniform_struct,
+                          const T *values, size_t count) const;
+  template <typename T>
+  void set_uniform_struct(const UniformStruct<T> &uniform_struct,
+                          const T &value) const {
+    this->set_uniform_struct(uniform_struct, &value, 1);
+  }
   void link();
   void use() const;
   void delete_shaders();
 
 private:
+  // Open addressing table of the active uniforms, filled by link(). Names
+  // missing from the program get a -1 slot the first time they are asked
+  // for so they are only reported once.
+  struct UniformSlot {
+    uint32_t hash = 0;
+    int location = -1;
+    // empty for a free slot
+    std::string name;
+  };
+
   unsigned int id;
   std::vector<unsigned int> shader_ids;
+  mutable std::vector<UniformSlot> _uniforms;
+  mutable size_t _uniform_count = 0;
+
+  void reflect_uniforms();
+  int find_uniform(uint32_t hash, std::string_view name) const;
+  void insert_uniform(uint32_t hash, std::string_view name,
+                      int location) const;
 
   template <typename ShaderType> unsigned int add_shader_impl() const;
   template <typename T>
   void set_uniform_impl(const int uniform_location, const T &value) const;
+  template <typename F>
+  void set_uniform_field(UniformLocation uniform,
+                         const ReflectedField<F> &field,
+                         const char *value) const;
 };
 
 template <typename ShaderType> void Shader::add_shader(const char *file_path) {
@@ -92,16 +161,20 @@ template <> inline unsigned int Shader::add_shader_impl<VertexShader>() const {
 
 template <typename T>
 void Shader::set_uniform(const char *uniform_name, const T &value) const {
-  const auto uniform_location = glGetUniformLocation(this->id, uniform_name);
-  if (uniform_location == -1) {
-    std::cerr << "Erreur: Impossible de trouver l'uniform " << uniform_name
-              << "\n";
+  const std::string_view name(uniform_name);
+  const int uniform_location = this->find_uniform(uniform_hash(name), name);
+  if (uniform_location == -1)
     return;
-  }
 
   set_uniform_impl(uniform_location, value);
 }
 
+template <typename T>
+void Shader::set_uniform(UniformLocation uniform, const T &value) const {
+  if (uniform.is_valid())
+    set_uniform_impl(uniform.location, value);
+}
+
 template <>
 inline void Shader::set_uniform_impl<int>(const int location,
                                           const int &value) const {
@@ -127,93 +200,83 @@ inline void Shader::set_uniform_impl<double>(const int location,
 }
 
 template <>
-inline void Shader::set_uniform_impl<glm::vec3>(const int location,
-                                                const glm::vec3 &value) const {
-  glUniform3fv(location, 1, &value[0]);
+inline void Shader::set_uniform_impl<glm::vec2>(const int location,
+                                                const glm::vec2 &value) const {
+  glUniform2fv(location, 1, &value[0]);
 }
 
 template <>
-inline void Shader::set_uniform_impl<glm::mat4>(const int location,
-                                                const glm::mat4 &value) const {
-  glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]);
+inline void Shader::set_uniform_impl<glm::vec3>(const int location,
+                                                const glm::vec3 &value) const {
+  glUniform3fv(location, 1, &value[0]);
 }
 
 template <>
-inline void
-Shader::set_uniform_struct<LightInfo>(std::string_view uniform_struct_name,
-                                      const LightInfo &value) const {
-  char buffer[64];
-  int name_len = static_cast<int>(uniform_struct_name.length());
-  const char *name_ptr = uniform_struct_name.data();
-
-  snprintf(buffer, sizeof(buffer), "%.*s.ambient", name_len, name_ptr);
-  this->set_uniform(buffer, value.ambient);
-
-  snprintf(buffer, sizeof(buffer), "%.*s.specular", name_len, name_ptr);
-  this->set_uniform(buffer, value.specular);
-
-  snprintf(buffer, sizeof(buffer), "%.*s.diffuse", name_len, name_ptr);
-  this->set_uniform(buffer, value.diffuse);
+inline void Shader::set_uniform_impl<glm::mat3>(const int location,
+                                                const glm::mat3 &value) const {
+  glUniformMatrix3fv(location, 1, GL_FALSE, &value[0][0]);
 }
 
 template <>
-inline void Shader::set_uniform_struct<AttenuationInfo>(
-    std::string_view uniform_struct_name, const AttenuationInfo &value) const {
-  char buffer[64];
-  int name_len = static_cast<int>(uniform_struct_name.length());
-  const char *name_ptr = uniform_struct_name.data();
-
-  snprintf(buffer, sizeof(buffer), "%.*s.constant", name_len, name_ptr);
-  this->set_uniform(buffer, value.constant);
-
-  snprintf(buffer, sizeof(buffer), "%.*s.linear", name_len, name_ptr);
-  this->set_uniform(buffer, value.linear);
-
-  snprintf(buffer, sizeof(buffer), "%.*s.quadratic", name_len, name_ptr);
-  this->set_uniform(buffer, value.quadratic);
+inline void Shader::set_uniform_impl<glm::mat4>(const int location,
+                                                const glm::mat4 &value) const {
+  glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]);
 }
 
-template <>
-inline void
-Shader::set_uniform_struct<PointLight>(std::string_view uniform_struct_name,
-                                       const PointLight &value) const {
-  std::string uniform_struct_name_s(uniform_struct_name);
-  this->set_uniform((uniform_struct_name_s + ".position").c_str(),
-                    value.position);
-
-  this->set_uniform((uniform_struct_name_s + ".linear").c_str(),
-                    value.attenuation_info.linear);
-  this->set_uniform((uniform_struct_name_s + ".quadratic").c_str(),
-                    value.attenuation_info.quadratic);
-  this->set_uniform((uniform_struct_name_s + ".constant").c_str(),
-                    value.attenuation_info.constant);
-
-  this->set_uniform_struct(uniform_struct_name_s, value.info);
-  this->set_uniform_struct(uniform_struct_name_s, value.attenuation_info);
+template <typename T>
+UniformStruct<T> Shader::uniform_struct(std::string_view uniform_struct_name,
+                                        size_t count) const {
+  constexpr auto fields = reflected_fields<T>();
+  UniformStruct<T> uniform_struct;
+  uniform_struct.elements.resize(std::max<size_t>(count, 1));
+
+  // only place the names are built, the uploads go through the locations
+  std::string name;
+  for (size_t i = 0; i < uniform_struct.elements.size(); i++) {
+    name.assign(uniform_struct_name);
+    if (count != 0)
+      name += "[" + std::to_string(i) + "]";
+    name += '.';
+    const size_t prefix_length = name.size();
+
+    auto &locations = uniform_struct.elements[i];
+    std::apply(
+        [&](const auto &...field) {
+          size_t k = 0;
+          ((name.resize(prefix_length), name += field.name,
+            locations[k++] = this->uniform(name)),
+           ...);
+        },
+        fields);
+  }
+  return uniform_struct;
 }
 
-template <>
-inline void
-Shader::set_uniform_struct<SpotLight>(std::string_view uniform_struct_name,
-                                      const SpotLight &value) const {
-  std::string uniform_struct_name_s(uniform_struct_name);
-  this->set_uniform((uniform_struct_name_s + ".position").c_str(),
-                    value.position);
-  this->set_uniform((uniform_struct_name_s + ".direction").c_str(),
-                    value.direction);
-  this->set_uniform((uniform_struct_name_s + ".inner_cut_off").c_str(),
-                    value.inner_cut_off);
-  this->set_uniform((uniform_struct_name_s + ".outer_cut_off").c_str(),
-                    value.outer_cut_off);
-  this->set_uniform_struct(uniform_struct_name_s, value.info);
-  this->set_uniform_struct(uniform_struct_name_s, value.attenuation_info);
+template <typename T>
+void Shader::set_uniform_struct(const UniformStruct<T> &uniform_struct,
+                                const T *values, size_t count) const {
+  constexpr auto fields = reflected_fields<T>();
+  count = std::min(count, uniform_struct.elements.size());
+
+  for (size_t i = 0; i < count; i++) {
+    const char *value = reinterpret_cast<const char *>(&values[i]);
+    const auto &locations = uniform_struct.elements[i];
+    std::apply(
+        [&](const auto &...field) {
+          size_t k = 0;
+          (this->set_uniform_field(locations[k++], field, value), ...);
+        },
+        fields);
+  }
 }
 
-template <>
-inline void Shader::set_uniform_struct<DirectionalLight>(
-    std::string_view uniform_struct_name, const DirectionalLight &value) const {
-  std::string uniform_struct_name_s(uniform_struct_name);
-  this->set_uniform((uniform_struct_name_s + ".direction").c_str(),
-                    value.direction);
-  this->set_uniform_struct(uniform_struct_name_s, value.info);
+template <typename F>
+void Shader::set_uniform_field(UniformLocation uniform,
+                               const ReflectedField<F> &field,
+                               const char *value) const {
+  if (!uniform.is_valid())
+    return;
+  F field_value;
+  std::memcpy(&field_value, value + field.offset, sizeof(F));
+  set_uniform_impl(uniform.location, field_value);
 }
@@ -0,0 +1,144 @@
+#version 330 core
+// Emission, directional and spot lights over the whole G-buffer, point
+// lights are added on top by deferred_point_light
+out vec4 FragColor; 
+
+in vec2 uv;
+
+// std140, see light_buffer.hpp
+struct PointLight {
+  vec3 position;
+  float constant;
+  vec3 ambient;
+  float linear;
+  vec3 diffuse;
+  float quadratic;
+  vec3 specular;
+};
+
+struct SpotLight {
+  vec3 position;
+  float constant;
+  vec3 direction;
+  float linear;
+  vec3 ambient;
+  float quadratic;
+  vec3 diffuse;
+  float inner_cut_off;
+  vec3 specular;
+  float outer_cut_off;
+};
+
+struct DirectionalLight {
+  vec3 direction;
+  vec3 ambient;
+  vec3 diffuse;
+  vec3 specular;
+};
+
+#define MAX_POINT_LIGHTS 128
+#define MAX_SPOT_LIGHTS 32
+#define MAX_DIRECTIONNAL_LIGHTS 4
+
+// shared by every lit program, see LightBuffer
+layout (std140) uniform Lights {
+  uint point_lights_count;
+  uint spot_lights_count;
+  uint directionnal_lights_count;
+  PointLight point_lights[MAX_POINT_LIGHTS];
+  SpotLight spot_lights[MAX_SPOT_LIGHTS];
+  DirectionalLight directionnal_lights[MAX_DIRECTIONNAL_LIGHTS];
+};
+
+// once per frame, see FrameConstants
+layout (std140) uniform Frame {
+  mat4 view;
+  mat4 projection;
+  mat4 view_projection;
+  vec3 camera_pos;
+  float near;
+  float far;
+  float time;
+};
+
+uniform sampler2D gbuffer_albedo_specular;
+uniform sampler2D gbuffer_normal;
+uniform sampler2D gbuffer_emission;
+uniform sampler2D gbuffer_depth;
+uniform mat4 inverse_view_projection;
+uniform float shininess;
+
+vec3 decode_normal(vec2 encoded)
+{
+  vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+  if (n.z < 0.0)
+    n.xy = (1.0 - abs(n.yx)) *
+           vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+  float len = length(n);
+  return len > 0.0 ? n / len : n;
+}
+
+vec3 world_position(vec2 coordinates, float depth)
+{
+  vec4 world = inverse_view_projection * vec4(vec3(coordinates, depth) * 2.0 - 1.0, 1.0);
+  return world.xyz / world.w;
+}
+
+// Phong, to_light normalized
+vec3 shade(vec3 position, vec3 normal, vec3 albedo, float specular, vec3 to_light,
+           vec3 light_diffuse, vec3 light_specular)
+{
+  vec3 view_dir = normalize(camera_pos - position);
+  vec3 reflect_dir = reflect(-to_light, normal);
+  float spec = pow(max(dot(view_dir, reflect_dir), 0.0), shininess);
+  float diffusion = max(dot(to_light, normal), 0.0);
+  return albedo * diffusion * light_diffuse + specular * spec * light_specular;
+}
+
+void main()
+{
+  float depth = texture(gbuffer_depth, uv).r;
+  if (depth >= 1.0) {
+    FragColor = vec4(0.0, 0.0, 0.0, 1.0);
+    return;
+  }
+
+  vec4 albedo_specular = texture(gbuffer_albedo_specular, uv);
+  vec3 albedo = albedo_specular.rgb;
+
+  // Lightning is deactivated, same as the forward shader
+  if (point_lights_count == 0u && spot_lights_count == 0u && directionnal_lights_count == 0u) {
+    FragColor = vec4(albedo, 1.0);
+    return;
+  }
+
+  vec3 normal = decode_normal(texture(gbuffer_normal, uv).xy);
+  vec3 position = world_position(uv, depth);
+  vec3 color = texture(gbuffer_emission, uv).rgb;
+
+  for (uint i = 0u; i < directionnal_lights_count; i++) {
+    DirectionalLight light = directionnal_lights[i];
+    color += albedo * light.ambient +
+              shade(position, normal, albedo, albedo_specular.a,
+                    normalize(-light.direction), light.diffuse, light.specular);
+  }
+
+  for (uint i = 0u; i < spot_lights_count; i++) {
+    SpotLight light = spot_lights[i];
+    vec3 to_light = light.position - position;
+    float dist = length(to_light);
+    to_light /= dist;
+
+    float theta = dot(to_light, normalize(-light.direction));
+    float epsilon = light.inner_cut_off - light.outer_cut_off;
+    float intensity = clamp((theta - light.outer_cut_off) / epsilon, 0.0, 1.0);
+    float attenuation = 1.0 / (light.constant + light.linear * dist + light.quadratic * dist * dist);
+
+    color += (albedo * light.ambient +
+               intensity * shade(position, normal, albedo, albedo_specular.a,
+                                 to_light, light.diffuse, light.specular)) *
+              attenuation;
+  }
+
+  FragColor = vec4(color, 1.0);
+}
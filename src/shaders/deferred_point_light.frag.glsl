@@ -0,0 +1,74 @@
+#version 330 core
+// One point light over the pixels its volume covers, blended additively
+out vec4 FragColor; 
+
+flat in vec4 position_radius;
+flat in vec3 ambient;
+flat in vec3 diffuse;
+flat in vec3 specular;
+// constant, linear, quadratic
+flat in vec3 attenuation;
+
+// once per frame, see FrameConstants
+layout (std140) uniform Frame {
+  mat4 view;
+  mat4 projection;
+  mat4 view_projection;
+  vec3 camera_pos;
+  float near;
+  float far;
+  float time;
+};
+
+uniform sampler2D gbuffer_albedo_specular;
+uniform sampler2D gbuffer_normal;
+uniform sampler2D gbuffer_depth;
+uniform mat4 inverse_view_projection;
+uniform float shininess;
+uniform vec2 screen_size;
+
+vec3 decode_normal(vec2 encoded)
+{
+  vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+  if (n.z < 0.0)
+    n.xy = (1.0 - abs(n.yx)) *
+           vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+  float len = length(n);
+  return len > 0.0 ? n / len : n;
+}
+
+vec3 world_position(vec2 coordinates, float depth)
+{
+  vec4 world = inverse_view_projection * vec4(vec3(coordinates, depth) * 2.0 - 1.0, 1.0);
+  return world.xyz / world.w;
+}
+
+void main()
+{
+  vec2 uv = gl_FragCoord.xy / screen_size;
+  float depth = texture(gbuffer_depth, uv).r;
+  if (depth >= 1.0)
+    discard;
+
+  vec3 position = world_position(uv, depth);
+  vec3 to_light = position_radius.xyz - position;
+  float dist = length(to_light);
+  // past the radius the light is under the cut off anyway
+  if (dist > position_radius.w)
+    discard;
+  to_light /= dist;
+
+  vec4 albedo_specular = texture(gbuffer_albedo_specular, uv);
+  vec3 albedo = albedo_specular.rgb;
+  vec3 normal = decode_normal(texture(gbuffer_normal, uv).xy);
+
+  vec3 view_dir = normalize(camera_pos - position);
+  vec3 reflect_dir = reflect(-to_light, normal);
+  float spec = pow(max(dot(view_dir, reflect_dir), 0.0), shininess);
+  float diffusion = max(dot(to_light, normal), 0.0);
+
+  float falloff = 1.0 / (attenuation.x + attenuation.y * dist + attenuation.z * dist * dist);
+  vec3 color = albedo * ambient + albedo * diffusion * diffuse +
+               albedo_specular.a * spec * specular;
+  FragColor = vec4(color * falloff, 1.0);
+}
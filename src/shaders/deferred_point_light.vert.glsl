@@ -0,0 +1,36 @@
+#version 330 core
+// unit sphere, scaled so its faces stay outside the real one
+layout (location = 0) in vec3 aPos;
+// one point light per instance, see DeferredRenderer::PointLightInstance
+layout (location = 1) in vec4 aPositionRadius;
+layout (location = 2) in vec3 aAmbient;
+layout (location = 3) in vec3 aDiffuse;
+layout (location = 4) in vec3 aSpecular;
+layout (location = 5) in vec3 aAttenuation;
+
+flat out vec4 position_radius;
+flat out vec3 ambient;
+flat out vec3 diffuse;
+flat out vec3 specular;
+flat out vec3 attenuation;
+
+// once per frame, see FrameConstants
+layout (std140) uniform Frame {
+  mat4 view;
+  mat4 projection;
+  mat4 view_projection;
+  vec3 camera_pos;
+  float near;
+  float far;
+  float time;
+};
+
+void main()
+{
+  gl_Position = view_projection * vec4(aPositionRadius.xyz + aPos * aPositionRadius.w, 1.0);
+  position_radius = aPositionRadius;
+  ambient = aAmbient;
+  diffuse = aDiffuse;
+  specular = aSpecular;
+  attenuation = aAttenuation;
+}
@@ -0,0 +1,5 @@
+#version 330 core
+
+// color writes are off, only the depth of the fragment matters
+void main() {
+}
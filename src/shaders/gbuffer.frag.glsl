@@ -0,0 +1,37 @@
+#version 330 core
+// see DeferredRenderer for the formats
+layout (location = 0) out vec4 albedo_specular;
+layout (location = 1) out vec2 packed_normal;
+layout (location = 2) out vec4 emission;
+
+in vec3 normal; 
+in vec3 pos;
+in vec2 tex_coord;
+
+struct Material {
+  sampler2D diffuse; 
+  sampler2D specular;
+  sampler2D emission;
+};
+
+uniform Material material; 
+
+// octahedral, same mapping as the packed vertex normals
+vec2 encode_normal(vec3 n)
+{
+  n /= abs(n.x) + abs(n.y) + abs(n.z);
+  vec2 encoded = n.xy;
+  if (n.z < 0.0)
+    encoded = (1.0 - abs(n.yx)) *
+              vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+  return encoded;
+}
+
+void main()
+{
+  albedo_specular = vec4(texture(material.diffuse, tex_coord).rgb,
+                         texture(material.specular, tex_coord).r);
+  // zero normals stay unlit instead of turning into NaN
+  packed_normal = dot(normal, normal) > 0.0 ? encode_normal(normal) : vec2(0.0);
+  emission = vec4(texture(material.emission, tex_coord).rgb, 1.0);
+}
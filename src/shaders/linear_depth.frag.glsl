@@ -6,8 +6,16 @@ in vec3 normal;
 in vec3 pos;
 in vec2 tex_coord;
 
-uniform float near;
-uniform float far;
+// once per frame, see FrameConstants
+layout (std140) uniform Frame {
+  mat4 view;
+  mat4 projection;
+  mat4 view_projection;
+  vec3 camera_pos;
+  float near;
+  float far;
+  float time;
+};
 
 float linearize_depth(float depth) {
 		float z = depth * 2.0 - 1.0;
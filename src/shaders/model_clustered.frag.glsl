@@ -0,0 +1,224 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec3 normal;
+in vec3 pos;
+in vec2 tex_coord;
+
+// model_fragment.glsl where point and spot lights come from the cluster of
+// the fragment, see LightGrid
+
+// std140, see light_buffer.hpp
+struct PointLight {
+  vec3 position;
+  float constant;
+  vec3 ambient;
+  float linear;
+  vec3 diffuse;
+  float quadratic;
+  vec3 specular;
+};
+
+struct SpotLight {
+  vec3 position;
+  float constant;
+  vec3 direction;
+  float linear;
+  vec3 ambient;
+  float quadratic;
+  vec3 diffuse;
+  float inner_cut_off;
+  vec3 specular;
+  float outer_cut_off;
+};
+
+struct DirectionalLight {
+  vec3 direction;
+  vec3 ambient;
+  vec3 diffuse;
+  vec3 specular;
+};
+
+struct Material {
+  sampler2D diffuse;
+  sampler2D specular;
+  sampler2D emission;
+  float shininess;
+};
+
+// LIGHT_GRID_X / Y / Z of light_grid.hpp
+#define LIGHT_GRID_X 16u
+#define LIGHT_GRID_Y 9u
+#define LIGHT_GRID_Z 24u
+
+#define MAX_POINT_LIGHTS 128
+#define MAX_SPOT_LIGHTS 32
+#define MAX_DIRECTIONNAL_LIGHTS 4
+
+// shared by every lit program, see LightBuffer. Only the counts and the
+// directional lights are read here, the grid has every point and spot light.
+layout (std140) uniform Lights {
+  uint point_lights_count;
+  uint spot_lights_count;
+  uint directionnal_lights_count;
+  PointLight point_lights[MAX_POINT_LIGHTS];
+  SpotLight spot_lights[MAX_SPOT_LIGHTS];
+  DirectionalLight directionnal_lights[MAX_DIRECTIONNAL_LIGHTS];
+};
+
+uniform Material material;
+
+// once per frame, see FrameConstants
+layout (std140) uniform Frame {
+  mat4 view;
+  mat4 projection;
+  mat4 view_projection;
+  vec3 camera_pos;
+  float near;
+  float far;
+  float time;
+};
+
+// offset in light_indices, point count | spot count << 16
+uniform usamplerBuffer light_grid;
+uniform usamplerBuffer light_indices;
+// 4 texels per point light, 5 per spot light
+uniform samplerBuffer point_light_data;
+uniform samplerBuffer spot_light_data;
+uniform vec2 light_grid_screen;
+// log(view depth) * scale + bias is the slice
+uniform float light_grid_scale;
+uniform float light_grid_bias;
+
+vec3 process_spot_light(SpotLight light, vec3 position, vec3 camera_position, vec3 normal);
+vec3 process_directionnal_light(DirectionalLight light, vec3 position, vec3 camera_position, vec3 normal);
+vec3 process_point_light(PointLight light, vec3 position, vec3 camera_position, vec3 normal);
+
+PointLight fetch_point_light(int i) {
+  vec4 t0 = texelFetch(point_light_data, i * 4);
+  vec4 t1 = texelFetch(point_light_data, i * 4 + 1);
+  vec4 t2 = texelFetch(point_light_data, i * 4 + 2);
+  vec4 t3 = texelFetch(point_light_data, i * 4 + 3);
+  return PointLight(t0.xyz, t0.w, t1.xyz, t1.w, t2.xyz, t2.w, t3.xyz);
+}
+
+SpotLight fetch_spot_light(int i) {
+  vec4 t0 = texelFetch(spot_light_data, i * 5);
+  vec4 t1 = texelFetch(spot_light_data, i * 5 + 1);
+  vec4 t2 = texelFetch(spot_light_data, i * 5 + 2);
+  vec4 t3 = texelFetch(spot_light_data, i * 5 + 3);
+  vec4 t4 = texelFetch(spot_light_data, i * 5 + 4);
+  return SpotLight(t0.xyz, t0.w, t1.xyz, t1.w, t2.xyz, t2.w, t3.xyz, t3.w, t4.xyz, t4.w);
+}
+
+uint cluster_index() {
+  uvec2 tile = min(uvec2(gl_FragCoord.xy / light_grid_screen * vec2(LIGHT_GRID_X, LIGHT_GRID_Y)),
+                   uvec2(LIGHT_GRID_X - 1u, LIGHT_GRID_Y - 1u));
+  // 1 / w of a perspective projection, the view depth
+  float depth = 1.0 / gl_FragCoord.w;
+  uint slice = uint(clamp(log(depth) * light_grid_scale + light_grid_bias, 0.0, float(LIGHT_GRID_Z - 1u)));
+  return tile.x + LIGHT_GRID_X * (tile.y + LIGHT_GRID_Y * slice);
+}
+
+void main()
+{
+  vec3 color = vec3(0.0);
+
+  // Lightning is deactivated
+  if (point_lights_count == 0u && spot_lights_count == 0u && directionnal_lights_count == 0u) {
+		  FragColor = texture(material.diffuse, tex_coord);
+		  return;
+  }
+
+  vec3 emission = vec3(texture(material.emission, tex_coord));
+
+  for (uint i = 0u; i<directionnal_lights_count; i++)
+		  color += process_directionnal_light(directionnal_lights[i], pos, camera_pos, normal);
+
+  uvec2 cluster = texelFetch(light_grid, int(cluster_index())).xy;
+  int first = int(cluster.x);
+  int points = int(cluster.y & 0xFFFFu);
+  int spots = int(cluster.y >> 16u);
+
+  for (int i = 0; i < points; i++) {
+    int light = int(texelFetch(light_indices, first + i).x);
+    color += process_point_light(fetch_point_light(light), pos, camera_pos, normal);
+  }
+
+  for (int i = points; i < points + spots; i++) {
+    int light = int(texelFetch(light_indices, first + i).x);
+    color += process_spot_light(fetch_spot_light(light), pos, camera_pos, normal);
+  }
+
+  FragColor = vec4(color + emission , 1.0f);
+}
+
+vec3 process_point_light(PointLight light, vec3 position, vec3 camera_position, vec3 normal) {
+  vec3 light_dir = normalize(light.position - position);
+  vec3 view_dir  = normalize(camera_position - position);
+  vec3 reflect_dir = reflect(-light_dir, normal);
+
+  // specular
+  float spec = pow(max(dot(view_dir, reflect_dir), 0.0), material.shininess);
+  vec3 specular = vec3(texture(material.specular, tex_coord)) * spec * light.specular;
+
+  // diffuse
+  float diffusion = max(dot(light_dir, normal), 0.0);
+  vec3 diffuse = vec3(texture(material.diffuse, tex_coord)) * diffusion * light.diffuse;
+
+  // attenuation
+  float dist = length(position-light.position);
+  float attenuation = 1.0 / (light.constant + light.linear*dist + light.quadratic*pow(dist,2));
+
+  // ambient
+  vec3 ambient = vec3(texture(material.diffuse , tex_coord)) * light.ambient;
+
+  return (ambient + diffuse + specular) * attenuation;
+}
+
+vec3 process_directionnal_light(DirectionalLight light, vec3 position, vec3 camera_position, vec3 normal) {
+  vec3 light_dir = normalize(-light.direction);
+  vec3 view_dir  = normalize(camera_position - position);
+  vec3 reflect_dir = reflect(-light_dir, normal);
+
+  // specular
+  float spec = pow(max(dot(view_dir, reflect_dir), 0.0), material.shininess);
+  vec3 specular = vec3(texture(material.specular, tex_coord)) * spec * light.specular;
+
+  // diffuse
+  float diffusion = max(dot(light_dir, normal), 0.0);
+  vec3 diffuse = vec3(texture(material.diffuse, tex_coord)) * diffusion * light.diffuse;
+
+  // ambient
+  vec3 ambient = vec3(texture(material.diffuse , tex_coord)) * light.ambient;
+
+  return (ambient + diffuse + specular);
+}
+
+vec3 process_spot_light(SpotLight light, vec3 position, vec3 camera_position, vec3 normal) {
+  vec3 light_dir = normalize(light.position - position);
+  vec3 view_dir  = normalize(camera_position - position);
+  vec3 reflect_dir = reflect(-light_dir, normal);
+
+  // stuff
+  float theta = dot(light_dir, normalize(-light.direction));
+  float epsilon = light.inner_cut_off - light.outer_cut_off;
+  float intensity = clamp((theta - light.outer_cut_off) / epsilon, 0.0, 1.0);
+
+  // specular
+  float spec = pow(max(dot(view_dir, reflect_dir), 0.0), material.shininess);
+  vec3 specular = vec3(texture(material.specular, tex_coord)) * spec * light.specular;
+
+  // diffuse
+  float diffusion = max(dot(light_dir, normal), 0.0);
+  vec3 diffuse = vec3(texture(material.diffuse, tex_coord)) * diffusion * light.diffuse;
+
+  // attenuation
+  float dist = length(position-light.position);
+  float attenuation = 1.0 / (light.constant + light.linear*dist + light.quadratic*pow(dist,2));
+
+  // ambient
+  vec3 ambient = vec3(texture(material.diffuse , tex_coord)) * light.ambient;
+
+  return (ambient + intensity * (diffuse + specular)) * attenuation;
+}
@@ -5,39 +5,35 @@ in vec3 normal;
 in vec3 pos;
 in vec2 tex_coord;
 
-struct DirectionalLight {
-  vec3 direction; 
-  
-  vec3 ambient;
-  vec3 diffuse;
-  vec3 specular; 
-};
-
+// std140, see light_buffer.hpp
 struct PointLight {
   vec3 position;
-
-  vec3 ambient;
-  vec3 diffuse;
-  vec3 specular; 
-
   float constant;
+  vec3 ambient;
   float linear;
+  vec3 diffuse;
   float quadratic;
+  vec3 specular;
 };
 
 struct SpotLight {
   vec3 position;
-  vec3 direction; 
+  float constant;
+  vec3 direction;
+  float linear;
+  vec3 ambient;
+  float quadratic;
+  vec3 diffuse;
   float inner_cut_off;
+  vec3 specular;
   float outer_cut_off;
+};
 
+struct DirectionalLight {
+  vec3 direction;
   vec3 ambient;
-  vec3 specular;
   vec3 diffuse;
-
-  float constant;
-  float linear;
-  float quadratic;
+  vec3 specular;
 };
 
 struct Material {
@@ -47,20 +43,32 @@ struct Material {
   float shininess;
 };
 
-#define MAX_POINT_LIGHTS 4
-#define MAX_SPOT_LIGHTS 4
+#define MAX_POINT_LIGHTS 128
+#define MAX_SPOT_LIGHTS 32
 #define MAX_DIRECTIONNAL_LIGHTS 4
 
-uniform DirectionalLight directionnal_lights[MAX_DIRECTIONNAL_LIGHTS];
-uniform SpotLight spot_lights[MAX_SPOT_LIGHTS];
-uniform PointLight point_lights[MAX_POINT_LIGHTS];
+// shared by every lit program, see LightBuffer
+layout (std140) uniform Lights {
+  uint point_lights_count;
+  uint spot_lights_count;
+  uint directionnal_lights_count;
+  PointLight point_lights[MAX_POINT_LIGHTS];
+  SpotLight spot_lights[MAX_SPOT_LIGHTS];
+  DirectionalLight directionnal_lights[MAX_DIRECTIONNAL_LIGHTS];
+};
 
 uniform Material material; 
-uniform vec3 camera_pos;
 
-uniform uint point_lights_count;
-uniform uint spot_lights_count;
-uniform uint directionnal_lights_count; 
+// once per frame, see FrameConstants
+layout (std140) uniform Frame {
+  mat4 view;
+  mat4 projection;
+  mat4 view_projection;
+  vec3 camera_pos;
+  float near;
+  float far;
+  float time;
+};
 
 vec3 process_spot_light(SpotLight light, vec3 position, vec3 camera_position, vec3 normal);
 vec3 process_directionnal_light(DirectionalLight light, vec3 position, vec3 camera_position, vec3 normal);
@@ -92,8 +100,8 @@ void main()
 }
 
 vec3 process_point_light(PointLight light, vec3 position, vec3 camera_position, vec3 normal) {
-  vec3 light_dir = normalize(position - light.position);
-  vec3 view_dir  = normalize(position - camera_position);
+  vec3 light_dir = normalize(light.position - position);
+  vec3 view_dir  = normalize(camera_position - position);
   vec3 reflect_dir = reflect(-light_dir, normal);
 
   // specular
@@ -115,8 +123,8 @@ vec3 process_point_light(PointLight light, vec3 position, vec3 camera_position,
 }
 
 vec3 process_directionnal_light(DirectionalLight light, vec3 position, vec3 camera_position, vec3 normal) {
-  vec3 light_dir = normalize(position - light.direction);
-  vec3 view_dir  = normalize(position - camera_position);
+  vec3 light_dir = normalize(-light.direction);
+  vec3 view_dir  = normalize(camera_position - position);
   vec3 reflect_dir = reflect(-light_dir, normal);
 
   // specular
@@ -135,7 +143,7 @@ vec3 process_directionnal_light(DirectionalLight light, vec3 position, vec3 came
 
 vec3 process_spot_light(SpotLight light, vec3 position, vec3 camera_position, vec3 normal) {
   vec3 light_dir = normalize(light.position - position);
-  vec3 view_dir  = normalize(position - camera_position);
+  vec3 view_dir  = normalize(camera_position - position);
   vec3 reflect_dir = reflect(-light_dir, normal);
 
   // stuff
@@ -8,15 +8,24 @@ out vec3 normal;
 out vec2 tex_coord;
 
 uniform mat4 model; 
-uniform mat4 view; 
-uniform mat4 projection; 
+
+// once per frame, see FrameConstants
+layout (std140) uniform Frame {
+  mat4 view;
+  mat4 projection;
+  mat4 view_projection;
+  vec3 camera_pos;
+  float near;
+  float far;
+  float time;
+};
 
 uniform mat4 outline_scale; 
 
 void main()
 {
   mat4 real_model = outline_scale * model;
-  gl_Position = projection * view * real_model * vec4(aPos, 1.0f);
+  gl_Position = view_projection * real_model * vec4(aPos, 1.0f);
   normal = aNormal; 
   tex_coord = aTexCoord;
   pos = vec3(real_model*vec4(aPos,1));
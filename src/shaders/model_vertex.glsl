@@ -1,20 +1,55 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal; 
+// w < 0 when octahedral encoded, see VertexFormat
+layout (location = 1) in vec4 aNormal; 
 layout (location = 2) in vec2 aTexCoord; 
+// one per instance, position decode already applied, see Model::draw
+layout (location = 3) in mat4 aModel;
+// inverse transpose of aModel without the position decode
+layout (location = 7) in mat3 aNormalMatrix;
 
 out vec3 pos;
 out vec3 normal; 
 out vec2 tex_coord;
 
-uniform mat4 model; 
-uniform mat4 view; 
-uniform mat4 projection; 
+// once per frame, see FrameConstants
+layout (std140) uniform Frame {
+  mat4 view;
+  mat4 projection;
+  mat4 view_projection;
+  vec3 camera_pos;
+  float near;
+  float far;
+  float time;
+};
+
+// the depth pre-pass runs this same shader in another program, its depth
+// has to match exactly for GL_LEQUAL
+invariant gl_Position;
+
+vec3 decode_normal(vec4 n)
+{
+  vec3 decoded = n.xyz;
+  if (n.w < 0.0) {
+    decoded = vec3(n.xy, 1.0 - abs(n.x) - abs(n.y));
+    if (decoded.z < 0.0)
+      decoded.xy = (1.0 - abs(decoded.yx)) *
+                   vec2(decoded.x >= 0.0 ? 1.0 : -1.0, decoded.y >= 0.0 ? 1.0 : -1.0);
+  }
+  return decoded;
+}
+
+// packed normals lose a bit of length, zero ones stay zero
+vec3 safe_normalize(vec3 v)
+{
+  float len = length(v);
+  return len > 0.0 ? v / len : v;
+}
 
 void main()
 {
-  gl_Position = projection * view * model * vec4(aPos, 1.0f);
-  normal = aNormal; 
+  gl_Position = view_projection * aModel * vec4(aPos, 1.0f);
+  normal = safe_normalize(aNormalMatrix * decode_normal(aNormal));
   tex_coord = aTexCoord;
-  pos = vec3(model*vec4(aPos,1));
+  pos = vec3(aModel*vec4(aPos,1));
 }
@@ -0,0 +1,21 @@
+#version 330 core
+// corners of the unit cube, see OcclusionQueries
+layout (location = 0) in vec3 aPos;
+
+// unit cube to the model space box, then model
+uniform mat4 box;
+// once per frame, see FrameConstants
+layout (std140) uniform Frame {
+  mat4 view;
+  mat4 projection;
+  mat4 view_projection;
+  vec3 camera_pos;
+  float near;
+  float far;
+  float time;
+};
+
+void main()
+{
+  gl_Position = view_projection * box * vec4(aPos, 1.0);
+}
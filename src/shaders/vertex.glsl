@@ -8,12 +8,21 @@ out vec2 TexCoord;
 out vec3 pos;
 
 uniform mat4 model; 
-uniform mat4 view; 
-uniform mat4 projection; 
+
+// once per frame, see FrameConstants
+layout (std140) uniform Frame {
+  mat4 view;
+  mat4 projection;
+  mat4 view_projection;
+  vec3 camera_pos;
+  float near;
+  float far;
+  float time;
+};
 
 void main()
 {
-  gl_Position = projection * view * model * vec4(aPos, 1.0f);
+  gl_Position = view_projection * model * vec4(aPos, 1.0f);
   ourColor = aColor; 
   TexCoord = aTexCoord;
 
@@ -0,0 +1,217 @@
+#include "spatial_index.hpp"
+
+#include <chrono>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// how many pending entities ahead sync() asks for the memory it is about to
+// read, the misses overlap instead of being paid one after the other
+constexpr size_t SPATIAL_PREFETCH_DISTANCE = 16;
+
+static void prefetch(const void *address) {
+#if defined(__SSE2__)
+  if (address != nullptr)
+    _mm_prefetch(static_cast<const char *>(address), _MM_HINT_T0);
+#else
+  (void)address;
+#endif
+}
+
+SpatialIndex::SpatialIndex(entt::registry &registry) : _registry(registry) {
+  registry.on_construct<WorldTransform>().connect<&SpatialIndex::moved>(*this);
+  registry.on_update<WorldTransform>().connect<&SpatialIndex::moved>(*this);
+  registry.on_destroy<WorldTransform>().connect<&SpatialIndex::forget>(*this);
+  registry.on_construct<LocalBounds>().connect<&SpatialIndex::resized>(*this);
+  registry.on_update<LocalBounds>().connect<&SpatialIndex::resized>(*this);
+  registry.on_destroy<LocalBounds>().connect<&SpatialIndex::forget>(*this);
+}
+
+SpatialIndex::~SpatialIndex() {
+  entt::registry &registry = this->_registry;
+  registry.on_construct<WorldTransform>().disconnect<&SpatialIndex::moved>(
+      *this);
+  registry.on_update<WorldTransform>().disconnect<&SpatialIndex::moved>(
+      *this);
+  registry.on_destroy<WorldTransform>().disconnect<&SpatialIndex::forget>(
+      *this);
+  registry.on_construct<LocalBounds>().disconnect<&SpatialIndex::resized>(
+      *this);
+  registry.on_update<LocalBounds>().disconnect<&SpatialIndex::resized>(
+      *this);
+  registry.on_destroy<LocalBounds>().disconnect<&SpatialIndex::forget>(
+      *this);
+}
+
+SpatialIndex::Slot &SpatialIndex::slot(entt::entity entity) {
+  const size_t index = static_cast<size_t>(entt::to_entity(entity));
+  if (index >= this->_slots.size())
+    this->_slots.resize(index + 1);
+  return this->_slots[index];
+}
+
+// BoundingBox::transformed on 4 wide registers, every write of a
+// WorldTransform goes through here
+static BoundingBox world_box(const BoundingBox &local, const glm::mat4 &m) {
+#if defined(__SSE2__)
+  const __m128 local_min = _mm_setr_ps(local.min.x, local.min.y, local.min.z,
+                                       0.0f);
+  const __m128 local_max = _mm_setr_ps(local.max.x, local.max.y, local.max.z,
+                                       0.0f);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 center = _mm_mul_ps(_mm_add_ps(local_min, local_max), half);
+  const __m128 extent = _mm_mul_ps(_mm_sub_ps(local_max, local_min), half);
+  const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+  const __m128 x = _mm_loadu_ps(&m[0].x);
+  const __m128 y = _mm_loadu_ps(&m[1].x);
+  const __m128 z = _mm_loadu_ps(&m[2].x);
+
+  const __m128 cx = _mm_shuffle_ps(center, center, _MM_SHUFFLE(0, 0, 0, 0));
+  const __m128 cy = _mm_shuffle_ps(center, center, _MM_SHUFFLE(1, 1, 1, 1));
+  const __m128 cz = _mm_shuffle_ps(center, center, _MM_SHUFFLE(2, 2, 2, 2));
+  const __m128 ex = _mm_shuffle_ps(extent, extent, _MM_SHUFFLE(0, 0, 0, 0));
+  const __m128 ey = _mm_shuffle_ps(extent, extent, _MM_SHUFFLE(1, 1, 1, 1));
+  const __m128 ez = _mm_shuffle_ps(extent, extent, _MM_SHUFFLE(2, 2, 2, 2));
+  const __m128 world_center =
+      _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, cx), _mm_mul_ps(y, cy)),
+                 _mm_add_ps(_mm_mul_ps(z, cz), _mm_loadu_ps(&m[3].x)));
+  const __m128 world_extent =
+      _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_and_ps(x, abs_mask), ex),
+                            _mm_mul_ps(_mm_and_ps(y, abs_mask), ey)),
+                 _mm_mul_ps(_mm_and_ps(z, abs_mask), ez));
+
+  alignas(16) float min[4], max[4];
+  _mm_store_ps(min, _mm_sub_ps(world_center, world_extent));
+  _mm_store_ps(max, _mm_add_ps(world_center, world_extent));
+  return BoundingBox{glm::vec3(min[0], min[1], min[2]),
+                     glm::vec3(max[0], max[1], max[2])};
+#else
+  return local.transformed(m);
+#endif
+}
+
+void SpatialIndex::resized(entt::registry &registry, entt::entity entity) {
+  Slot &slot = this->slot(entity);
+  slot.local = registry.get<LocalBounds>(entity).box;
+  if (slot.proxy == UNBOUNDED)
+    slot.proxy = BVH_NULL;
+  this->moved(registry, entity);
+}
+
+// Every write of a WorldTransform ends up here, the entity is only written
+// down, its slot is not even read
+void SpatialIndex::moved(entt::registry &, entt::entity entity) {
+  const size_t index = static_cast<size_t>(entt::to_entity(entity));
+  if (index >= this->_slots.size())
+    this->_slots.resize(index + 1);
+  if (index / 64 >= this->_queued.size())
+    this->_queued.resize(index / 64 + 1, 0);
+  uint64_t &word = this->_queued[index / 64];
+  const uint64_t bit = uint64_t{1} << (index % 64);
+  if ((word & bit) != 0)
+    return;
+  word |= bit;
+  this->_pending.push_back(entity);
+}
+
+// one of the components is going away, the entity leaves the tree right now
+// so a query never returns a dead handle. Its entries in _pending, if any,
+// are skipped by sync().
+void SpatialIndex::forget(entt::registry &, entt::entity entity) {
+  Slot &slot = this->slot(entity);
+  if (slot.proxy >= 0)
+    this->_tree.remove(slot.proxy);
+  slot = Slot{};
+  const size_t index = static_cast<size_t>(entt::to_entity(entity));
+  if (index / 64 < this->_queued.size())
+    this->_queued[index / 64] &= ~(uint64_t{1} << (index % 64));
+}
+
+void SpatialIndex::query_frustum(const Frustum &frustum,
+                                 std::vector<entt::entity> &out) const {
+  this->_tree.query_frustum(frustum, [&out](uint32_t user) {
+    out.push_back(static_cast<entt::entity>(user));
+  });
+}
+
+void SpatialIndex::query_sphere(const glm::vec3 &center, float radius,
+                                std::vector<entt::entity> &out) const {
+  this->_tree.query_sphere(center, radius, [&out](uint32_t user) {
+    out.push_back(static_cast<entt::entity>(user));
+  });
+}
+
+void SpatialIndex::query_ray(const glm::vec3 &origin,
+                             const glm::vec3 &direction, float max_distance,
+                             std::vector<entt::entity> &out) const {
+  this->_tree.query_ray(origin, direction, max_distance,
+                        [&out](uint32_t user) {
+                          out.push_back(static_cast<entt::entity>(user));
+                        });
+}
+
+void SpatialIndex::sync(size_t optimize_budget) {
+  auto start = std::chrono::high_resolution_clock::now();
+
+  this->_moves.clear();
+  auto &transforms = this->_registry.storage<WorldTransform>();
+  const size_t count = this->_pending.size();
+  for (size_t k = count; k-- > 0;) {
+    // the slot far ahead, the transform of the entity halfway there
+    if (k >= SPATIAL_PREFETCH_DISTANCE)
+      prefetch(&this->_slots[static_cast<size_t>(entt::to_entity(
+          this->_pending[k - SPATIAL_PREFETCH_DISTANCE]))]);
+    if (k >= SPATIAL_PREFETCH_DISTANCE / 2) {
+      const entt::entity ahead =
+          this->_pending[k - SPATIAL_PREFETCH_DISTANCE / 2];
+      if (transforms.contains(ahead))
+        prefetch(&transforms.get(ahead));
+    }
+
+    const entt::entity entity = this->_pending[k];
+    const size_t index = static_cast<size_t>(entt::to_entity(entity));
+    uint64_t &word = this->_queued[index / 64];
+    const uint64_t bit = uint64_t{1} << (index % 64);
+    // taken by a later entry, or forgotten since
+    if ((word & bit) == 0)
+      continue;
+    word &= ~bit;
+
+    Slot &slot = this->_slots[index];
+    if (slot.proxy == UNBOUNDED) {
+      // the bounds were there before, then the transform left and came back
+      const LocalBounds *bounds = this->_registry.try_get<LocalBounds>(entity);
+      if (bounds == nullptr)
+        continue;
+      slot.local = bounds->box;
+      slot.proxy = BVH_NULL;
+    }
+    if (!transforms.contains(entity))
+      continue;
+
+    const BoundingBox box =
+        world_box(slot.local, transforms.get(entity).matrix);
+    const glm::vec3 center = (box.min + box.max) * 0.5f;
+    if (slot.proxy == BVH_NULL) {
+      slot.proxy = this->_tree.insert(box, entt::to_integral(entity));
+      slot.fat = this->_tree.fat_box(slot.proxy);
+    } else if (!slot.fat.contains(box)) {
+      this->_moves.push_back(BvhMove{slot.proxy, box, center - slot.center});
+    }
+    slot.center = center;
+  }
+  this->_pending.clear();
+
+  this->_tree.move(this->_moves.data(), this->_moves.size());
+  for (const BvhMove &move : this->_moves) {
+    const auto entity =
+        static_cast<entt::entity>(this->_tree.user(move.proxy));
+    this->slot(entity).fat = this->_tree.fat_box(move.proxy);
+  }
+  this->_tree.optimize(optimize_budget);
+
+  auto end = std::chrono::high_resolution_clock::now();
+  this->_last_sync_ms =
+      std::chrono::duration<double, std::milli>(end - start).count();
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <entt/entt.hpp>
+#include <vector>
+
+#include "bvh.hpp"
+
+// Components followed by SpatialIndex. Change them through registry.patch,
+// replace or emplace_or_replace, a write through get<> is not seen.
+struct WorldTransform {
+  glm::mat4 matrix = glm::mat4(1.0f);
+};
+
+// Local space, e.g. Mesh::box or Model::bounds()
+struct LocalBounds {
+  BoundingBox box{glm::vec3(0.0f), glm::vec3(0.0f)};
+};
+
+// DynamicBvh over every entity with both a WorldTransform and LocalBounds.
+// The registry signals only write down which entities changed, sync()
+// computes their world boxes once per frame, reading ahead what the next ones
+// need, and checks them against a copy of the fattened boxes. Only what left
+// them reaches the tree, in one batched move. Queries visit the entities
+// whose fattened box passes the test.
+class SpatialIndex {
+public:
+  explicit SpatialIndex(entt::registry &registry);
+  ~SpatialIndex();
+  SpatialIndex(const SpatialIndex &) = delete;
+  SpatialIndex &operator=(const SpatialIndex &) = delete;
+
+  // optimize_budget leaves are reinserted on top of what moved, see
+  // DynamicBvh::optimize
+  void sync(size_t optimize_budget = 16);
+
+  // Append the entities found to out, which the caller keeps from one
+  // query to the next so nothing is allocated once it reached its size
+  void query_frustum(const Frustum &frustum,
+                     std::vector<entt::entity> &out) const;
+  void query_sphere(const glm::vec3 &center, float radius,
+                    std::vector<entt::entity> &out) const;
+  void query_ray(const glm::vec3 &origin, const glm::vec3 &direction,
+                 float max_distance, std::vector<entt::entity> &out) const;
+
+  size_t size() const { return this->_tree.size(); }
+  const DynamicBvh &tree() const { return this->_tree; }
+  // Time spent in the last sync(), for the debug UI
+  double last_sync_ms() const { return this->_last_sync_ms; }
+
+private:
+  // proxy of an entity whose LocalBounds box is not in the slot yet
+  static constexpr int32_t UNBOUNDED = -2;
+
+  // one cache line, all a moving entity reads besides its transform
+  struct alignas(64) Slot {
+    BoundingBox local{glm::vec3(0.0f), glm::vec3(0.0f)};
+    // copy of the leaf box, checked without touching the tree
+    BoundingBox fat{glm::vec3(0.0f), glm::vec3(0.0f)};
+    // world box center at the last sync, gives the displacement
+    glm::vec3 center{0.0f};
+    // BVH_NULL until sync() inserts it
+    int32_t proxy = UNBOUNDED;
+  };
+
+  entt::registry &_registry;
+  DynamicBvh _tree;
+  // by entity index
+  std::vector<Slot> _slots;
+  // One bit per entity index with an entry in _pending. An entity forgotten
+  // and signaled again gets a second entry, sync() walks them backwards and
+  // only takes the last one.
+  std::vector<uint64_t> _queued;
+  std::vector<entt::entity> _pending;
+  std::vector<BvhMove> _moves;
+  double _last_sync_ms = 0.0;
+
+  Slot &slot(entt::entity entity);
+  void moved(entt::registry &registry, entt::entity entity);
+  void resized(entt::registry &registry, entt::entity entity);
+  void forget(entt::registry &, entt::entity entity);
+};
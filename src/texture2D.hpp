@@ -1,8 +1,14 @@
 #pragma once
 
 #include "glad/glad.h"
+#include "pixel_uploader.hpp"
 #include "stb_image.h"
+#include <cstdlib>
+#include <cstring>
+#include <memory>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 enum WrapMode : GLenum { Repeat = GL_REPEAT, ClampToEdge = GL_CLAMP_TO_EDGE };
 enum FilterMode : GLenum { Linear = GL_LINEAR, Nearest = GL_NEAREST };
@@ -14,26 +20,100 @@ struct Texture2DBuilder {
   FilterMode min_filter = FilterMode::Linear;
   FilterMode mag_filter = FilterMode::Linear;
   TextureType type = TextureType::DIFFUSE;
+  // Block compress (BC1/BC3/BC4/BC5) with a baked mip chain, cached in a
+  // .ktx next to the source. Falls back to raw pixels when unsupported.
+  bool compress = false;
 };
 
-class Texture2D {
-public:
-  explicit Texture2D(const char *file_path,
-                     const Texture2DBuilder &builder = {}) {
-    unsigned char *data =
-        stbi_load(file_path, &this->width, &this->height, &this->nrChannels, 0);
+// A texture file referenced by a model, path relative to the model directory
+struct TextureRef {
+  std::string path;
+  TextureType type;
+};
+
+struct MipLevel {
+  int width;
+  int height;
+  size_t offset;
+  size_t size;
+};
+
+// Every mip level back to back in data, format is a GL compressed format
+struct CompressedImage {
+  GLenum format = 0;
+  std::vector<MipLevel> levels;
+  std::vector<unsigned char> data;
+};
+
+// CPU side result of stbi_load. Decoding does not touch OpenGL so it can run
+// on any thread, only the upload (Texture2D constructor) needs the context.
+struct DecodedImage {
+  std::unique_ptr<unsigned char, void (*)(void *)> pixels{nullptr,
+                                                          stbi_image_free};
+  int width = 0;
+  int height = 0;
+  int nrChannels = 0;
+  std::string path;
+  // pixels is empty when the image comes out of the block compressor
+  CompressedImage compressed;
+
+  static DecodedImage decode(const char *file_path) {
+    DecodedImage image;
+    image.pixels.reset(stbi_load(file_path, &image.width, &image.height,
+                                 &image.nrChannels, 0));
 
-    if (!data) {
+    if (!image.pixels) {
       throw std::runtime_error(
           "Erreur: impossible de charger la texture avec stbi: " +
           std::string(file_path));
     }
+    image.path = std::string(file_path);
+    return image;
+  }
+
+  // 1x1 stand in for an image that could not be loaded: magenta so a
+  // missing diffuse map shows, black so specular and emission add nothing
+  static DecodedImage placeholder(TextureType type, const std::string &path) {
+    DecodedImage image;
+    const unsigned char value[4] = {
+        static_cast<unsigned char>(type == TextureType::DIFFUSE ? 255 : 0), 0,
+        static_cast<unsigned char>(type == TextureType::DIFFUSE ? 255 : 0),
+        255};
+    // freed by stbi_image_free like any decoded image
+    image.pixels.reset(static_cast<unsigned char *>(std::malloc(4)));
+    std::memcpy(image.pixels.get(), value, sizeof(value));
+    image.width = image.height = 1;
+    image.nrChannels = 4;
+    image.path = path;
+    return image;
+  }
+};
+
+class Texture2D {
+public:
+  explicit Texture2D(const char *file_path,
+                     const Texture2DBuilder &builder = {})
+      : Texture2D(DecodedImage::decode(file_path), builder) {}
+
+  // With an uploader the pixels go through a staging buffer and the
+  // transfer is asynchronous, otherwise they are copied from client memory
+  explicit Texture2D(const DecodedImage &image,
+                     const Texture2DBuilder &builder = {},
+                     PixelUploader *uploader = nullptr) {
+    this->width = image.width;
+    this->height = image.height;
+    this->nrChannels = image.nrChannels;
+    const char *file_path = image.path.c_str();
 
     GLenum format;
     switch (this->nrChannels) {
     case 1:
       format = GL_RED;
       break;
+    case 2:
+      // only reachable through the compressed path (BC5)
+      format = GL_RG;
+      break;
     case 3:
       format = GL_RGB;
       break;
@@ -44,6 +124,10 @@ public:
       throw std::runtime_error(" Erreur: format non supporté " +
                                std::string(file_path));
     };
+    if (format == GL_RG && !image.compressed.format) {
+      throw std::runtime_error(" Erreur: format non supporté " +
+                               std::string(file_path));
+    }
 
     glGenTextures(1, &this->id);
 
@@ -56,13 +140,44 @@ public:
                     static_cast<GLint>(builder.min_filter));
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
                     static_cast<GLint>(builder.mag_filter));
-    glTexImage2D(GL_TEXTURE_2D, 0, static_cast<GLint>(format), width, height, 0,
-                 static_cast<GLenum>(format), GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    stbi_image_free(data);
+
+    if (image.compressed.format) {
+      // the mip chain is baked, no glGenerateMipmap
+      const CompressedImage &compressed = image.compressed;
+      if (uploader)
+        uploader->stage(compressed.data.data(), compressed.data.size());
+      for (size_t level = 0; level < compressed.levels.size(); level++) {
+        const MipLevel &mip = compressed.levels[level];
+        // offset inside the staging buffer when there is one
+        const void *source =
+            uploader ? reinterpret_cast<const void *>(mip.offset)
+                     : compressed.data.data() + mip.offset;
+        glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(level),
+                               compressed.format, mip.width, mip.height, 0,
+                               static_cast<GLsizei>(mip.size), source);
+      }
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                      static_cast<GLint>(compressed.levels.size()) - 1);
+      this->byte_size = compressed.data.size();
+    } else {
+      const size_t size = static_cast<size_t>(width) *
+                          static_cast<size_t>(height) *
+                          static_cast<size_t>(nrChannels);
+      if (uploader)
+        uploader->stage(image.pixels.get(), size);
+      const void *source = uploader ? nullptr : image.pixels.get();
+      glTexImage2D(GL_TEXTURE_2D, 0, static_cast<GLint>(format), width, height,
+                   0, static_cast<GLenum>(format), GL_UNSIGNED_BYTE, source);
+      glGenerateMipmap(GL_TEXTURE_2D);
+      // + 1/3 for the generated mip chain
+      this->byte_size = size * 4 / 3;
+    }
+    if (uploader)
+      uploader->finish();
 
     this->path = std::string(file_path);
     this->type = builder.type;
+    this->compressed_format = image.compressed.format;
   };
 
   void deinit() { glDeleteTextures(1, &this->id); }
@@ -76,12 +191,17 @@ public:
                              this->path.size());
   }
   TextureType get_type() const { return this->type; }
+  // video memory used by every mip level
+  size_t get_byte_size() const { return this->byte_size; }
+  bool is_compressed() const { return this->compressed_format != 0; }
 
 private:
   unsigned int id;
   int width;
   int height;
   int nrChannels;
+  size_t byte_size;
+  GLenum compressed_format;
 
   TextureType type;
   std::string path;
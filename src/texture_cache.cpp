@@ -0,0 +1,113 @@
+#include "texture_cache.hpp"
+
+#include <filesystem>
+#include <functional>
+#include <system_error>
+
+TextureKey TextureKey::from(const std::string &file_path,
+                            const Texture2DBuilder &params) {
+  std::error_code error;
+  std::filesystem::path canonical =
+      std::filesystem::weakly_canonical(file_path, error);
+  // stbi will report the missing file later on, keep the path as is
+  if (error)
+    canonical = std::filesystem::absolute(file_path, error);
+  return TextureKey{canonical.string(), params};
+}
+
+size_t TextureKeyHash::operator()(const TextureKey &key) const {
+  size_t hash = std::hash<std::string>{}(key.path);
+  const size_t fields[] = {key.params.wrap_s, key.params.wrap_t,
+                           key.params.min_filter, key.params.mag_filter,
+                           static_cast<size_t>(key.params.type),
+                           static_cast<size_t>(key.params.compress)};
+  for (size_t field : fields)
+    hash ^= field + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+  return hash;
+}
+
+TextureHandle::TextureHandle(const TextureHandle &other)
+    : _cache(other._cache), _key(other._key) {
+  if (this->_key)
+    this->_cache->retain(*this->_key);
+}
+
+TextureHandle::TextureHandle(TextureHandle &&other) noexcept
+    : _cache(other._cache), _key(other._key) {
+  other._cache = nullptr;
+  other._key = nullptr;
+}
+
+TextureHandle &TextureHandle::operator=(TextureHandle other) noexcept {
+  std::swap(this->_cache, other._cache);
+  std::swap(this->_key, other._key);
+  return *this;
+}
+
+void TextureHandle::reset() {
+  if (this->_key)
+    this->_cache->release(*this->_key);
+  this->_cache = nullptr;
+  this->_key = nullptr;
+}
+
+Texture2D *TextureHandle::get() const {
+  return this->_key ? this->_cache->get(*this->_key) : nullptr;
+}
+
+TextureCache &TextureCache::global() {
+  static TextureCache cache;
+  return cache;
+}
+
+TextureHandle TextureCache::acquire(const TextureKey &key, bool &needs_load) {
+  std::lock_guard<std::mutex> lock(this->_mutex);
+  auto [it, inserted] = this->_entries.try_emplace(key);
+  it->second.refcount++;
+  needs_load = inserted;
+  return TextureHandle(this, &it->first);
+}
+
+void TextureCache::fulfill(const TextureHandle &handle, Texture2D *texture) {
+  std::lock_guard<std::mutex> lock(this->_mutex);
+  this->_entries.at(*handle._key).texture.reset(texture);
+}
+
+void TextureCache::retain(const TextureKey &key) {
+  std::lock_guard<std::mutex> lock(this->_mutex);
+  this->_entries.at(key).refcount++;
+}
+
+void TextureCache::release(const TextureKey &key) {
+  std::unique_ptr<Texture2D> texture;
+  {
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    auto it = this->_entries.find(key);
+    if (--it->second.refcount > 0)
+      return;
+    texture = std::move(it->second.texture);
+    this->_entries.erase(it);
+  }
+
+  if (texture)
+    texture->deinit();
+}
+
+Texture2D *TextureCache::get(const TextureKey &key) const {
+  std::lock_guard<std::mutex> lock(this->_mutex);
+  return this->_entries.at(key).texture.get();
+}
+
+size_t TextureCache::size() const {
+  std::lock_guard<std::mutex> lock(this->_mutex);
+  return this->_entries.size();
+}
+
+size_t TextureCache::resident_bytes() const {
+  std::lock_guard<std::mutex> lock(this->_mutex);
+  size_t bytes = 0;
+  for (const auto &[key, entry] : this->_entries)
+    if (entry.texture)
+      bytes += entry.texture->get_byte_size();
+  return bytes;
+}
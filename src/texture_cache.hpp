@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "texture2D.hpp"
+
+// Same file loaded with other parameters is another GL texture
+struct TextureKey {
+  std::string path; // canonical absolute path
+  Texture2DBuilder params;
+
+  static TextureKey from(const std::string &file_path,
+                         const Texture2DBuilder &params);
+
+  bool operator==(const TextureKey &other) const {
+    return this->path == other.path &&
+           this->params.wrap_s == other.params.wrap_s &&
+           this->params.wrap_t == other.params.wrap_t &&
+           this->params.min_filter == other.params.min_filter &&
+           this->params.mag_filter == other.params.mag_filter &&
+           this->params.type == other.params.type &&
+           this->params.compress == other.params.compress;
+  }
+};
+
+struct TextureKeyHash {
+  size_t operator()(const TextureKey &key) const;
+};
+
+class TextureCache;
+
+// Shared ownership of a cache entry. The texture is destroyed as soon as the
+// last handle goes away, which must happen on the GL thread.
+class TextureHandle {
+public:
+  TextureHandle() = default;
+  TextureHandle(const TextureHandle &other);
+  TextureHandle(TextureHandle &&other) noexcept;
+  TextureHandle &operator=(TextureHandle other) noexcept;
+  ~TextureHandle() { this->reset(); }
+
+  void reset();
+  // nullptr while the texture is still being loaded
+  Texture2D *get() const;
+  explicit operator bool() const { return this->_key != nullptr; }
+
+private:
+  friend class TextureCache;
+  TextureHandle(TextureCache *cache, const TextureKey *key)
+      : _cache(cache), _key(key) {}
+
+  TextureCache *_cache = nullptr;
+  // points to the key stored in the map node, stable across rehashes
+  const TextureKey *_key = nullptr;
+};
+
+// Engine wide, every Model shares it. Lookups are thread safe so imports can
+// reserve entries from the thread pool, the GL work itself (fulfill and the
+// last release) stays on the GL thread.
+class TextureCache {
+public:
+  static TextureCache &global();
+
+  // Returns a handle on the entry, creating an empty one if needed. When
+  // needs_load is set the caller must load the texture and fulfill it.
+  TextureHandle acquire(const TextureKey &key, bool &needs_load);
+  void fulfill(const TextureHandle &handle, Texture2D *texture);
+
+  size_t size() const;
+  size_t resident_bytes() const;
+
+private:
+  friend class TextureHandle;
+  struct Entry {
+    std::unique_ptr<Texture2D> texture;
+    size_t refcount = 0;
+  };
+
+  mutable std::mutex _mutex;
+  std::unordered_map<TextureKey, Entry, TextureKeyHash> _entries;
+
+  void retain(const TextureKey &key);
+  void release(const TextureKey &key);
+  Texture2D *get(const TextureKey &key) const;
+};
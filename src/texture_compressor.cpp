@@ -0,0 +1,517 @@
+#include "texture_compressor.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "mapped_file.hpp"
+
+static std::atomic<bool> S3TC_SUPPORTED{false};
+
+void detect_texture_compression() {
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; i++) {
+    const auto *name = reinterpret_cast<const char *>(
+        glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i)));
+    if (name && std::strcmp(name, "GL_EXT_texture_compression_s3tc") == 0) {
+      S3TC_SUPPORTED = true;
+      return;
+    }
+  }
+}
+
+bool s3tc_supported() { return S3TC_SUPPORTED; }
+
+GLenum compressed_format_for(int channels) {
+  switch (channels) {
+  case 1:
+    return GL_COMPRESSED_RED_RGTC1;
+  case 2:
+    return GL_COMPRESSED_RG_RGTC2;
+  case 3:
+    return s3tc_supported() ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : 0;
+  case 4:
+    return s3tc_supported() ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : 0;
+  default:
+    return 0;
+  }
+}
+
+// what compressed_format_for() can hand out on this driver
+static bool is_baked_format(GLenum format) {
+  switch (format) {
+  case GL_COMPRESSED_RED_RGTC1:
+  case GL_COMPRESSED_RG_RGTC2:
+    return true;
+  case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+  case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+    return s3tc_supported();
+  default:
+    return false;
+  }
+}
+
+static size_t block_size(GLenum format) {
+  return format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ||
+                 format == GL_COMPRESSED_RED_RGTC1
+             ? 8
+             : 16;
+}
+
+// 4x4 texels, always 4 channels (missing ones are 0 / 255 for alpha)
+using Block = std::array<std::array<unsigned char, 4>, 16>;
+
+static Block fetch_block(const unsigned char *pixels, int width, int height,
+                         int channels, int block_x, int block_y) {
+  Block block;
+  for (int y = 0; y < 4; y++) {
+    for (int x = 0; x < 4; x++) {
+      // edges of non multiple of 4 images repeat the last texel
+      const int px = std::min(block_x * 4 + x, width - 1);
+      const int py = std::min(block_y * 4 + y, height - 1);
+      const unsigned char *texel =
+          pixels + (static_cast<size_t>(py) * static_cast<size_t>(width) +
+                    static_cast<size_t>(px)) *
+                       static_cast<size_t>(channels);
+
+      auto &out = block[static_cast<size_t>(y * 4 + x)];
+      out = {0, 0, 0, 255};
+      for (int c = 0; c < channels; c++)
+        out[static_cast<size_t>(c)] = texel[c];
+    }
+  }
+  return block;
+}
+
+static uint16_t to_565(const float color[3]) {
+  auto quantize = [](float v, int max) {
+    return static_cast<uint16_t>(
+        std::clamp(static_cast<int>(v / 255.0f * static_cast<float>(max) +
+                                    0.5f),
+                   0, max));
+  };
+  return static_cast<uint16_t>(quantize(color[0], 31) << 11 |
+                               quantize(color[1], 63) << 5 |
+                               quantize(color[2], 31));
+}
+
+static void from_565(uint16_t packed, float color[3]) {
+  const int r = packed >> 11 & 31;
+  const int g = packed >> 5 & 63;
+  const int b = packed & 31;
+  color[0] = static_cast<float>(r << 3 | r >> 2);
+  color[1] = static_cast<float>(g << 2 | g >> 4);
+  color[2] = static_cast<float>(b << 3 | b >> 2);
+}
+
+// Endpoints are the extremes of the block along its principal axis
+static void encode_color_block(const Block &block, unsigned char *out) {
+  float mean[3] = {0, 0, 0};
+  for (const auto &texel : block)
+    for (int c = 0; c < 3; c++)
+      mean[c] += texel[static_cast<size_t>(c)] / 16.0f;
+
+  float cov[6] = {0, 0, 0, 0, 0, 0};
+  for (const auto &texel : block) {
+    const float r = texel[0] - mean[0];
+    const float g = texel[1] - mean[1];
+    const float b = texel[2] - mean[2];
+    cov[0] += r * r;
+    cov[1] += r * g;
+    cov[2] += r * b;
+    cov[3] += g * g;
+    cov[4] += g * b;
+    cov[5] += b * b;
+  }
+
+  // a few power iterations are enough for 16 texels
+  float axis[3] = {1, 1, 1};
+  for (int i = 0; i < 4; i++) {
+    const float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+    const float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+    const float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+    const float norm = std::max({std::abs(x), std::abs(y), std::abs(z)});
+    if (norm <= 0.0f)
+      break;
+    axis[0] = x / norm;
+    axis[1] = y / norm;
+    axis[2] = z / norm;
+  }
+
+  size_t min_i = 0, max_i = 0;
+  float min_d = 1e30f, max_d = -1e30f;
+  for (size_t i = 0; i < block.size(); i++) {
+    const float d = block[i][0] * axis[0] + block[i][1] * axis[1] +
+                    block[i][2] * axis[2];
+    if (d < min_d) {
+      min_d = d;
+      min_i = i;
+    }
+    if (d > max_d) {
+      max_d = d;
+      max_i = i;
+    }
+  }
+
+  float max_color[3], min_color[3];
+  for (int c = 0; c < 3; c++) {
+    max_color[c] = block[max_i][static_cast<size_t>(c)];
+    min_color[c] = block[min_i][static_cast<size_t>(c)];
+  }
+
+  uint16_t color0 = to_565(max_color);
+  uint16_t color1 = to_565(min_color);
+  if (color0 < color1)
+    std::swap(color0, color1);
+
+  uint32_t indices = 0;
+  // color0 == color1 selects the 3 colors mode, index 0 is still color0
+  if (color0 != color1) {
+    float palette[4][3];
+    from_565(color0, palette[0]);
+    from_565(color1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    for (size_t i = 0; i < block.size(); i++) {
+      uint32_t best = 0;
+      float best_dist = 1e30f;
+      for (uint32_t p = 0; p < 4; p++) {
+        float dist = 0;
+        for (int c = 0; c < 3; c++) {
+          const float delta = block[i][static_cast<size_t>(c)] - palette[p][c];
+          dist += delta * delta;
+        }
+        if (dist < best_dist) {
+          best_dist = dist;
+          best = p;
+        }
+      }
+      indices |= best << (2 * i);
+    }
+  }
+
+  out[0] = static_cast<unsigned char>(color0 & 0xFF);
+  out[1] = static_cast<unsigned char>(color0 >> 8);
+  out[2] = static_cast<unsigned char>(color1 & 0xFF);
+  out[3] = static_cast<unsigned char>(color1 >> 8);
+  for (int i = 0; i < 4; i++)
+    out[4 + i] = static_cast<unsigned char>(indices >> (8 * i));
+}
+
+// BC4 block, also the alpha half of BC3 and each half of BC5
+static void encode_channel_block(const Block &block, size_t channel,
+                                 unsigned char *out) {
+  unsigned char lo = 255, hi = 0;
+  for (const auto &texel : block) {
+    lo = std::min(lo, texel[channel]);
+    hi = std::max(hi, texel[channel]);
+  }
+
+  // hi > lo selects the 8 values mode: 0 = hi, 1 = lo, 2..7 interpolated
+  int palette[8] = {hi, lo};
+  for (int k = 2; k < 8; k++)
+    palette[k] = ((8 - k) * hi + (k - 1) * lo) / 7;
+
+  uint64_t indices = 0;
+  if (hi != lo) {
+    for (size_t i = 0; i < block.size(); i++) {
+      uint64_t best = 0;
+      int best_dist = 256;
+      for (int p = 0; p < 8; p++) {
+        const int dist = std::abs(block[i][channel] - palette[p]);
+        if (dist < best_dist) {
+          best_dist = dist;
+          best = static_cast<uint64_t>(p);
+        }
+      }
+      indices |= best << (3 * i);
+    }
+  }
+
+  out[0] = hi;
+  out[1] = lo;
+  for (int i = 0; i < 6; i++)
+    out[2 + i] = static_cast<unsigned char>(indices >> (8 * i));
+}
+
+static void compress_level(const unsigned char *pixels, int width, int height,
+                           int channels, GLenum format, unsigned char *out) {
+  const int blocks_x = (width + 3) / 4;
+  const int blocks_y = (height + 3) / 4;
+  const size_t stride = block_size(format);
+
+  for (int by = 0; by < blocks_y; by++) {
+    for (int bx = 0; bx < blocks_x; bx++) {
+      const Block block = fetch_block(pixels, width, height, channels, bx, by);
+      switch (format) {
+      case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        encode_color_block(block, out);
+        break;
+      case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        encode_channel_block(block, 3, out);
+        encode_color_block(block, out + 8);
+        break;
+      case GL_COMPRESSED_RED_RGTC1:
+        encode_channel_block(block, 0, out);
+        break;
+      case GL_COMPRESSED_RG_RGTC2:
+        encode_channel_block(block, 0, out);
+        encode_channel_block(block, 1, out + 8);
+        break;
+      default:
+        break;
+      }
+      out += stride;
+    }
+  }
+}
+
+// 2x2 box filter, odd sizes reuse the last row / column
+static std::vector<unsigned char> downsample(const unsigned char *pixels,
+                                             int width, int height,
+                                             int channels) {
+  const int next_w = std::max(width / 2, 1);
+  const int next_h = std::max(height / 2, 1);
+  std::vector<unsigned char> next(static_cast<size_t>(next_w) *
+                                  static_cast<size_t>(next_h) *
+                                  static_cast<size_t>(channels));
+
+  auto at = [&](int x, int y, int c) -> int {
+    x = std::min(x, width - 1);
+    y = std::min(y, height - 1);
+    return pixels[(static_cast<size_t>(y) * static_cast<size_t>(width) +
+                   static_cast<size_t>(x)) *
+                      static_cast<size_t>(channels) +
+                  static_cast<size_t>(c)];
+  };
+
+  for (int y = 0; y < next_h; y++)
+    for (int x = 0; x < next_w; x++)
+      for (int c = 0; c < channels; c++) {
+        const int sum = at(2 * x, 2 * y, c) + at(2 * x + 1, 2 * y, c) +
+                        at(2 * x, 2 * y + 1, c) + at(2 * x + 1, 2 * y + 1, c);
+        const size_t index =
+            (static_cast<size_t>(y) * static_cast<size_t>(next_w) +
+             static_cast<size_t>(x)) *
+                static_cast<size_t>(channels) +
+            static_cast<size_t>(c);
+        next[index] = static_cast<unsigned char>((sum + 2) / 4);
+      }
+  return next;
+}
+
+CompressedImage compress_image(const unsigned char *pixels, int width,
+                               int height, int channels, GLenum format) {
+  CompressedImage image;
+  image.format = format;
+
+  std::vector<unsigned char> level_pixels;
+  const unsigned char *current = pixels;
+  while (true) {
+    const size_t size = static_cast<size_t>((width + 3) / 4) *
+                        static_cast<size_t>((height + 3) / 4) *
+                        block_size(format);
+    image.levels.push_back(MipLevel{width, height, image.data.size(), size});
+    image.data.resize(image.data.size() + size);
+    compress_level(current, width, height, channels, format,
+                   image.data.data() + image.levels.back().offset);
+
+    if (width == 1 && height == 1)
+      break;
+    level_pixels = downsample(current, width, height, channels);
+    current = level_pixels.data();
+    width = std::max(width / 2, 1);
+    height = std::max(height / 2, 1);
+  }
+  return image;
+}
+
+static const unsigned char KTX_IDENTIFIER[12] = {0xAB, 'K',  'T',  'X',
+                                                 ' ',  '1',  '1',  0xBB,
+                                                 '\r', '\n', 0x1A, '\n'};
+constexpr uint32_t KTX_ENDIANNESS = 0x04030201;
+constexpr const char KTX_HASH_KEY[] = "kaos.source_hash";
+
+struct KtxHeader {
+  unsigned char identifier[12];
+  uint32_t endianness;
+  uint32_t gl_type;
+  uint32_t gl_type_size;
+  uint32_t gl_format;
+  uint32_t gl_internal_format;
+  uint32_t gl_base_internal_format;
+  uint32_t pixel_width;
+  uint32_t pixel_height;
+  uint32_t pixel_depth;
+  uint32_t number_of_array_elements;
+  uint32_t number_of_faces;
+  uint32_t number_of_mipmap_levels;
+  uint32_t bytes_of_key_value_data;
+};
+
+// key/value entry: u32 size, key + '\0', 8 bytes of hash, padded to 4
+constexpr size_t KTX_KV_SIZE = sizeof(KTX_HASH_KEY) + sizeof(uint64_t);
+constexpr size_t KTX_KV_PADDED = (4 + KTX_KV_SIZE + 3) / 4 * 4;
+
+bool read_ktx(const std::string &path, uint64_t source_hash,
+              CompressedImage &image, int &width, int &height) {
+  MappedFile file;
+  if (!file.open(path) || file.size() < sizeof(KtxHeader))
+    return false;
+
+  KtxHeader header;
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (std::memcmp(header.identifier, KTX_IDENTIFIER, 12) != 0 ||
+      header.endianness != KTX_ENDIANNESS || header.gl_type != 0 ||
+      header.number_of_faces != 1 ||
+      header.bytes_of_key_value_data != KTX_KV_PADDED ||
+      file.size() < sizeof(KtxHeader) + KTX_KV_PADDED ||
+      !is_baked_format(header.gl_internal_format) ||
+      header.pixel_width == 0 || header.pixel_height == 0 ||
+      header.pixel_width > INT32_MAX || header.pixel_height > INT32_MAX)
+    return false;
+
+  // only files baked by write_ktx are accepted, the hash has a fixed place
+  const unsigned char *kv = file.data() + sizeof(KtxHeader);
+  uint64_t stored_hash;
+  if (std::memcmp(kv + 4, KTX_HASH_KEY, sizeof(KTX_HASH_KEY)) != 0)
+    return false;
+  std::memcpy(&stored_hash, kv + 4 + sizeof(KTX_HASH_KEY), sizeof(uint64_t));
+  if (stored_hash != source_hash)
+    return false;
+
+  image = CompressedImage{};
+  image.format = header.gl_internal_format;
+  width = static_cast<int>(header.pixel_width);
+  height = static_cast<int>(header.pixel_height);
+
+  size_t offset = sizeof(KtxHeader) + KTX_KV_PADDED;
+  int level_w = width, level_h = height;
+  for (uint32_t level = 0; level < header.number_of_mipmap_levels; level++) {
+    // the padding of the previous level can already be past the end
+    uint32_t size;
+    if (offset > file.size() || file.size() - offset < sizeof(size))
+      return false;
+    std::memcpy(&size, file.data() + offset, sizeof(size));
+    offset += sizeof(size);
+    const size_t expected = static_cast<size_t>((level_w + 3) / 4) *
+                            static_cast<size_t>((level_h + 3) / 4) *
+                            block_size(image.format);
+    if (size != expected || file.size() - offset < size)
+      return false;
+
+    image.levels.push_back(MipLevel{level_w, level_h, image.data.size(), size});
+    image.data.insert(image.data.end(), file.data() + offset,
+                      file.data() + offset + size);
+    offset += (size + 3u) / 4u * 4u;
+    level_w = std::max(level_w / 2, 1);
+    level_h = std::max(level_h / 2, 1);
+  }
+  return !image.levels.empty();
+}
+
+bool write_ktx(const std::string &path, uint64_t source_hash,
+               const CompressedImage &image, int channels) {
+  KtxHeader header{};
+  std::memcpy(header.identifier, KTX_IDENTIFIER, 12);
+  header.endianness = KTX_ENDIANNESS;
+  header.gl_type_size = 1;
+  header.gl_internal_format = image.format;
+  const GLenum base_formats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+  header.gl_base_internal_format =
+      base_formats[std::clamp(channels, 1, 4) - 1];
+  header.pixel_width = static_cast<uint32_t>(image.levels[0].width);
+  header.pixel_height = static_cast<uint32_t>(image.levels[0].height);
+  header.number_of_faces = 1;
+  header.number_of_mipmap_levels = static_cast<uint32_t>(image.levels.size());
+  header.bytes_of_key_value_data = KTX_KV_PADDED;
+
+  unsigned char kv[KTX_KV_PADDED] = {};
+  const auto kv_size = static_cast<uint32_t>(KTX_KV_SIZE);
+  std::memcpy(kv, &kv_size, sizeof(kv_size));
+  std::memcpy(kv + 4, KTX_HASH_KEY, sizeof(KTX_HASH_KEY));
+  std::memcpy(kv + 4 + sizeof(KTX_HASH_KEY), &source_hash, sizeof(uint64_t));
+
+  // same temporary + rename dance as the mesh cache
+  const std::string tmp_path = path + ".tmp";
+  std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open())
+    return false;
+
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char *>(kv), sizeof(kv));
+  for (const MipLevel &level : image.levels) {
+    const auto size = static_cast<uint32_t>(level.size);
+    const char padding[3] = {};
+    file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+    file.write(reinterpret_cast<const char *>(image.data.data() + level.offset),
+               static_cast<std::streamsize>(level.size));
+    file.write(padding, static_cast<std::streamsize>((4 - level.size % 4) % 4));
+  }
+
+  file.close();
+  if (!file || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+DecodedImage decode_compressed(const char *file_path) {
+  uint64_t source_hash;
+  {
+    MappedFile source;
+    if (!source.open(file_path))
+      return DecodedImage::decode(file_path); // reports the missing file
+    source_hash = hash_bytes(source.data(), source.size());
+  }
+
+  const std::string ktx_path = std::string(file_path) + KTX_EXTENSION;
+  DecodedImage image;
+  if (read_ktx(ktx_path, source_hash, image.compressed, image.width,
+               image.height)) {
+    const bool is_s3tc =
+        image.compressed.format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ||
+        image.compressed.format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    if (!is_s3tc || s3tc_supported()) {
+      switch (image.compressed.format) {
+      case GL_COMPRESSED_RED_RGTC1:
+        image.nrChannels = 1;
+        break;
+      case GL_COMPRESSED_RG_RGTC2:
+        image.nrChannels = 2;
+        break;
+      case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        image.nrChannels = 3;
+        break;
+      default:
+        image.nrChannels = 4;
+        break;
+      }
+      image.path = file_path;
+      return image;
+    }
+  }
+
+  image = DecodedImage::decode(file_path);
+  const GLenum format = compressed_format_for(image.nrChannels);
+  if (!format)
+    return image;
+
+  image.compressed = compress_image(image.pixels.get(), image.width,
+                                    image.height, image.nrChannels, format);
+  image.pixels.reset();
+  if (!write_ktx(ktx_path, source_hash, image.compressed, image.nrChannels))
+    std::cerr << "Erreur: impossible d'ecrire " << ktx_path << "\n";
+  return image;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "glad/glad.h"
+#include "texture2D.hpp"
+
+// EXT_texture_compression_s3tc is not part of the generated glad profile
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+constexpr const char *KTX_EXTENSION = ".ktx";
+
+// Must run once on the GL thread, until then only RGTC (core since 3.0) is
+// considered available
+void detect_texture_compression();
+bool s3tc_supported();
+
+// 1 channel -> BC4, 2 -> BC5, 3 -> BC1, 4 -> BC3. 0 when there is no usable
+// block format for that channel count.
+GLenum compressed_format_for(int channels);
+
+// Encodes every level of the mip chain (box filtered down to 1x1)
+CompressedImage compress_image(const unsigned char *pixels, int width,
+                               int height, int channels, GLenum format);
+
+// KTX 1.1 container, the source hash is kept in the key/value data
+bool read_ktx(const std::string &path, uint64_t source_hash,
+              CompressedImage &image, int &width, int &height);
+bool write_ktx(const std::string &path, uint64_t source_hash,
+               const CompressedImage &image, int channels);
+
+// stbi_load replacement for Texture2DBuilder::compress: reuses the baked .ktx
+// when it matches the source, otherwise decodes, compresses and bakes it.
+// Can run on any thread.
+DecodedImage decode_compressed(const char *file_path);
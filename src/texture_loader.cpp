@@ -0,0 +1,72 @@
+#include "texture_loader.hpp"
+#include "texture_compressor.hpp"
+
+#include <chrono>
+#include <iostream>
+
+void TextureLoader::decode(std::vector<TextureLoadRequest> requests) {
+  this->_requests = std::move(requests);
+  this->_decoding.clear();
+  this->_decoding.reserve(this->_requests.size());
+
+  for (const TextureLoadRequest &request : this->_requests) {
+    this->_decoding.push_back(
+        this->_pool->submit([file_path = request.file_path,
+                             compress = request.builder.compress]() {
+          auto start = std::chrono::high_resolution_clock::now();
+          DecodedImage image =
+              compress ? decode_compressed(file_path.c_str())
+                       : DecodedImage::decode(file_path.c_str());
+          auto end = std::chrono::high_resolution_clock::now();
+          return DecodeResult{
+              std::move(image),
+              std::chrono::duration_cast<std::chrono::milliseconds>(end -
+                                                                    start)
+                  .count()};
+        }));
+  }
+}
+
+bool TextureLoader::is_decoded(size_t index) const {
+  return this->_decoding[index].wait_for(std::chrono::seconds(0)) ==
+         std::future_status::ready;
+}
+
+Texture2D *TextureLoader::upload(size_t index, PixelUploader *uploader) {
+  DecodeResult result = this->_decoding[index].get();
+
+  auto upload_start = std::chrono::high_resolution_clock::now();
+  Texture2D *texture =
+      new Texture2D(result.image, this->_requests[index].builder, uploader);
+  auto upload_end = std::chrono::high_resolution_clock::now();
+
+  std::cout << "Texture load time: decode " << result.decode_ms
+            << "ms, upload "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   upload_end - upload_start)
+                   .count()
+            << "ms, " << (texture->get_byte_size() >> 10)
+            << (texture->is_compressed() ? "KB compressed (" : "KB (")
+            << this->_requests[index].file_path << ")\n";
+  return texture;
+}
+
+std::vector<Texture2D *>
+TextureLoader::load(std::vector<TextureLoadRequest> requests) {
+  this->decode(std::move(requests));
+
+  std::vector<Texture2D *> textures;
+  textures.reserve(this->size());
+  try {
+    // uploads of the first images overlap the decoding of the next ones
+    for (size_t i = 0; i < this->size(); i++)
+      textures.push_back(this->upload(i));
+  } catch (...) {
+    for (Texture2D *texture : textures) {
+      texture->deinit();
+      delete texture;
+    }
+    throw;
+  }
+  return textures;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <future>
+#include <string>
+#include <vector>
+
+#include "texture2D.hpp"
+#include "thread_pool.hpp"
+
+struct TextureLoadRequest {
+  std::string file_path;
+  Texture2DBuilder builder;
+};
+
+// Batch loader: every image is decoded on the worker pool, the uploads are
+// done by the thread owning the GL context through upload().
+class TextureLoader {
+public:
+  explicit TextureLoader(ThreadPool &pool = ThreadPool::global())
+      : _pool(&pool) {}
+
+  // Starts decoding in the background and returns right away
+  void decode(std::vector<TextureLoadRequest> requests);
+
+  size_t size() const { return this->_requests.size(); }
+  const TextureLoadRequest &request(size_t index) const {
+    return this->_requests[index];
+  }
+  bool is_decoded(size_t index) const;
+  // Waits for the decoding if needed, ownership goes to the caller. Decoding
+  // errors are rethrown here. See Texture2D for the uploader.
+  Texture2D *upload(size_t index, PixelUploader *uploader = nullptr);
+
+  // decode() + upload() of everything, same order as requests
+  std::vector<Texture2D *> load(std::vector<TextureLoadRequest> requests);
+
+private:
+  struct DecodeResult {
+    DecodedImage image;
+    long long decode_ms;
+  };
+
+  ThreadPool *_pool;
+  std::vector<TextureLoadRequest> _requests;
+  std::vector<std::future<DecodeResult>> _decoding;
+};
@@ -0,0 +1,46 @@
+#include "thread_pool.hpp"
+
+ThreadPool::ThreadPool(size_t worker_count) {
+  if (worker_count == 0)
+    worker_count = 1;
+
+  this->_workers.reserve(worker_count);
+  for (size_t i = 0; i < worker_count; i++)
+    this->_workers.emplace_back([this]() { this->worker_loop(); });
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    this->_stopping = true;
+  }
+  this->_cv.notify_all();
+  for (std::thread &worker : this->_workers)
+    worker.join();
+}
+
+ThreadPool &ThreadPool::global() {
+  static ThreadPool pool(std::thread::hardware_concurrency() > 1
+                             ? std::thread::hardware_concurrency() - 1
+                             : 1);
+  return pool;
+}
+
+void ThreadPool::worker_loop() {
+  while (true) {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(this->_mutex);
+      this->_cv.wait(lock, [this]() {
+        return this->_stopping || !this->_jobs.empty();
+      });
+      // pending jobs are still drained so no future is left broken
+      if (this->_jobs.empty())
+        return;
+
+      job = std::move(this->_jobs.front());
+      this->_jobs.pop();
+    }
+    job();
+  }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of workers fed through a single FIFO queue. Jobs must never touch
+// OpenGL, the context only lives on the main thread.
+class ThreadPool {
+public:
+  explicit ThreadPool(size_t worker_count);
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ~ThreadPool();
+
+  // Shared by the whole engine, sized on the hardware threads minus the one
+  // running the render loop
+  static ThreadPool &global();
+
+  template <typename F>
+  std::future<std::invoke_result_t<F>> submit(F &&job);
+
+  size_t worker_count() const { return this->_workers.size(); }
+
+private:
+  std::vector<std::thread> _workers;
+  std::queue<std::function<void()>> _jobs;
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  bool _stopping = false;
+
+  void worker_loop();
+};
+
+template <typename F>
+std::future<std::invoke_result_t<F>> ThreadPool::submit(F &&job) {
+  using R = std::invoke_result_t<F>;
+  // std::function needs a copyable callable, packaged_task is move only
+  auto task =
+      std::make_shared<std::packaged_task<R()>>(std::forward<F>(job));
+  std::future<R> result = task->get_future();
+  {
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    this->_jobs.emplace([task]() { (*task)(); });
+  }
+  this->_cv.notify_one();
+  return result;
+}
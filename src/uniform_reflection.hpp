@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <tuple>
+
+// Compile time description of the structs uploaded as plain uniforms, see
+// Shader::uniform_struct(). Each one specializes UniformReflection next to
+// its definition:
+//
+//   template <> struct UniformReflection<Foo> {
+//     static constexpr auto fields = std::make_tuple(
+//         UNIFORM_FIELD(Foo, color), UNIFORM_NESTED(Foo, attenuation));
+//   };
+
+// Uploaded with one glUniform*, offset from the start of the outer struct
+template <typename T> struct ReflectedField {
+  std::string_view name;
+  size_t offset;
+};
+
+// Member whose own fields sit at the same level in the GLSL struct
+template <typename T> struct ReflectedNested {
+  size_t offset;
+};
+
+template <typename T> struct UniformReflection;
+
+#define UNIFORM_FIELD(Struct, member)                                          \
+  ReflectedField<decltype(Struct::member)> { #member, offsetof(Struct, member) }
+#define UNIFORM_NESTED(Struct, member)                                         \
+  ReflectedNested<decltype(Struct::member)> { offsetof(Struct, member) }
+
+template <typename T> constexpr auto reflected_fields(size_t base = 0);
+
+template <typename T>
+constexpr auto flatten_field(const ReflectedField<T> &field, size_t base) {
+  return std::make_tuple(ReflectedField<T>{field.name, base + field.offset});
+}
+
+template <typename T>
+constexpr auto flatten_field(const ReflectedNested<T> &field, size_t base) {
+  return reflected_fields<T>(base + field.offset);
+}
+
+// Every leaf of T, nested members flattened, in declaration order
+template <typename T> constexpr auto reflected_fields(size_t base) {
+  return std::apply(
+      [base](const auto &...fields) {
+        return std::tuple_cat(flatten_field(fields, base)...);
+      },
+      UniformReflection<T>::fields);
+}
+
+template <typename T>
+constexpr size_t reflected_field_count =
+    std::tuple_size_v<decltype(reflected_fields<T>())>;
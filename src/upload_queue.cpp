@@ -0,0 +1,47 @@
+#include "upload_queue.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+UploadQueue &UploadQueue::global() {
+  static UploadQueue queue;
+  return queue;
+}
+
+void UploadQueue::cancel(const void *owner) {
+  this->_jobs.erase(std::remove_if(this->_jobs.begin(), this->_jobs.end(),
+                                   [owner](const UploadJob &job) {
+                                     return job.owner == owner;
+                                   }),
+                    this->_jobs.end());
+}
+
+void UploadQueue::drain() {
+  using clock = std::chrono::high_resolution_clock;
+  const auto start = clock::now();
+  auto elapsed_ms = [start]() {
+    return std::chrono::duration<double, std::milli>(clock::now() - start)
+        .count();
+  };
+
+  size_t bytes = 0;
+  bool first = true;
+  for (auto it = this->_jobs.begin(); it != this->_jobs.end();) {
+    if (!first && (bytes >= this->_budget.max_bytes ||
+                   elapsed_ms() >= this->_budget.max_ms))
+      break;
+
+    if (!it->ready()) {
+      ++it;
+      continue;
+    }
+
+    UploadJob job = std::move(*it);
+    it = this->_jobs.erase(it);
+    bytes += job.run();
+    first = false;
+  }
+
+  this->_last_bytes = bytes;
+  this->_last_ms = elapsed_ms();
+}
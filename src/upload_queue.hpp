@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+
+// Per frame limit, whichever is reached first stops the drain
+struct UploadBudget {
+  double max_ms = 2.0;
+  size_t max_bytes = 32 * 1024 * 1024;
+};
+
+struct UploadJob {
+  // used to cancel every job of a destroyed object
+  const void *owner;
+  // jobs that are not ready yet are skipped, not waited on
+  std::function<bool()> ready;
+  // runs on the GL thread, returns the number of bytes sent to the GPU
+  std::function<size_t()> run;
+};
+
+// GPU uploads spread over several frames. Main thread only: push/drain/cancel
+// are not synchronized and jobs must not push new jobs while running.
+class UploadQueue {
+public:
+  static UploadQueue &global();
+
+  void push(UploadJob job) { this->_jobs.push_back(std::move(job)); }
+  void cancel(const void *owner);
+  // Runs ready jobs in FIFO order until the budget is spent. At least one
+  // job always goes through so a big texture can't stall the queue forever.
+  void drain();
+
+  size_t pending() const { return this->_jobs.size(); }
+  // stats of the last drain
+  size_t last_uploaded_bytes() const { return this->_last_bytes; }
+  double last_upload_ms() const { return this->_last_ms; }
+
+  UploadBudget &budget() { return this->_budget; }
+
+private:
+  std::deque<UploadJob> _jobs;
+  UploadBudget _budget;
+  size_t _last_bytes = 0;
+  double _last_ms = 0;
+};
@@ -0,0 +1,76 @@
+#include "vertex_conversion.hpp"
+
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Vertex is written as two 16 bytes halves: position.xyz normal.x | normal.yz
+// uv.xy
+static_assert(sizeof(Vertex) == 8 * sizeof(float),
+              "Vertex must stay 8 packed floats");
+
+static void convert_range(const float *positions, const float *normals,
+                          const float *uvs, size_t first, size_t count,
+                          float v_sign, Vertex *out) {
+  for (size_t i = first; i < count; i++) {
+    Vertex &vertex = out[i];
+    const float *position = positions + i * 3;
+    vertex.position = glm::vec3(position[0], position[1], position[2]);
+    vertex.normal = normals ? glm::vec3(normals[i * 3], normals[i * 3 + 1],
+                                        normals[i * 3 + 2])
+                            : glm::vec3(0.0f);
+    vertex.texture_coordinate =
+        uvs ? glm::vec2(uvs[i * 3], v_sign * uvs[i * 3 + 1])
+            : glm::vec2(0.0f);
+  }
+}
+
+void convert_vertices_scalar(const float *positions, const float *normals,
+                             const float *uvs, size_t count, bool flip_y,
+                             Vertex *out) {
+  convert_range(positions, normals, uvs, 0, count, flip_y ? -1.0f : 1.0f,
+                out);
+}
+
+void convert_vertices(const float *positions, const float *normals,
+                      const float *uvs, size_t count, bool flip_y,
+                      Vertex *out) {
+  const float v_sign = flip_y ? -1.0f : 1.0f;
+
+  size_t i = 0;
+#if defined(__SSE2__)
+  if (normals && uvs) {
+    // the output is written once and only read back by the upload, streaming
+    // stores keep it from evicting the source arrays
+    const bool aligned = reinterpret_cast<uintptr_t>(out) % 16 == 0;
+    const __m128 sign = _mm_set_ps(v_sign, 1.0f, 1.0f, 1.0f);
+    float *dst = reinterpret_cast<float *>(out);
+
+    // 16 bytes loads overread one float of the next triplet, so the last
+    // vertex goes through the scalar loop
+    for (; i + 1 < count; i++, dst += 8) {
+      const __m128 p = _mm_loadu_ps(positions + i * 3);
+      const __m128 n = _mm_loadu_ps(normals + i * 3);
+      const __m128 t = _mm_loadu_ps(uvs + i * 3);
+
+      const __m128 pz_nx = _mm_shuffle_ps(p, n, _MM_SHUFFLE(0, 0, 2, 2));
+      const __m128 lo = _mm_shuffle_ps(p, pz_nx, _MM_SHUFFLE(2, 0, 1, 0));
+      const __m128 hi =
+          _mm_mul_ps(_mm_shuffle_ps(n, t, _MM_SHUFFLE(1, 0, 2, 1)), sign);
+
+      if (aligned) {
+        _mm_stream_ps(dst, lo);
+        _mm_stream_ps(dst + 4, hi);
+      } else {
+        _mm_storeu_ps(dst, lo);
+        _mm_storeu_ps(dst + 4, hi);
+      }
+    }
+    _mm_sfence();
+  }
+#endif
+
+  convert_range(positions, normals, uvs, i, count, v_sign, out);
+}
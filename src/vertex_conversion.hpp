@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+
+#include "mesh.hpp"
+
+// Fills count vertices from the arrays of an imported mesh, xyz triplets as
+// aiVector3D stores them. normals and uvs may be null and come out zero,
+// only the xy of the uvs are kept, v negated when flip_y.
+// SSE2 when there are both normals and uvs, with streaming stores when out
+// is 16 bytes aligned.
+void convert_vertices(const float *positions, const float *normals,
+                      const float *uvs, size_t count, bool flip_y,
+                      Vertex *out);
+// One vertex at a time, what convert_vertices() falls back to
+void convert_vertices_scalar(const float *positions, const float *normals,
+                             const float *uvs, size_t count, bool flip_y,
+                             Vertex *out);